@@ -0,0 +1,598 @@
+/* Display-free microbenchmarks for the code paths of sierpinski and
+ * squares-wayland.
+ *
+ * Geometry generation runs on the CPU only.  The GL benchmarks render
+ * into a framebuffer object on a surfaceless EGL context (llvmpipe when
+ * there is no GPU), so nothing needs a compositor or an X server.
+ *
+ * Output is one CSV line per benchmark and parameter on stdout:
+ *
+ *   name,param,reps,items,min_ns,median_ns,mean_ns,ns_per_item
+ *
+ * where items is what the benchmark processes per repetition (triangles,
+ * draws) and ns_per_item is median_ns / items. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "geometry.h"
+#include "ifs.h"
+#include "trace.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+static int reps = 20, warmup = 3, max_depth = 14, gl_max_depth = 10;
+static size_t memory_budget = 256 << 20;
+
+static GLuint position_l,
+              projection_l,
+              model_l,
+              color_l;
+
+static const GLfloat triangle_up[] = {
+    0.0,     0.0,
+    1.0/2.0, sqrt(3)/2,
+    1.0,     0.0,
+    0.0,     0.0
+};
+
+static const GLfloat square[] = {
+     0.0f,  1.0f,
+    -1.0f,  1.0f,
+    -1.0f,  0.0f,
+     0.0f,  0.0f
+};
+
+static GLfloat projection[] = {
+    2.0f, 0.0f, 0.0f, -1.0f,
+    0.0f, 2.0f, 0.0f, -1.0f,
+    0.0f, 0.0f, 1.0f,  0.0f,
+    0.0f, 0.0f, 0.0f,  1.0f
+};
+
+static GLfloat model[] = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f
+};
+
+static GLfloat color[] = {1.0f, 0.0f, 1.0f, 1.0f};
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+typedef void (*bench_fn)(int param, void *data);
+
+/* warm up, then time reps repetitions of fn(param) and print one line */
+static void run(const char *name, int param, uint64_t items,
+                bench_fn fn, void *data) {
+    uint64_t *ns, sum = 0, t;
+    int i;
+
+    ns = calloc(reps, sizeof *ns);
+    assert(ns);
+
+    for (i = 0; i < warmup; i++)
+        fn(param, data);
+
+    for (i = 0; i < reps; i++) {
+        t = trace_now();
+        fn(param, data);
+        ns[i] = trace_now() - t;
+        sum += ns[i];
+    }
+
+    qsort(ns, reps, sizeof *ns, compare_u64);
+    printf("%s,%d,%d,%llu,%llu,%llu,%llu,%.3f\n",
+           name, param, reps,
+           (unsigned long long) items,
+           (unsigned long long) ns[0],
+           (unsigned long long) ns[reps / 2],
+           (unsigned long long) (sum / reps),
+           (double) ns[reps / 2] / (items ? items : 1));
+    fflush(stdout);
+
+    free(ns);
+}
+
+/* geometry */
+
+static volatile GLfloat sink;
+
+static void emit_sum(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    GLfloat *acc = data;
+
+    *acc += x + y + s;
+}
+
+static void bench_walk(int depth, void *data) {
+    GLfloat acc = 0;
+
+    sierpinski2(depth, emit_sum, &acc);
+    sink = acc;
+}
+
+static void bench_lines(int depth, void *data) {
+    sierpinski2_lines(depth, data);
+}
+
+static void bench_leaf_lines(int depth, void *data) {
+    sierpinski2_leaf_lines(depth, data);
+}
+
+static void bench_leaf_packed(int depth, void *data) {
+    sierpinski2_leaf_lines_packed(depth, data);
+}
+
+static struct ifs ifs_sierpinski;
+
+static void bench_ifs_lines(int depth, void *data) {
+    ifs_lines(&ifs_sierpinski, depth, data);
+}
+
+/* matrix setup, as done per call by draw_triangle() and draw_square() */
+
+static void emit_model(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    model[3] = x;
+    model[7] = y;
+    model[0] = s;
+    model[5] = s;
+    sink += model[0] + model[3] + model[7];
+}
+
+static void bench_matrix_cpu(int depth, void *data) {
+    sierpinski2(depth, emit_model, NULL);
+}
+
+static void emit_uniforms(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    model[3] = x;
+    model[7] = y;
+    model[0] = s;
+    model[5] = s;
+
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glUniform4fv(color_l, 1, color);
+}
+
+static void bench_matrix_upload(int depth, void *data) {
+    sierpinski2(depth, emit_uniforms, NULL);
+    glFinish();
+}
+
+static void bench_squares(int n, void *data) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        model[3] = i & 1;
+        model[7] = -(i >> 1 & 1);
+        model[0] = 1;
+        model[5] = 1;
+
+        glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+        glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+        glUniform4fv(color_l, 1, color);
+
+        glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, square);
+        glEnableVertexAttribArray(position_l);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+    model[3] = 0;
+    model[7] = 0;
+    glFinish();
+}
+
+/* GL submission */
+
+static void emit_draw(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    emit_uniforms(data, x, y, s);
+
+    glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, triangle_up);
+    glEnableVertexAttribArray(position_l);
+    glDrawArrays(GL_LINE_STRIP, 0, 4);
+}
+
+/* the way sierpinski draws today: one draw call per triangle */
+static void bench_submit_per_triangle(int depth, void *data) {
+    glClear(GL_COLOR_BUFFER_BIT);
+    sierpinski2(depth, emit_draw, NULL);
+    glFinish();
+}
+
+struct batch {
+    GLuint vbo;
+    GLsizei count;
+};
+
+/* all triangles from one vertex buffer in a single draw */
+static void bench_submit_batched(int depth, void *data) {
+    struct batch *b = data;
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    model[3] = 0;
+    model[7] = 0;
+    model[0] = 1;
+    model[5] = 1;
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glUniform4fv(color_l, 1, color);
+
+    glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+    glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(position_l);
+    glDrawArrays(GL_LINES, 0, b->count);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glFinish();
+}
+
+/* framebuffer formats: what -B changes in the clients, filling a panel
+ * sized colour buffer of each format with full screen layers and reading
+ * the result back, which stands in for the compositor or display
+ * controller reading the frame */
+
+#define PANEL_WIDTH 1920
+#define PANEL_HEIGHT 1080
+
+static const GLfloat unit_quad[] = {
+    0.0f, 0.0f,
+    1.0f, 0.0f,
+    1.0f, 1.0f,
+    0.0f, 1.0f
+};
+
+struct target {
+    GLuint fbo, rb;
+    GLenum read_format, read_type;
+    int dither;
+    void *pixels;
+};
+
+static int target_init(struct target *t, GLenum format, int dither) {
+    GLint read_format, read_type;
+
+    glGenFramebuffers(1, &t->fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glGenRenderbuffers(1, &t->rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, t->rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, format,
+                          PANEL_WIDTH, PANEL_HEIGHT);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, t->rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        return 0;
+
+    /* the format the target reads back in without conversion */
+    glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &read_format);
+    glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &read_type);
+    t->read_format = read_format;
+    t->read_type = read_type;
+    t->dither = dither;
+    t->pixels = malloc((size_t) PANEL_WIDTH * PANEL_HEIGHT * 4);
+
+    return t->pixels != NULL;
+}
+
+static void target_fini(struct target *t, GLuint fbo) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glDeleteFramebuffers(1, &t->fbo);
+    glDeleteRenderbuffers(1, &t->rb);
+    free(t->pixels);
+}
+
+static void bench_fill(int layers, void *data) {
+    struct target *t = data;
+    int i;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glViewport(0, 0, PANEL_WIDTH, PANEL_HEIGHT);
+    if (t->dither)
+        glEnable(GL_DITHER);
+    else
+        glDisable(GL_DITHER);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    model[3] = 0;
+    model[7] = 0;
+    model[0] = 1;
+    model[5] = 1;
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, unit_quad);
+    glEnableVertexAttribArray(position_l);
+
+    /* a colour off the 565 grid, for dithering to have work to do */
+    for (i = 0; i < layers; i++) {
+        glUniform4f(color_l, 0.3f + 0.01f * i, 0.45f, 0.6f, 1.0f);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+    glFinish();
+}
+
+static void bench_readback(int param, void *data) {
+    struct target *t = data;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, t->fbo);
+    glReadPixels(0, 0, PANEL_WIDTH, PANEL_HEIGHT,
+                 t->read_format, t->read_type, t->pixels);
+}
+
+static void bench_formats(void) {
+    static const struct {
+        const char *fill, *readback;
+        GLenum format;
+        int dither;
+        const char *extension;
+    } formats[] = {
+        { "fill_rgba8888", "readback_rgba8888", GL_RGBA8_OES, 0,
+          "GL_OES_rgb8_rgba8" },
+        { "fill_rgb565", "readback_rgb565", GL_RGB565, 0, NULL },
+        { "fill_rgb565_dither", NULL, GL_RGB565, 1, NULL }
+    };
+    static const int layers[] = { 1, 4, 16 };
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    uint64_t pixels = (uint64_t) PANEL_WIDTH * PANEL_HEIGHT;
+    struct target t;
+    GLint fbo;
+    int i, j;
+
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &fbo);
+
+    for (i = 0; i < (int) (sizeof formats / sizeof formats[0]); i++) {
+        if (formats[i].extension &&
+            (!extensions || !strstr(extensions, formats[i].extension))) {
+            fprintf(stderr, "%s: no %s, skipped\n", formats[i].fill,
+                    formats[i].extension);
+            continue;
+        }
+        memset(&t, 0, sizeof t);
+        if (!target_init(&t, formats[i].format, formats[i].dither)) {
+            fprintf(stderr, "%s: framebuffer incomplete, skipped\n",
+                    formats[i].fill);
+            target_fini(&t, fbo);
+            continue;
+        }
+
+        for (j = 0; j < (int) (sizeof layers / sizeof layers[0]); j++)
+            run(formats[i].fill, layers[j], layers[j] * pixels,
+                bench_fill, &t);
+        if (formats[i].readback)
+            run(formats[i].readback, 1, pixels, bench_readback, &t);
+
+        target_fini(&t, fbo);
+    }
+
+    glEnable(GL_DITHER);
+}
+
+static int init_gl(int width, int height) {
+    static const EGLint config_attribs[] = {
+        EGL_RED_SIZE, 1,
+        EGL_GREEN_SIZE, 1,
+        EGL_BLUE_SIZE, 1,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE
+    };
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+    static const char *src_v = "uniform mat4 projection;\n"
+                               "uniform mat4 model;\n"
+                               "uniform vec4 color_u;\n"
+
+                               "attribute vec2 position;\n"
+
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "color = color_u;\n"
+                                   "gl_Position = vec4(position, 0, 1) * model * projection;"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "gl_FragColor = color;"
+                               "}";
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+    EGLDisplay dpy;
+    EGLConfig conf;
+    EGLContext ctx;
+    EGLint major, minor, n;
+    GLuint s_v, s_f, p, fbo, rb;
+
+    get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+        eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!get_platform_display)
+        return 0;
+
+    dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                               EGL_DEFAULT_DISPLAY, NULL);
+    if (!dpy || !eglInitialize(dpy, &major, &minor))
+        return 0;
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+    if (!eglChooseConfig(dpy, config_attribs, &conf, 1, &n) || n < 1)
+        conf = NULL; /* EGL_KHR_no_config_context */
+
+    ctx = eglCreateContext(dpy, conf, EGL_NO_CONTEXT, context_attribs);
+    if (!ctx || !eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx))
+        return 0;
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glGenRenderbuffers(1, &rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA4, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        return 0;
+    glViewport(0, 0, width, height);
+
+    s_v = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(s_v, 1, &src_v, NULL);
+    glCompileShader(s_v);
+    s_f = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(s_f, 1, &src_f, NULL);
+    glCompileShader(s_f);
+
+    p = glCreateProgram();
+    glAttachShader(p, s_v);
+    glAttachShader(p, s_f);
+    glLinkProgram(p);
+    glUseProgram(p);
+
+    projection_l = glGetUniformLocation(p, "projection");
+    model_l = glGetUniformLocation(p, "model");
+    color_l = glGetUniformLocation(p, "color_u");
+    position_l = glGetAttribLocation(p, "position");
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    fprintf(stderr, "GL_RENDERER: %s\n", glGetString(GL_RENDERER));
+
+    return 1;
+}
+
+static void usage(int error_code) {
+    fprintf(stderr, "Usage: bench [OPTIONS]\n\n"
+            "  -r N\tTimed repetitions per benchmark (default 20)\n"
+            "  -w N\tUntimed warmup repetitions (default 3)\n"
+            "  -d N\tMaximum depth for geometry benchmarks (default 14)\n"
+            "  -D N\tMaximum depth for GL benchmarks (default 10)\n"
+            "  -m MB\tLargest flattened mesh to build (default 256)\n"
+            "  -n\tSkip the GL benchmarks\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
+}
+
+int main(int argc, char **argv) {
+    struct batch batch;
+    GLfloat *lines;
+    uint64_t n;
+    int i, depth, use_gl = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-r", argv[i]) == 0 && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (strcmp("-w", argv[i]) == 0 && i + 1 < argc)
+            warmup = atoi(argv[++i]);
+        else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc)
+            max_depth = atoi(argv[++i]);
+        else if (strcmp("-D", argv[i]) == 0 && i + 1 < argc)
+            gl_max_depth = atoi(argv[++i]);
+        else if (strcmp("-m", argv[i]) == 0 && i + 1 < argc)
+            memory_budget = (size_t) atoi(argv[++i]) << 20;
+        else if (strcmp("-n", argv[i]) == 0)
+            use_gl = 0;
+        else if (strcmp("-h", argv[i]) == 0)
+            usage(EXIT_SUCCESS);
+        else
+            usage(EXIT_FAILURE);
+    }
+
+    if (reps < 1 || warmup < 0)
+        usage(EXIT_FAILURE);
+
+    ifs_find(&ifs_sierpinski, "sierpinski");
+
+    printf("name,param,reps,items,min_ns,median_ns,mean_ns,ns_per_item\n");
+
+    for (depth = 1; depth <= max_depth; depth++)
+        run("geometry_walk", depth, sierpinski2_count(depth),
+            bench_walk, NULL);
+
+    for (depth = 1; depth <= max_depth; depth++) {
+        n = sierpinski2_count(depth);
+        if (n * 12 * sizeof *lines > memory_budget) {
+            fprintf(stderr, "geometry_lines: depth %d needs %llu MB, "
+                    "skipped (-m)\n", depth,
+                    (unsigned long long) (n * 12 * sizeof *lines >> 20));
+            break;
+        }
+        lines = malloc(n * 12 * sizeof *lines);
+        if (!lines)
+            break;
+        run("geometry_lines", depth, n, bench_lines, lines);
+        free(lines);
+    }
+
+    for (depth = 1; depth <= max_depth; depth++) {
+        n = sierpinski2_leaf_count(depth);
+        if (n * 12 * sizeof(GLfloat) > memory_budget)
+            break;
+        lines = malloc(n * 12 * sizeof(GLfloat));
+        if (!lines)
+            break;
+        run("geometry_leaf_lines", depth, n, bench_leaf_lines, lines);
+        if (depth <= SIERPINSKI_PACKED_MAX_DEPTH)
+            run("geometry_leaf_packed", depth, n, bench_leaf_packed, lines);
+        /* the same leaves through the generic engine */
+        run("geometry_ifs_lines", depth, n, bench_ifs_lines, lines);
+        free(lines);
+    }
+
+    for (depth = 1; depth <= max_depth; depth++)
+        run("matrix_setup", depth, sierpinski2_count(depth),
+            bench_matrix_cpu, NULL);
+
+    if (!use_gl)
+        return 0;
+
+    if (!init_gl(512, 512)) {
+        fprintf(stderr, "no surfaceless EGL context, skipping GL benchmarks\n");
+        return 0;
+    }
+
+    run("squares_submit", 4, 4, bench_squares, NULL);
+
+    bench_formats();
+    glViewport(0, 0, 512, 512);
+
+    for (depth = 1; depth <= gl_max_depth; depth++)
+        run("matrix_upload", depth, sierpinski2_count(depth),
+            bench_matrix_upload, NULL);
+
+    for (depth = 1; depth <= gl_max_depth; depth++)
+        run("submit_per_triangle", depth, sierpinski2_count(depth),
+            bench_submit_per_triangle, NULL);
+
+    glGenBuffers(1, &batch.vbo);
+    for (depth = 1; depth <= gl_max_depth; depth++) {
+        n = sierpinski2_count(depth);
+        if (n * 12 * sizeof *lines > memory_budget)
+            break;
+        lines = malloc(n * 12 * sizeof *lines);
+        if (!lines)
+            break;
+        batch.count = sierpinski2_lines(depth, lines);
+
+        glBindBuffer(GL_ARRAY_BUFFER, batch.vbo);
+        glBufferData(GL_ARRAY_BUFFER, n * 12 * sizeof *lines, lines,
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        free(lines);
+
+        run("submit_batched", depth, n, bench_submit_batched, &batch);
+    }
+    glDeleteBuffers(1, &batch.vbo);
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "dynres.h"
+#include "program.h"
+
+static const GLfloat quad[] = {
+    -1.0f, -1.0f,
+     1.0f, -1.0f,
+     1.0f,  1.0f,
+    -1.0f,  1.0f
+};
+
+void dynres_init(struct dynres *d, double target_ms) {
+    static const char *src_v = "uniform vec2 uv_scale;\n"
+
+                               "attribute vec2 position;\n"
+
+                               "varying vec2 uv;\n"
+
+                               "void main() {"
+                                   "uv = (position * 0.5 + 0.5) * uv_scale;\n"
+                                   "gl_Position = vec4(position, 0, 1);"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "uniform sampler2D source;\n"
+                               "uniform vec2 uv_max;\n"
+
+                               "varying vec2 uv;\n"
+
+                               "void main() {"
+                                   /* don't filter in texels outside the
+                                    * rendered sub-rectangle */
+                                   "gl_FragColor = texture2D(source, min(uv, uv_max));"
+                               "}";
+    GLint prev;
+
+    memset(d, 0, sizeof *d);
+    d->target_ms = target_ms;
+    d->frame_ms = target_ms;
+    d->scale = 1.0f;
+    d->min_scale = 0.25f;
+
+    d->program = program_create("dynres", src_v, src_f);
+    if (!d->program) {
+        fprintf(stderr, "dynres: disabled\n");
+        return;
+    }
+    d->enabled = 1;
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prev);
+    glUseProgram(d->program);
+
+    d->position_l = glGetAttribLocation(d->program, "position");
+    d->uv_scale_l = glGetUniformLocation(d->program, "uv_scale");
+    d->uv_max_l = glGetUniformLocation(d->program, "uv_max");
+    d->texture_l = glGetUniformLocation(d->program, "source");
+    glUniform1i(d->texture_l, 0);
+
+    glUseProgram(prev);
+
+    glGenFramebuffers(1, &d->fbo);
+    glGenTextures(1, &d->texture);
+    glGenRenderbuffers(1, &d->depth);
+}
+
+void dynres_fini(struct dynres *d) {
+    if (!d->enabled)
+        return;
+
+    glDeleteFramebuffers(1, &d->fbo);
+    glDeleteTextures(1, &d->texture);
+    glDeleteRenderbuffers(1, &d->depth);
+    glDeleteProgram(d->program);
+}
+
+void dynres_resize(struct dynres *d, int width, int height) {
+    GLenum status;
+
+    if (!d->enabled || (width == d->width && height == d->height))
+        return;
+
+    d->width = width;
+    d->height = height;
+
+    glBindTexture(GL_TEXTURE_2D, d->texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, d->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16,
+                          width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, d->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, d->texture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, d->depth);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "dynres framebuffer incomplete: 0x%x, disabled\n",
+                status);
+        d->enabled = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void dynres_begin(struct dynres *d) {
+    d->scaled_width = d->width * d->scale + 0.5f;
+    d->scaled_height = d->height * d->scale + 0.5f;
+    if (d->scaled_width < 1)
+        d->scaled_width = 1;
+    if (d->scaled_height < 1)
+        d->scaled_height = 1;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, d->fbo);
+    glViewport(0, 0, d->scaled_width, d->scaled_height);
+}
+
+void dynres_end(struct dynres *d) {
+    GLint prev;
+    GLboolean depth_test;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, d->width, d->height);
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prev);
+    depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(d->program);
+    glUniform2f(d->uv_scale_l,
+                (GLfloat) d->scaled_width / d->width,
+                (GLfloat) d->scaled_height / d->height);
+    glUniform2f(d->uv_max_l,
+                (d->scaled_width - 0.5f) / d->width,
+                (d->scaled_height - 0.5f) / d->height);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, d->texture);
+    glVertexAttribPointer(d->position_l, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    glEnableVertexAttribArray(d->position_l);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glUseProgram(prev);
+    if (depth_test)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void dynres_update(struct dynres *d, double frame_ms) {
+    float desired;
+
+    /* smooth out single slow frames */
+    d->frame_ms = 0.8 * d->frame_ms + 0.2 * frame_ms;
+
+    /* don't chase noise around the target */
+    if (fabs(d->frame_ms - d->target_ms) < 0.1 * d->target_ms)
+        return;
+
+    /* fill cost goes with the pixel count, i.e. with scale^2; move a
+     * quarter of the way towards the scale that would hit the target */
+    desired = d->scale * sqrt(d->target_ms / d->frame_ms);
+    d->scale += 0.25f * (desired - d->scale);
+
+    if (d->scale < d->min_scale)
+        d->scale = d->min_scale;
+    if (d->scale > 1.0f)
+        d->scale = 1.0f;
+}
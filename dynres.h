@@ -0,0 +1,43 @@
+#ifndef DYNRES_H
+#define DYNRES_H
+
+#include <GLES2/gl2.h>
+
+/* Dynamic resolution: the scene is rendered into an offscreen colour
+ * texture at a fraction of the surface size and stretched onto the
+ * surface.  The fraction is adjusted every frame to keep the measured
+ * frame time near a target, so under fill-rate pressure the picture gets
+ * blurrier instead of the frame rate dropping.
+ *
+ * The texture is allocated at full surface size and only the lower left
+ * scale * size sub-rectangle is rendered to, so changing the scale never
+ * reallocates anything. */
+struct dynres {
+    int enabled;
+    double target_ms, frame_ms;
+    float scale, min_scale;
+
+    int width, height;
+    int scaled_width, scaled_height;
+
+    GLuint fbo, texture, depth;
+    GLuint program;
+    GLint position_l, uv_scale_l, uv_max_l, texture_l;
+};
+
+void dynres_init(struct dynres *d, double target_ms);
+void dynres_fini(struct dynres *d);
+
+/* (re)allocate the offscreen target for a surface of width x height */
+void dynres_resize(struct dynres *d, int width, int height);
+
+/* bind the offscreen target with a viewport of the current scale */
+void dynres_begin(struct dynres *d);
+
+/* upscale the offscreen target onto the default framebuffer */
+void dynres_end(struct dynres *d);
+
+/* feed the time the frame took, excluding any wait for vblank */
+void dynres_update(struct dynres *d, double frame_ms);
+
+#endif
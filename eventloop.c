@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "eventloop.h"
+#include "trace.h"
+
+enum source {
+    SOURCE_DISPLAY,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL
+};
+
+static int watch(struct event_loop *l, int fd, enum source source) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = source };
+
+    return epoll_ctl(l->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int event_loop_init(struct event_loop *l) {
+    sigset_t mask;
+
+    memset(l, 0, sizeof *l);
+    l->timer_fd = l->signal_fd = -1;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    l->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    l->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    l->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                 TFD_NONBLOCK | TFD_CLOEXEC);
+    if (l->epoll_fd < 0 || l->signal_fd < 0 || l->timer_fd < 0 ||
+        watch(l, l->signal_fd, SOURCE_SIGNAL) < 0 ||
+        watch(l, l->timer_fd, SOURCE_TIMER) < 0) {
+        fprintf(stderr, "event loop: %s\n", strerror(errno));
+        event_loop_fini(l);
+        return -1;
+    }
+
+    l->start_ns = trace_now();
+
+    return 0;
+}
+
+void event_loop_fini(struct event_loop *l) {
+    if (l->epoll_fd >= 0)
+        close(l->epoll_fd);
+    if (l->timer_fd >= 0)
+        close(l->timer_fd);
+    if (l->signal_fd >= 0)
+        close(l->signal_fd);
+    l->epoll_fd = l->timer_fd = l->signal_fd = -1;
+}
+
+/* EPOLLOUT only while a flush is pending, or epoll_wait() would return
+ * at once every time the socket has room */
+static void watch_display(struct event_loop *l, int writing) {
+    struct epoll_event ev = {
+        .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+        .data.u32 = SOURCE_DISPLAY
+    };
+
+    if (writing == l->writing)
+        return;
+    epoll_ctl(l->epoll_fd, EPOLL_CTL_MOD, wl_display_get_fd(l->display),
+              &ev);
+    l->writing = writing;
+}
+
+/* 0 once everything queued has been sent, 1 if the socket is full and
+ * the rest waits for EPOLLOUT, -1 if the connection broke */
+static int flush(struct event_loop *l) {
+    if (wl_display_flush(l->display) >= 0) {
+        watch_display(l, 0);
+        return 0;
+    }
+    if (errno != EAGAIN)
+        return -1;
+    watch_display(l, 1);
+    return 1;
+}
+
+void event_loop_add_display(struct event_loop *l, struct wl_display *display) {
+    l->display = display;
+    watch(l, wl_display_get_fd(display), SOURCE_DISPLAY);
+}
+
+void event_loop_set_tick(struct event_loop *l, uint64_t tick_ns) {
+    struct itimerspec its = { 0 };
+
+    its.it_interval.tv_sec = tick_ns / 1000000000;
+    its.it_interval.tv_nsec = tick_ns % 1000000000;
+    its.it_value = its.it_interval;
+    timerfd_settime(l->timer_fd, 0, &its, NULL);
+
+    l->tick_ns = tick_ns;
+}
+
+static void read_timer(struct event_loop *l) {
+    uint64_t expirations;
+
+    if (read(l->timer_fd, &expirations, sizeof expirations) ==
+        sizeof expirations) {
+        l->ticks += expirations;
+        l->time_ns = l->ticks * l->tick_ns;
+    }
+}
+
+static void read_signals(struct event_loop *l) {
+    struct signalfd_siginfo si;
+
+    while (read(l->signal_fd, &si, sizeof si) == sizeof si)
+        l->quit = 1;
+}
+
+void event_loop_wait(struct event_loop *l, int timeout_ms) {
+    TRACE_SCOPE("event_loop_wait");
+    struct epoll_event events[3];
+    int i, n, readable = 0;
+    uint64_t start;
+
+    /* events EGL read for us while swapping */
+    while (wl_display_prepare_read(l->display) != 0)
+        wl_display_dispatch_pending(l->display);
+
+    if (flush(l) < 0) {
+        wl_display_cancel_read(l->display);
+        l->quit = 1;
+        return;
+    }
+
+    start = trace_now();
+    do
+        n = epoll_wait(l->epoll_fd, events, 3, timeout_ms);
+    while (n < 0 && errno == EINTR);
+    if (timeout_ms != 0) {
+        l->sleep_ns += trace_now() - start;
+        l->wakeups++;
+        l->wakeups_total++;
+    }
+
+    for (i = 0; i < n; i++) {
+        switch (events[i].data.u32) {
+        case SOURCE_DISPLAY:
+            if (events[i].events & EPOLLOUT && flush(l) < 0)
+                l->quit = 1;
+            if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                readable = 1;
+            break;
+        case SOURCE_TIMER:
+            read_timer(l);
+            break;
+        case SOURCE_SIGNAL:
+            read_signals(l);
+            break;
+        }
+    }
+
+    if (readable) {
+        if (wl_display_read_events(l->display) < 0)
+            l->quit = 1;
+    } else {
+        wl_display_cancel_read(l->display);
+    }
+
+    if (wl_display_dispatch_pending(l->display) < 0)
+        l->quit = 1;
+}
+
+void event_loop_report(struct event_loop *l, int frames) {
+    uint64_t now = trace_now();
+
+    printf("event loop: %.2f wakeups/frame, asleep %.1f%% of the time",
+           frames ? (double) l->wakeups / frames : 0.0,
+           100.0 * l->sleep_ns / (now - l->start_ns));
+    if (l->tick_ns)
+        printf(", %llu ticks of %.2f ms", (unsigned long long) l->ticks,
+               l->tick_ns / 1e6);
+    printf("\n");
+
+    l->wakeups = 0;
+    l->sleep_ns = 0;
+    l->start_ns = now;
+}
@@ -0,0 +1,54 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+/* Main loop of the Wayland clients: one epoll set over the display fd, a
+ * timerfd and a signalfd, so the client sleeps in epoll_wait() until a
+ * frame callback, input or anything else arrives instead of blocking
+ * inside eglSwapBuffers() or spinning.
+ *
+ * The timer is the fixed timestep clock of the animation: it ticks every
+ * tick_ns once armed, and time_ns is the number of ticks so far times
+ * tick_ns, however irregular the frames are.  Missed ticks are caught up
+ * on the next wakeup, as timerfd counts expirations.
+ *
+ * SIGINT and SIGTERM are blocked and read from the signalfd, which sets
+ * quit.  event_loop_init() must come before any thread is started, so
+ * that the threads inherit the blocked mask; otherwise a signal could
+ * still be delivered to one of them the old way. */
+struct event_loop {
+    struct wl_display *display;
+    int epoll_fd, timer_fd, signal_fd;
+    uint64_t tick_ns, ticks, time_ns;
+    int quit;
+    /* a flush hit a full socket, so the display fd is also watched for
+     * EPOLLOUT until the rest is sent */
+    int writing;
+
+    /* accumulated since the last event_loop_report() */
+    uint64_t wakeups, sleep_ns, start_ns;
+    /* never reset, for metrics */
+    uint64_t wakeups_total;
+};
+
+/* -1 after printing why if it can't */
+int event_loop_init(struct event_loop *l);
+void event_loop_fini(struct event_loop *l);
+
+void event_loop_add_display(struct event_loop *l, struct wl_display *display);
+
+/* tick every tick_ns from now on, or stop ticking for 0 */
+void event_loop_set_tick(struct event_loop *l, uint64_t tick_ns);
+
+/* Flush, sleep for up to timeout_ms (-1 for as long as it takes, 0 not at
+ * all) until there is something to do and do it: read and dispatch
+ * Wayland events, send what the flush couldn't once the socket has room,
+ * count ticks, set quit on a signal or a lost connection. */
+void event_loop_wait(struct event_loop *l, int timeout_ms);
+
+void event_loop_report(struct event_loop *l, int frames);
+
+#endif
@@ -0,0 +1,106 @@
+/* Consumer end of the frame export of sierpinski -E (frameexport.h), as
+ * a starting point for a recorder or encoder and to measure the export.
+ *
+ * Takes the newest frame whenever one is published, writes it as raw
+ * RGBA straight from the shared ring if asked to, and prints how many
+ * frames arrived and how many it missed every few seconds.  -s makes it
+ * slow on purpose, to see the producer drop frames instead of waiting:
+ *
+ *   frame-consumer /tmp/sierpinski.sock -o - | ffmpeg -f rawvideo \
+ *       -pix_fmt rgba -s 500x500 -i - -vf vflip out.mp4
+ *
+ * Frames are bottom row first and change size with the window; the
+ * size is printed on stderr whenever it does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frameexport.h"
+#include "trace.h"
+
+static const int report_interval = 5;
+
+static void usage(int error_code) {
+    fprintf(stderr, "Usage: frame-consumer SOCKET [OPTIONS]\n\n"
+            "  -o FILE\tWrite the frames as raw RGBA to FILE, - for stdout\n"
+            "  -s MS\tSpend MS on every frame, like a slow encoder\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
+}
+
+int main(int argc, char **argv) {
+    struct frame_import c;
+    struct frame_slot *slot;
+    struct timespec slow = { 0 };
+    const char *path = NULL, *out_path = NULL;
+    uint32_t width = 0, height = 0;
+    uint64_t start, now;
+    FILE *out = NULL;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-o", argv[i]) == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp("-s", argv[i]) == 0 && i + 1 < argc)
+            slow.tv_nsec = atof(argv[++i]) * 1e6;
+        else if (strcmp("-h", argv[i]) == 0)
+            usage(EXIT_SUCCESS);
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+            usage(EXIT_FAILURE);
+    }
+
+    if (!path || slow.tv_nsec >= 1000000000)
+        usage(EXIT_FAILURE);
+
+    if (out_path) {
+        out = strcmp(out_path, "-") == 0 ? stdout : fopen(out_path, "wb");
+        if (!out) {
+            perror(out_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (frame_import_connect(&c, path) < 0)
+        exit(EXIT_FAILURE);
+
+    start = trace_now();
+
+    while ((slot = frame_import_next(&c))) {
+        if (c.ring->width != width || c.ring->height != height) {
+            width = c.ring->width;
+            height = c.ring->height;
+            fprintf(stderr, "frames are %ux%u\n", width, height);
+        }
+
+        if (out)
+            fwrite(frame_slot_pixels(c.ring, slot), c.ring->stride,
+                   height, out);
+        if (slow.tv_nsec)
+            nanosleep(&slow, NULL);
+
+        frame_import_release(&c, slot);
+
+        now = trace_now();
+        if (now - start >= report_interval * 1000000000ULL) {
+            fprintf(stderr, "%llu frames in %.1f seconds, %llu missed\n",
+                    (unsigned long long) c.frames, (now - start) / 1e9,
+                    (unsigned long long) c.dropped);
+            c.frames = 0;
+            c.dropped = 0;
+            start = now;
+        }
+    }
+
+    fprintf(stderr, "producer gone\n");
+
+    frame_import_close(&c);
+    if (out && out != stdout)
+        fclose(out);
+
+    return 0;
+}
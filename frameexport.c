@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "frameexport.h"
+
+static int unix_address(struct sockaddr_un *addr, const char *path) {
+    memset(addr, 0, sizeof *addr);
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof addr->sun_path) {
+        fprintf(stderr, "frame export: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+int frame_export_init(struct frame_export *e, const char *path) {
+    struct sockaddr_un addr;
+
+    memset(e, 0, sizeof *e);
+    e->listen_fd = e->client_fd = e->ring_fd = -1;
+
+    if (unix_address(&addr, path) < 0)
+        return -1;
+
+    e->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+                          SOCK_CLOEXEC, 0);
+    unlink(path);
+    if (e->listen_fd < 0 ||
+        bind(e->listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+        listen(e->listen_fd, 1) < 0) {
+        fprintf(stderr, "frame export %s: %s\n", path, strerror(errno));
+        if (e->listen_fd >= 0)
+            close(e->listen_fd);
+        e->listen_fd = -1;
+        return -1;
+    }
+
+    e->path = path;
+    e->enabled = 1;
+    printf("frame export: listening on %s\n", path);
+
+    return 0;
+}
+
+static void drop_ring(struct frame_export *e) {
+    if (e->ring)
+        munmap(e->ring, e->size);
+    if (e->ring_fd >= 0)
+        close(e->ring_fd);
+    e->ring = NULL;
+    e->ring_fd = -1;
+    e->size = 0;
+}
+
+static void disconnect(struct frame_export *e) {
+    close(e->client_fd);
+    e->client_fd = -1;
+    printf("frame export: consumer gone\n");
+}
+
+void frame_export_fini(struct frame_export *e) {
+    if (!e->enabled)
+        return;
+
+    if (e->client_fd >= 0)
+        close(e->client_fd);
+    close(e->listen_fd);
+    unlink(e->path);
+    drop_ring(e);
+    e->enabled = 0;
+}
+
+/* The consumer keeps its own mapping of the old ring until it gets the
+ * new one.  Without a ring there is nothing to export into until the
+ * next resize, which may never come, so a failure turns export off. */
+static int new_ring(struct frame_export *e, int width, int height) {
+    size_t header, one;
+    int i;
+
+    drop_ring(e);
+
+    header = (sizeof *e->ring + 63) & ~(size_t) 63;
+    one = ((size_t) width * 4 * height + 63) & ~(size_t) 63;
+    e->size = header + one * FRAME_EXPORT_SLOTS;
+
+    /* sealed, so neither side can truncate it under the other's
+     * mapping */
+    e->ring_fd = memfd_create("frame-export", MFD_CLOEXEC |
+                              MFD_ALLOW_SEALING);
+    if (e->ring_fd < 0 || ftruncate(e->ring_fd, e->size) < 0 ||
+        fcntl(e->ring_fd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        fprintf(stderr, "frame export: %s, turned off\n", strerror(errno));
+        frame_export_fini(e);
+        return -1;
+    }
+
+    e->ring = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   e->ring_fd, 0);
+    if (e->ring == MAP_FAILED) {
+        fprintf(stderr, "frame export: mmap: %s, turned off\n",
+                strerror(errno));
+        e->ring = NULL;
+        frame_export_fini(e);
+        return -1;
+    }
+
+    e->ring->magic = FRAME_EXPORT_MAGIC;
+    e->ring->version = FRAME_EXPORT_VERSION;
+    e->ring->width = width;
+    e->ring->height = height;
+    e->ring->stride = width * 4;
+    e->ring->format = FRAME_FORMAT_RGBA_BOTTOM_UP;
+    e->ring->n_slots = FRAME_EXPORT_SLOTS;
+    for (i = 0; i < FRAME_EXPORT_SLOTS; i++)
+        e->ring->slots[i].offset = header + i * one;
+
+    e->width = width;
+    e->height = height;
+    e->ring_pending = 1;
+    e->ring_shared = 0;
+
+    return 0;
+}
+
+int frame_export_resize(struct frame_export *e, int width, int height) {
+    if (!e->enabled || (width == e->width && height == e->height))
+        return 0;
+
+    return new_ring(e, width, height);
+}
+
+/* 1 if sent, 0 if the socket is full, -1 if the consumer went away */
+static int send_msg(struct frame_export *e,
+                    enum frame_msg_type type,
+                    uint64_t seq,
+                    int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct frame_msg msg = { type, 0, seq };
+    struct iovec iov = { &msg, sizeof msg };
+    struct msghdr m = { 0 };
+    struct cmsghdr *cmsg;
+
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    if (fd >= 0) {
+        memset(control, 0, sizeof control);
+        m.msg_control = control;
+        m.msg_controllen = sizeof control;
+        cmsg = CMSG_FIRSTHDR(&m);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+    }
+
+    if (sendmsg(e->client_fd, &m, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+        return 1;
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+
+    disconnect(e);
+    return -1;
+}
+
+static void poll_consumer(struct frame_export *e) {
+    int fd;
+
+    /* the newest consumer replaces any other */
+    fd = accept4(e->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd >= 0) {
+        if (e->client_fd >= 0)
+            disconnect(e);
+        e->client_fd = fd;
+        e->ring_pending = 1;
+        printf("frame export: consumer connected\n");
+
+        /* slots the last one still held would stay locked for good */
+        if (e->ring_shared)
+            new_ring(e, e->width, e->height);
+    }
+
+    if (e->client_fd >= 0 && e->ring && e->ring_pending &&
+        send_msg(e, FRAME_MSG_RING, e->ring->latest, e->ring_fd) > 0) {
+        e->ring_pending = 0;
+        e->ring_shared = 1;
+    }
+}
+
+void *frame_export_begin(struct frame_export *e) {
+    struct frame_slot *s, *oldest = NULL;
+    uint32_t expected = FRAME_SLOT_FREE;
+    int i;
+
+    if (!e->enabled)
+        return NULL;
+
+    poll_consumer(e);
+    if (e->client_fd < 0 || !e->ring || e->ring_pending)
+        return NULL;
+
+    /* the newest frame stays put, so the consumer can always get it */
+    for (i = 0; i < FRAME_EXPORT_SLOTS; i++) {
+        s = &e->ring->slots[i];
+        if (s->seq && s->seq == e->ring->latest)
+            continue;
+        if (__atomic_load_n(&s->lock, __ATOMIC_ACQUIRE) != FRAME_SLOT_FREE)
+            continue;
+        if (!oldest || s->seq < oldest->seq)
+            oldest = s;
+    }
+
+    if (!oldest ||
+        !__atomic_compare_exchange_n(&oldest->lock, &expected,
+                                     FRAME_SLOT_WRITING, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        e->skipped++;
+        return NULL;
+    }
+
+    e->writing = oldest - e->ring->slots;
+
+    return frame_slot_pixels(e->ring, oldest);
+}
+
+void frame_export_end(struct frame_export *e, uint64_t time_ns) {
+    struct frame_slot *s = &e->ring->slots[e->writing];
+
+    /* frame_import_next() looks for the latest frame by seq without
+     * taking the lock */
+    __atomic_store_n(&s->seq, ++e->seq, __ATOMIC_RELEASE);
+    s->time_ns = time_ns;
+    __atomic_store_n(&s->lock, FRAME_SLOT_FREE, __ATOMIC_RELEASE);
+    __atomic_store_n(&e->ring->latest, e->seq, __ATOMIC_RELEASE);
+    e->frames++;
+
+    /* if the socket is full the consumer is behind on wakeups and will
+     * find this frame through latest anyway */
+    send_msg(e, FRAME_MSG_FRAME, e->seq, -1);
+}
+
+void frame_export_report(struct frame_export *e) {
+    uint64_t consumed;
+
+    if (!e->enabled || !e->ring)
+        return;
+
+    consumed = __atomic_load_n(&e->ring->consumed, __ATOMIC_RELAXED);
+    printf("frame export: %llu frames, readback %.2f ms/frame, %llu "
+           "skipped, consumer %llu frames behind\n",
+           (unsigned long long) e->frames,
+           e->frames ? e->readback_ns / 1e6 / e->frames : 0.0,
+           (unsigned long long) e->skipped,
+           (unsigned long long) (consumed ? e->ring->latest - consumed : 0));
+
+    e->frames = 0;
+    e->skipped = 0;
+    e->readback_ns = 0;
+}
+
+int frame_import_connect(struct frame_import *c, const char *path) {
+    struct sockaddr_un addr;
+
+    memset(c, 0, sizeof *c);
+
+    if (unix_address(&addr, path) < 0)
+        return -1;
+
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 ||
+        connect(c->fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        fprintf(stderr, "frame import %s: %s\n", path, strerror(errno));
+        if (c->fd >= 0)
+            close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void frame_import_close(struct frame_import *c) {
+    if (c->ring)
+        munmap(c->ring, c->size);
+    if (c->fd >= 0)
+        close(c->fd);
+    c->ring = NULL;
+    c->fd = -1;
+}
+
+static int map_ring(struct frame_import *c, int fd) {
+    struct frame_ring *ring;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof *ring)
+        return -1;
+
+    ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+    if (ring == MAP_FAILED)
+        return -1;
+
+    if (ring->magic != FRAME_EXPORT_MAGIC ||
+        ring->version != FRAME_EXPORT_VERSION) {
+        munmap(ring, st.st_size);
+        return -1;
+    }
+
+    if (c->ring)
+        munmap(c->ring, c->size);
+    c->ring = ring;
+    c->size = st.st_size;
+
+    return 0;
+}
+
+/* wait for one message, -1 once the producer is gone */
+static int receive(struct frame_import *c) {
+    char control[CMSG_SPACE(sizeof(int))];
+    struct frame_msg msg;
+    struct iovec iov = { &msg, sizeof msg };
+    struct msghdr m = { 0 };
+    struct cmsghdr *cmsg;
+    int fd = -1, ret = 0;
+
+    m.msg_iov = &iov;
+    m.msg_iovlen = 1;
+    m.msg_control = control;
+    m.msg_controllen = sizeof control;
+
+    if (recvmsg(c->fd, &m, MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+
+    for (cmsg = CMSG_FIRSTHDR(&m); cmsg; cmsg = CMSG_NXTHDR(&m, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof fd);
+    }
+
+    if (msg.type == FRAME_MSG_RING) {
+        if (fd < 0 || map_ring(c, fd) < 0) {
+            fprintf(stderr, "frame import: bad ring\n");
+            ret = -1;
+        }
+    }
+    if (fd >= 0)
+        close(fd);
+
+    return ret;
+}
+
+struct frame_slot *frame_import_next(struct frame_import *c) {
+    uint32_t expected;
+    uint64_t latest;
+    struct frame_slot *s;
+    int i;
+
+    for (;;) {
+        latest = c->ring ? __atomic_load_n(&c->ring->latest,
+                                           __ATOMIC_ACQUIRE) : 0;
+
+        for (i = 0; latest > c->last && i < FRAME_EXPORT_SLOTS; i++) {
+            s = &c->ring->slots[i];
+            if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != latest)
+                continue;
+
+            expected = FRAME_SLOT_FREE;
+            if (!__atomic_compare_exchange_n(&s->lock, &expected,
+                                             FRAME_SLOT_READING, 0,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_RELAXED))
+                break;
+
+            /* reused for a newer frame before we got the lock */
+            if (s->seq != latest) {
+                frame_import_release(c, s);
+                break;
+            }
+
+            if (c->last)
+                c->dropped += latest - c->last - 1;
+            c->last = latest;
+            c->frames++;
+            __atomic_store_n(&c->ring->consumed, latest, __ATOMIC_RELAXED);
+
+            return s;
+        }
+
+        /* try again straight away if we only lost a race */
+        if (c->ring && latest > c->last &&
+            __atomic_load_n(&c->ring->latest, __ATOMIC_ACQUIRE) != latest)
+            continue;
+
+        if (receive(c) < 0)
+            return NULL;
+    }
+}
+
+void frame_import_release(struct frame_import *c, struct frame_slot *slot) {
+    __atomic_store_n(&slot->lock, FRAME_SLOT_FREE, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,122 @@
+#ifndef FRAMEEXPORT_H
+#define FRAMEEXPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FRAME_EXPORT_MAGIC 0x58454746 /* "FGEX" */
+#define FRAME_EXPORT_VERSION 1
+#define FRAME_EXPORT_SLOTS 4
+
+/* Frame export to a local consumer, such as a recorder or encoder, with
+ * no copies beyond the readback itself.
+ *
+ * Frames go into a ring of FRAME_EXPORT_SLOTS slots in one memfd,
+ * which the producer hands to the consumer over a SOCK_SEQPACKET Unix
+ * socket (SCM_RIGHTS).  Both map it, so the consumer reads frames in
+ * place.  After each frame a FRAME_MSG_FRAME message with its sequence
+ * number wakes the consumer; a new memfd after a resize comes with
+ * FRAME_MSG_RING.
+ *
+ * Each slot's lock word is the fence between the two processes: the
+ * producer takes a slot FREE -> WRITING and the consumer FREE ->
+ * READING, both by compare and swap, so neither ever sees a half written
+ * frame.  The producer writes into the oldest free slot, never the newest
+ * frame's, and never waits: if the consumer is slow it misses frames,
+ * which show up as gaps in the sequence numbers.
+ *
+ * A consumer that goes away may leave slots locked for reading, so
+ * every new consumer gets a ring of its own, never one an earlier
+ * consumer had. */
+enum frame_slot_lock {
+    FRAME_SLOT_FREE,
+    FRAME_SLOT_WRITING,
+    FRAME_SLOT_READING
+};
+
+/* RGBA8888 as glReadPixels() returns it, bottom row first */
+#define FRAME_FORMAT_RGBA_BOTTOM_UP 1
+
+struct frame_slot {
+    uint32_t lock;
+    uint32_t pad;
+    uint64_t seq;      /* frame in the slot, 0 for none yet */
+    uint64_t time_ns;  /* of the frame, on the producer's frame clock */
+    uint64_t offset;   /* of the pixels from the start of the ring */
+};
+
+/* at offset 0 of the memfd, followed by the pixels of every slot */
+struct frame_ring {
+    uint32_t magic, version;
+    uint32_t width, height, stride, format;
+    uint32_t n_slots, pad;
+    uint64_t latest;   /* newest complete frame */
+    uint64_t consumed; /* newest frame the consumer took, set by it */
+    struct frame_slot slots[FRAME_EXPORT_SLOTS];
+};
+
+enum frame_msg_type {
+    FRAME_MSG_RING = 1,
+    FRAME_MSG_FRAME
+};
+
+struct frame_msg {
+    uint32_t type;
+    uint32_t pad;
+    uint64_t seq;
+};
+
+/* producer */
+struct frame_export {
+    int enabled;
+    const char *path;
+    int listen_fd, client_fd, ring_fd;
+    struct frame_ring *ring;
+    size_t size;
+    int width, height, writing, ring_pending, ring_shared;
+    uint64_t seq;
+
+    /* accumulated since the last frame_export_report() */
+    uint64_t frames, skipped, readback_ns;
+};
+
+/* listen on the Unix socket path; -1 after printing why if it can't */
+int frame_export_init(struct frame_export *e, const char *path);
+void frame_export_fini(struct frame_export *e);
+
+/* a new ring for width x height frames, if that changed; -1 after
+ * printing why if it can't make one, which turns export off */
+int frame_export_resize(struct frame_export *e, int width, int height);
+
+/* Pixels of a free slot to write the next frame into, or NULL if no
+ * consumer is connected or it holds every slot but the newest. */
+void *frame_export_begin(struct frame_export *e);
+
+/* publish the frame written since frame_export_begin() */
+void frame_export_end(struct frame_export *e, uint64_t time_ns);
+
+void frame_export_report(struct frame_export *e);
+
+/* consumer */
+struct frame_import {
+    int fd;
+    struct frame_ring *ring;
+    size_t size;
+    uint64_t last, frames, dropped;
+};
+
+int frame_import_connect(struct frame_import *c, const char *path);
+void frame_import_close(struct frame_import *c);
+
+/* Wait for a frame newer than the last one taken and lock its slot for
+ * reading; NULL once the producer goes away.  The slot stays valid until
+ * frame_import_release(), which must come before the next call. */
+struct frame_slot *frame_import_next(struct frame_import *c);
+void frame_import_release(struct frame_import *c, struct frame_slot *slot);
+
+static inline void *frame_slot_pixels(struct frame_ring *ring,
+                                      struct frame_slot *slot) {
+    return (char *) ring + slot->offset;
+}
+
+#endif
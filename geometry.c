@@ -0,0 +1,205 @@
+#include <math.h>
+#include <string.h>
+
+#include "geometry.h"
+
+void sierpinski2_(GLfloat x,
+                  GLfloat y,
+                  uint64_t i,
+                  uint64_t m,
+                  triangle_fn emit,
+                  void *data) {
+    if (i > m) return;
+
+    emit(data, x, y, 1.0 / pow(2, i));
+
+    i++;
+
+    sierpinski2_(x, y, i, m, emit, data);
+    sierpinski2_(x + 1.0 / pow(2, i), y, i, m, emit, data);
+    sierpinski2_(x + 1.0 / pow(2, i + 1), y + sqrt(3) / pow(2, i + 1), i, m,
+                 emit, data);
+}
+
+void sierpinski2(uint64_t m, triangle_fn emit, void *data) {
+    sierpinski2_(0, 0, 0, m, emit, data);
+}
+
+uint64_t sierpinski2_count(uint64_t m) {
+    uint64_t n = 1, level = 1;
+
+    while (m--) {
+        level *= 3;
+        n += level;
+    }
+
+    return n;
+}
+
+static void emit_lines(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    GLfloat **out = data;
+    GLfloat *v = *out;
+    GLfloat hx = x + s / 2, hy = y + s * sqrt(3) / 2;
+
+    /* the three edges of triangle_up scaled by s */
+    v[0] = x;   v[1] = y;   v[2] = hx;    v[3] = hy;
+    v[4] = hx;  v[5] = hy;  v[6] = x + s; v[7] = y;
+    v[8] = x + s; v[9] = y; v[10] = x;    v[11] = y;
+
+    *out = v + 12;
+}
+
+size_t sierpinski2_lines(uint64_t m, GLfloat *out) {
+    GLfloat *end = out;
+
+    if (m > SIERPINSKI_FLOAT_MAX_DEPTH)
+        return 0;
+
+    sierpinski2(m, emit_lines, &end);
+
+    return (end - out) / 2;
+}
+
+uint64_t sierpinski2_leaf_count(uint64_t m) {
+    uint64_t n = 1;
+
+    while (m--)
+        n *= 3;
+
+    return n;
+}
+
+/* Both generators below visit the leaf cells row by row: for each b the
+ * valid a are the submasks of ~b, walked in increasing order with
+ * a = (a - rest) & rest until it wraps back to 0. */
+
+size_t sierpinski2_leaf_lines(uint64_t m, GLfloat *out) {
+    GLfloat s, h = sqrt(3) / 2;
+    GLfloat x0, y0, x1, x2, y2;
+    GLfloat *v = out;
+    uint32_t n, a, b, rest;
+
+    if (m > SIERPINSKI_FLOAT_MAX_DEPTH)
+        return 0;
+    n = 1u << m;
+    s = 1.0 / n;
+
+    for (b = 0; b < n; b++) {
+        rest = ~b & (n - 1);
+        a = 0;
+        do {
+            x0 = (a + b * 0.5f) * s;
+            y0 = b * h * s;
+            x1 = x0 + s;
+            x2 = x0 + s * 0.5f;
+            y2 = y0 + h * s;
+
+            v[0] = x0;  v[1] = y0;  v[2] = x1;   v[3] = y0;
+            v[4] = x1;  v[5] = y0;  v[6] = x2;   v[7] = y2;
+            v[8] = x2;  v[9] = y2;  v[10] = x0;  v[11] = y0;
+            v += 12;
+
+            a = (a - rest) & rest;
+        } while (a);
+    }
+
+    return (v - out) / 2;
+}
+
+/* copies 1 and 2 first, so that copy 0 can overwrite in when out is
+ * in */
+size_t sierpinski2_next_level_lines(uint64_t m,
+                                    const GLfloat *in,
+                                    size_t n,
+                                    GLfloat *out) {
+    GLfloat *out1 = out + 2 * n, *out2 = out + 4 * n;
+    GLfloat dx2 = 0.25f, dy2 = sqrt(3) / 4;
+    size_t p;
+
+    if (m + 1 > SIERPINSKI_FLOAT_MAX_DEPTH)
+        return 0;
+
+#pragma GCC ivdep
+    for (p = 0; p < n; p++) {
+        out1[2 * p] = in[2 * p] * 0.5f + 0.5f;
+        out1[2 * p + 1] = in[2 * p + 1] * 0.5f;
+        out2[2 * p] = in[2 * p] * 0.5f + dx2;
+        out2[2 * p + 1] = in[2 * p + 1] * 0.5f + dy2;
+    }
+
+    for (p = 0; p < 2 * n; p++)
+        out[p] = in[p] * 0.5f;
+
+    return 3 * n;
+}
+
+size_t sierpinski2_next_level_lines_packed(uint64_t m,
+                                           const GLushort *in,
+                                           size_t n,
+                                           GLushort *out) {
+    GLushort *out1 = out + 2 * n, *out2 = out + 4 * n;
+    GLushort d;
+    size_t p;
+
+    if (m + 1 > SIERPINSKI_PACKED_MAX_DEPTH)
+        return 0;
+    d = 1u << m;
+
+#pragma GCC ivdep
+    for (p = 0; p < n; p++) {
+        out1[2 * p] = in[2 * p] + d;
+        out1[2 * p + 1] = in[2 * p + 1];
+        out2[2 * p] = in[2 * p];
+        out2[2 * p + 1] = in[2 * p + 1] + d;
+    }
+
+    if (out != in)
+        memcpy(out, in, 2 * n * sizeof *out);
+
+    return 3 * n;
+}
+
+size_t sierpinski2_leaf_lines_packed(uint64_t m, GLushort *out) {
+    return sierpinski2_tile_lines_packed(m, m, 0, 0, out);
+}
+
+size_t sierpinski2_tile_lines_packed(uint64_t m,
+                                     uint64_t k,
+                                     uint64_t ta,
+                                     uint64_t tb,
+                                     GLushort *out) {
+    GLushort *v = out;
+    uint64_t n = (uint64_t) 1 << k, a, b, rest;
+
+    if (k > SIERPINSKI_PACKED_MAX_DEPTH || k > m || m > 63 ||
+        (ta | tb) >> (m - k))
+        return 0;
+
+    /* (a & b) == 0 for the global coordinates: the high bits are the
+     * tile's and the low bits are walked as for the whole lattice */
+    if (ta & tb)
+        return 0;
+
+    for (b = 0; b < n; b++) {
+        rest = ~b & (n - 1);
+        a = 0;
+        do {
+            v[0] = a;      v[1] = b;      v[2] = a + 1;  v[3] = b;
+            v[4] = a + 1;  v[5] = b;      v[6] = a;      v[7] = b + 1;
+            v[8] = a;      v[9] = b + 1;  v[10] = a;     v[11] = b;
+            v += 12;
+
+            a = (a - rest) & rest;
+        } while (a);
+    }
+
+    return (v - out) / 2;
+}
+
+void sierpinski2_lattice_decode(uint64_t m, GLfloat decode[9]) {
+    GLfloat s = ldexp(1.0, -(int) (m < 63 ? m : 63));
+
+    decode[0] = s;        decode[1] = 0;                decode[2] = 0;
+    decode[3] = s * 0.5f; decode[4] = s * sqrt(3) / 2;  decode[5] = 0;
+    decode[6] = 0;        decode[7] = 0;                decode[8] = 1;
+}
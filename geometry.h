@@ -0,0 +1,97 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+/* Sierpinski geometry, kept apart from any GL state so it can be
+ * generated and measured without a window.
+ *
+ * sierpinski2() visits every triangle_up of the recursion down to depth
+ * m (3^(m+1) - 1) / 2 of them) and hands its lower left corner and
+ * scale to emit. */
+typedef void (*triangle_fn)(void *data, GLfloat x, GLfloat y, GLfloat s);
+
+void sierpinski2_(GLfloat x,
+                  GLfloat y,
+                  uint64_t i,
+                  uint64_t m,
+                  triangle_fn emit,
+                  void *data);
+
+void sierpinski2(uint64_t m, triangle_fn emit, void *data);
+
+uint64_t sierpinski2_count(uint64_t m);
+
+/* The float generators below stop at the depth where the 2^-m lattice
+ * of the vertices no longer fits the 24 bit mantissa of a GLfloat, and
+ * return 0 deeper than that; long before it their output runs into GB. */
+#define SIERPINSKI_FLOAT_MAX_DEPTH 23
+
+/* Flatten the whole recursion into GL_LINES vertex pairs, 12 floats per
+ * triangle; out must hold sierpinski2_count(m) * 12 floats.  Returns the
+ * number of vertices written. */
+size_t sierpinski2_lines(uint64_t m, GLfloat *out);
+
+/* Only the 3^m triangles of the last level: the outline of every
+ * triangle is the union of the outer edges of its three children, so
+ * drawing the leaves draws the same lines as the whole recursion.
+ *
+ * All leaf vertices are points (a, b) of the integer lattice with
+ * spacing 2^-m in which triangle_up is (0, 0), (1, 0), (0, 1), i.e.
+ *
+ *   x = (a + b / 2) / 2^m,  y = b * sqrt(3) / 2 / 2^m
+ *
+ * and the leaf cells are exactly those with (a & b) == 0 (Pascal's
+ * triangle mod 2), which is how they are enumerated. */
+uint64_t sierpinski2_leaf_count(uint64_t m);
+
+/* GL_LINES vertex pairs as floats, 12 per triangle */
+size_t sierpinski2_leaf_lines(uint64_t m, GLfloat *out);
+
+/* The same as raw lattice coordinates, 12 GLushorts (24 bytes instead of
+ * 48) per triangle and exact.  Coordinates go up to 2^m, so m must not
+ * exceed SIERPINSKI_PACKED_MAX_DEPTH. */
+#define SIERPINSKI_PACKED_MAX_DEPTH 15
+
+size_t sierpinski2_leaf_lines_packed(uint64_t m, GLushort *out);
+
+/* Level m + 1 of the leaf lines from the n vertices of level m: the
+ * three half-scale copies of it, at the three corner maps of
+ * sierpinski2_(), so going one level deeper is a scaled copy of the data
+ * already there instead of a walk of the whole lattice.  out must hold
+ * 3 n vertices and may be in, grown to that size.  Returns 3 n, or 0 if
+ * m + 1 exceeds SIERPINSKI_FLOAT_MAX_DEPTH. */
+size_t sierpinski2_next_level_lines(uint64_t m,
+                                    const GLfloat *in,
+                                    size_t n,
+                                    GLfloat *out);
+
+/* The same for packed lattice coordinates of depth m: the copies are
+ * level m offset by 2^m along a, along b, or not at all, so m + 1 must
+ * not exceed SIERPINSKI_PACKED_MAX_DEPTH. */
+size_t sierpinski2_next_level_lines_packed(uint64_t m,
+                                           const GLushort *in,
+                                           size_t n,
+                                           GLushort *out);
+
+/* For depths too deep to hold whole, the lattice of depth m split into
+ * square tiles of 2^k x 2^k cells: tile (ta, tb) holds the cells with
+ * a >> k == ta and b >> k == tb.  Writes the leaf triangles of one tile
+ * like sierpinski2_leaf_lines_packed(), but relative to the tile's
+ * corner (ta << k, tb << k), so m may go up to 63 as long as k does not
+ * exceed SIERPINSKI_PACKED_MAX_DEPTH.  out must hold
+ * sierpinski2_leaf_count(k) * 12 GLushorts.  Returns 0 for empty tiles
+ * and tiles outside the triangle. */
+size_t sierpinski2_tile_lines_packed(uint64_t m,
+                                     uint64_t k,
+                                     uint64_t ta,
+                                     uint64_t tb,
+                                     GLushort *out);
+
+/* column-major mat3 taking packed lattice coordinates of depth m to the
+ * scene coordinates used by sierpinski2() */
+void sierpinski2_lattice_decode(uint64_t m, GLfloat decode[9]);
+
+#endif
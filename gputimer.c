@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+
+#include "gputimer.h"
+#include "trace.h"
+
+static PFNGLGENQUERIESEXTPROC gen_queries;
+static PFNGLDELETEQUERIESEXTPROC delete_queries;
+static PFNGLBEGINQUERYEXTPROC begin_query;
+static PFNGLENDQUERYEXTPROC end_query;
+static PFNGLGETQUERYOBJECTUIVEXTPROC get_query_objectuiv;
+static PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_objectui64v;
+
+void gpu_timer_init(struct gpu_timer *t, const char **names, int n_passes) {
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    int i;
+
+    memset(t, 0, sizeof *t);
+    t->enabled = 1;
+    t->n_passes = n_passes < GPU_TIMER_MAX_PASSES ?
+                  n_passes : GPU_TIMER_MAX_PASSES;
+    for (i = 0; i < t->n_passes; i++)
+        t->names[i] = names[i];
+
+    if (extensions && strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+        gen_queries = (PFNGLGENQUERIESEXTPROC)
+            eglGetProcAddress("glGenQueriesEXT");
+        delete_queries = (PFNGLDELETEQUERIESEXTPROC)
+            eglGetProcAddress("glDeleteQueriesEXT");
+        begin_query = (PFNGLBEGINQUERYEXTPROC)
+            eglGetProcAddress("glBeginQueryEXT");
+        end_query = (PFNGLENDQUERYEXTPROC)
+            eglGetProcAddress("glEndQueryEXT");
+        get_query_objectuiv = (PFNGLGETQUERYOBJECTUIVEXTPROC)
+            eglGetProcAddress("glGetQueryObjectuivEXT");
+        get_query_objectui64v = (PFNGLGETQUERYOBJECTUI64VEXTPROC)
+            eglGetProcAddress("glGetQueryObjectui64vEXT");
+
+        t->use_queries = gen_queries && delete_queries && begin_query &&
+                         end_query && get_query_objectuiv &&
+                         get_query_objectui64v;
+    }
+
+    if (t->use_queries) {
+        gen_queries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_PASSES,
+                    &t->queries[0][0]);
+        printf("gpu timing: GL_EXT_disjoint_timer_query\n");
+    } else {
+        printf("gpu timing: no GL_EXT_disjoint_timer_query, "
+               "falling back to glFinish()\n");
+    }
+}
+
+void gpu_timer_fini(struct gpu_timer *t) {
+    if (t->enabled && t->use_queries)
+        delete_queries(GPU_TIMER_FRAMES * GPU_TIMER_MAX_PASSES,
+                       &t->queries[0][0]);
+}
+
+static void collect(struct gpu_timer *t, int slot, int disjoint) {
+    GLuint available;
+    GLuint64 ns;
+    int pass;
+
+    for (pass = 0; pass < t->n_passes; pass++) {
+        if (!(t->issued[slot] & (1 << pass)))
+            continue;
+
+        get_query_objectuiv(t->queries[slot][pass],
+                            GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available || disjoint) {
+            /* reading it now would block; drop the sample instead */
+            t->dropped++;
+            continue;
+        }
+
+        get_query_objectui64v(t->queries[slot][pass],
+                              GL_QUERY_RESULT_EXT, &ns);
+        t->pass_ms[pass] += ns / 1e6;
+        t->samples[pass]++;
+    }
+
+    t->issued[slot] = 0;
+}
+
+void gpu_timer_frame(struct gpu_timer *t) {
+    GLint disjoint = 0;
+    int slot;
+
+    t->blocked_ns = 0;
+    if (!t->enabled || !t->use_queries)
+        return;
+
+    /* a frequency change or similar makes every query in flight
+     * meaningless, not only the ones about to be reused */
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        for (slot = 0; slot < GPU_TIMER_FRAMES; slot++)
+            collect(t, slot, 1);
+    }
+
+    t->slot = (t->slot + 1) % GPU_TIMER_FRAMES;
+    collect(t, t->slot, 0);
+}
+
+void gpu_timer_begin(struct gpu_timer *t, int pass) {
+    if (!t->enabled || pass >= t->n_passes)
+        return;
+
+    if (t->use_queries) {
+        begin_query(GL_TIME_ELAPSED_EXT, t->queries[t->slot][pass]);
+    } else {
+        uint64_t before = trace_now();
+
+        glFinish();
+        t->finish_start = trace_now();
+        t->blocked_ns += t->finish_start - before;
+    }
+}
+
+void gpu_timer_end(struct gpu_timer *t, int pass) {
+    if (!t->enabled || pass >= t->n_passes)
+        return;
+
+    if (t->use_queries) {
+        end_query(GL_TIME_ELAPSED_EXT);
+        t->issued[t->slot] |= 1 << pass;
+    } else {
+        uint64_t elapsed;
+
+        glFinish();
+        elapsed = trace_now() - t->finish_start;
+        t->blocked_ns += elapsed;
+        t->pass_ms[pass] += elapsed / 1e6;
+        t->samples[pass]++;
+    }
+}
+
+void gpu_timer_cpu(struct gpu_timer *t, double ms) {
+    if (!t->enabled)
+        return;
+
+    t->cpu_ms += ms - t->blocked_ns / 1e6;
+    t->cpu_samples++;
+}
+
+void gpu_timer_report(struct gpu_timer *t) {
+    double total = 0;
+    int pass;
+
+    if (!t->enabled)
+        return;
+
+    printf("gpu (%s):", t->use_queries ? "timer query" : "glFinish");
+    for (pass = 0; pass < t->n_passes; pass++) {
+        if (!t->samples[pass])
+            continue;
+        printf(" %s %.3f ms,", t->names[pass],
+               t->pass_ms[pass] / t->samples[pass]);
+        total += t->pass_ms[pass] / t->samples[pass];
+    }
+    printf(" total %.3f ms; cpu submit %.3f ms",
+           total, t->cpu_samples ? t->cpu_ms / t->cpu_samples : 0.0);
+    if (t->dropped)
+        printf("; %d samples dropped", t->dropped);
+    printf("\n");
+
+    memset(t->pass_ms, 0, sizeof t->pass_ms);
+    memset(t->samples, 0, sizeof t->samples);
+    t->cpu_ms = 0;
+    t->cpu_samples = 0;
+    t->dropped = 0;
+}
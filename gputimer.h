@@ -0,0 +1,54 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+#define GPU_TIMER_MAX_PASSES 4
+#define GPU_TIMER_FRAMES 4 /* frames of queries in flight */
+
+/* GPU execution time per render pass, to tell whether a slow frame is
+ * CPU or GPU bound.
+ *
+ * With GL_EXT_disjoint_timer_query every pass gets a GL_TIME_ELAPSED_EXT
+ * query.  Queries go into a ring of GPU_TIMER_FRAMES slots and a slot's
+ * results are only read when it is about to be reused, and then only if
+ * they are already available, so measuring never stalls the pipeline.
+ *
+ * Without the extension (llvmpipe, among others) each pass is bracketed
+ * by glFinish() instead.  That is accurate but serialises CPU and GPU,
+ * so it changes the frame time it is measuring. */
+struct gpu_timer {
+    int enabled, use_queries;
+
+    int n_passes;
+    const char *names[GPU_TIMER_MAX_PASSES];
+
+    GLuint queries[GPU_TIMER_FRAMES][GPU_TIMER_MAX_PASSES];
+    unsigned issued[GPU_TIMER_FRAMES];
+    int slot;
+    uint64_t finish_start, blocked_ns;
+
+    /* accumulated since the last gpu_timer_report() */
+    double pass_ms[GPU_TIMER_MAX_PASSES], cpu_ms;
+    int samples[GPU_TIMER_MAX_PASSES], cpu_samples, dropped;
+};
+
+void gpu_timer_init(struct gpu_timer *t, const char **names, int n_passes);
+void gpu_timer_fini(struct gpu_timer *t);
+
+/* start a new frame, collecting whatever finished from earlier ones */
+void gpu_timer_frame(struct gpu_timer *t);
+
+/* passes may not nest */
+void gpu_timer_begin(struct gpu_timer *t, int pass);
+void gpu_timer_end(struct gpu_timer *t, int pass);
+
+/* CPU time spent building and submitting the frame; time blocked in the
+ * glFinish() fallback is taken out again */
+void gpu_timer_cpu(struct gpu_timer *t, double ms);
+
+/* print per-pass averages since the last report and reset them */
+void gpu_timer_report(struct gpu_timer *t);
+
+#endif
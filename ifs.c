@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+#include "ifs.h"
+
+#define S3 0.8660254f /* sqrt(3) / 2 */
+
+static const struct {
+    const char *name;
+    struct ifs ifs;
+} builtins[] = {
+    { "sierpinski", {
+        3, {
+            { 0.5f, 0, 0, 0.5f, 0,     0 },
+            { 0.5f, 0, 0, 0.5f, 0.5f,  0 },
+            { 0.5f, 0, 0, 0.5f, 0.25f, S3 / 2 },
+        },
+        6, { 0, 0, 1, 0,  1, 0, 0.5f, S3,  0.5f, S3, 0, 0 },
+    } },
+    { "carpet", {
+        8, {
+            { 1/3.f, 0, 0, 1/3.f, 0,     0 },
+            { 1/3.f, 0, 0, 1/3.f, 1/3.f, 0 },
+            { 1/3.f, 0, 0, 1/3.f, 2/3.f, 0 },
+            { 1/3.f, 0, 0, 1/3.f, 0,     1/3.f },
+            { 1/3.f, 0, 0, 1/3.f, 2/3.f, 1/3.f },
+            { 1/3.f, 0, 0, 1/3.f, 0,     2/3.f },
+            { 1/3.f, 0, 0, 1/3.f, 1/3.f, 2/3.f },
+            { 1/3.f, 0, 0, 1/3.f, 2/3.f, 2/3.f },
+        },
+        8, { 0, 0, 1, 0,  1, 0, 1, 1,  1, 1, 0, 1,  0, 1, 0, 0 },
+    } },
+    /* a third of the segment, the two sides of the bump turned by 60
+     * degrees either way, and the last third */
+    { "koch", {
+        4, {
+            { 1/3.f, 0,          0,          1/3.f, 0,     0 },
+            { 1/6.f, -S3 / 3,    S3 / 3,     1/6.f, 1/3.f, 0 },
+            { 1/6.f, S3 / 3,     -S3 / 3,    1/6.f, 0.5f,  S3 / 3 },
+            { 1/3.f, 0,          0,          1/3.f, 2/3.f, 0 },
+        },
+        2, { 0, 0, 1, 0 },
+    } },
+    /* Barnsley's, which is meant for the chaos game: the stem map is
+     * singular and the frond map shrinks slowly, so it takes a deep
+     * level to look like a fern */
+    { "fern", {
+        4, {
+            { 0,      0,     0,     0.16f, 0, 0 },
+            { 0.85f,  0.04f, -0.04f, 0.85f, 0, 1.6f },
+            { 0.2f,   -0.26f, 0.23f, 0.22f, 0, 1.6f },
+            { -0.15f, 0.28f, 0.26f, 0.24f, 0, 0.44f },
+        },
+        2, { 0, 0, 0, 1.6f },
+    } },
+};
+
+static int ifs_load(struct ifs *ifs, const char *path) {
+    char line[256], word[16];
+    struct ifs_map *m;
+    GLfloat *v;
+    FILE *f;
+    int n = 0;
+
+    f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "ifs %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    memset(ifs, 0, sizeof *ifs);
+
+    while (fgets(line, sizeof line, f)) {
+        n++;
+        if (sscanf(line, "%15s", word) != 1 || word[0] == '#')
+            continue;
+
+        if (strcmp(word, "map") == 0 && ifs->n_maps < IFS_MAX_MAPS) {
+            m = &ifs->maps[ifs->n_maps];
+            if (sscanf(line, "%*s %f %f %f %f %f %f",
+                       &m->a, &m->b, &m->c, &m->d, &m->e, &m->f) != 6)
+                break;
+            ifs->n_maps++;
+        } else if (strcmp(word, "line") == 0 &&
+                   ifs->n_vertices + 2 <= IFS_MAX_VERTICES) {
+            v = &ifs->shape[ifs->n_vertices * 2];
+            if (sscanf(line, "%*s %f %f %f %f",
+                       &v[0], &v[1], &v[2], &v[3]) != 4)
+                break;
+            ifs->n_vertices += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (!feof(f)) {
+        fprintf(stderr, "ifs %s:%d: expected \"map a b c d e f\" "
+                "(at most %d) or \"line x0 y0 x1 y1\" (at most %d)\n",
+                path, n, IFS_MAX_MAPS, IFS_MAX_VERTICES / 2);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    if (!ifs->n_maps || !ifs->n_vertices) {
+        fprintf(stderr, "ifs %s: needs at least one map and one line\n",
+                path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int ifs_find(struct ifs *ifs, const char *name) {
+    size_t i;
+
+    for (i = 0; i < sizeof builtins / sizeof builtins[0]; i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            *ifs = builtins[i].ifs;
+            return 0;
+        }
+    }
+
+    return ifs_load(ifs, name);
+}
+
+uint64_t ifs_leaf_count(const struct ifs *ifs, uint64_t m) {
+    uint64_t n = 1;
+
+    while (m--)
+        n *= ifs->n_maps;
+
+    return n;
+}
+
+/* one level of transforms, a coefficient per array */
+struct xforms {
+    GLfloat *a, *b, *c, *d, *e, *f;
+};
+
+/* x[o + p] = x[p] composed with the map (map applied first), for p
+ * below count.  Either o is 0 or the ranges don't overlap, so there is
+ * no dependence between iterations even in place. */
+static void compose(const struct xforms *x, size_t o, size_t count,
+                    const struct ifs_map *m) {
+    GLfloat *pa = x->a, *pb = x->b, *pc = x->c, *pd = x->d;
+    GLfloat *pe = x->e, *pf = x->f;
+    GLfloat ma = m->a, mb = m->b, mc = m->c, md = m->d;
+    GLfloat me = m->e, mf = m->f;
+    size_t p;
+
+#pragma GCC ivdep
+    for (p = 0; p < count; p++) {
+        GLfloat a = pa[p], b = pb[p], c = pc[p], d = pd[p];
+        GLfloat e = pe[p], f = pf[p];
+
+        pa[o + p] = a * ma + b * mc;
+        pb[o + p] = a * mb + b * md;
+        pc[o + p] = c * ma + d * mc;
+        pd[o + p] = c * mb + d * md;
+        pe[o + p] = a * me + b * mf + e;
+        pf[o + p] = c * me + d * mf + f;
+    }
+}
+
+size_t ifs_lines(const struct ifs *ifs, uint64_t m, GLfloat *out) {
+    uint64_t leaves = ifs_leaf_count(ifs, m), count = 1, p;
+    GLfloat s[IFS_MAX_VERTICES * 2], *v = out;
+    int i, k, n = ifs->n_vertices;
+    struct xforms x;
+
+    x.a = malloc(6 * leaves * sizeof(GLfloat));
+    if (!x.a)
+        return 0;
+    x.b = x.a + leaves;
+    x.c = x.b + leaves;
+    x.d = x.c + leaves;
+    x.e = x.d + leaves;
+    x.f = x.e + leaves;
+
+    x.a[0] = 1; x.b[0] = 0; x.c[0] = 0;
+    x.d[0] = 1; x.e[0] = 0; x.f[0] = 0;
+
+    /* a copy the stores to out can't alias */
+    memcpy(s, ifs->shape, n * 2 * sizeof(GLfloat));
+
+    /* Level after level in one buffer: map i writes its children to
+     * [i * count, (i + 1) * count).  Map 0 goes last, since it overwrites
+     * the parents it reads, each in place. */
+    while (m--) {
+        for (i = ifs->n_maps - 1; i >= 0; i--)
+            compose(&x, i * count, count, &ifs->maps[i]);
+        count *= ifs->n_maps;
+    }
+
+    for (p = 0; p < count; p++) {
+        GLfloat a = x.a[p], b = x.b[p], c = x.c[p], d = x.d[p];
+        GLfloat e = x.e[p], f = x.f[p];
+
+        for (k = 0; k < n; k++) {
+            v[0] = a * s[2 * k] + b * s[2 * k + 1] + e;
+            v[1] = c * s[2 * k] + d * s[2 * k + 1] + f;
+            v += 2;
+        }
+    }
+
+    free(x.a);
+
+    return (v - out) / 2;
+}
+
+/* map 0 last, over in when out is in */
+size_t ifs_next_level(const struct ifs *ifs,
+                      const GLfloat *in,
+                      size_t n,
+                      GLfloat *out) {
+    int i;
+    size_t p;
+
+    for (i = ifs->n_maps - 1; i >= 0; i--) {
+        const struct ifs_map *m = &ifs->maps[i];
+        GLfloat *o = out + i * 2 * n;
+
+#pragma GCC ivdep
+        for (p = 0; p < n; p++) {
+            GLfloat x = in[2 * p], y = in[2 * p + 1];
+
+            o[2 * p] = m->a * x + m->b * y + m->e;
+            o[2 * p + 1] = m->c * x + m->d * y + m->f;
+        }
+    }
+
+    return ifs->n_maps * n;
+}
+
+void ifs_fit(const GLfloat *v, size_t n, GLfloat decode[9]) {
+    GLfloat x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    GLfloat w, h, s;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        x0 = fminf(x0, v[2 * i]);
+        x1 = fmaxf(x1, v[2 * i]);
+        y0 = fminf(y0, v[2 * i + 1]);
+        y1 = fmaxf(y1, v[2 * i + 1]);
+    }
+
+    w = x1 - x0;
+    h = y1 - y0;
+    s = w > h ? w : h;
+    s = s > 0 ? 1 / s : 1;
+
+    decode[0] = s;  decode[1] = 0;  decode[2] = 0;
+    decode[3] = 0;  decode[4] = s;  decode[5] = 0;
+    decode[6] = (1 - w * s) / 2 - x0 * s;
+    decode[7] = (1 - h * s) / 2 - y0 * s;
+    decode[8] = 1;
+}
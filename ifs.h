@@ -0,0 +1,64 @@
+#ifndef IFS_H
+#define IFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+/* Iterated function systems: a fractal given by a handful of affine maps
+ *
+ *   (x, y) -> (a x + b y + e, c x + d y + f)
+ *
+ * whose attractor is approximated at depth m by the n^m compositions of
+ * m maps applied to a base shape.  sierpinski2_() is the case of three
+ * half-scale maps and a triangle outline, hand-unrolled.
+ *
+ * The compositions are built a level at a time: every transform of a
+ * level is multiplied by each map in turn, with the six coefficients kept
+ * in separate arrays so the loop over transforms vectorizes. */
+#define IFS_MAX_MAPS 16
+#define IFS_MAX_VERTICES 32
+
+struct ifs_map {
+    GLfloat a, b, c, d, e, f;
+};
+
+struct ifs {
+    int n_maps;
+    struct ifs_map maps[IFS_MAX_MAPS];
+    /* base shape as GL_LINES vertex pairs */
+    int n_vertices;
+    GLfloat shape[IFS_MAX_VERTICES * 2];
+};
+
+/* One of the built in systems "sierpinski", "carpet", "koch" and "fern",
+ * or else a file of lines
+ *
+ *   map a b c d e f
+ *   line x0 y0 x1 y1
+ *
+ * with # starting a comment.  Returns -1 after printing why if neither
+ * works. */
+int ifs_find(struct ifs *ifs, const char *name);
+
+uint64_t ifs_leaf_count(const struct ifs *ifs, uint64_t m);
+
+/* GL_LINES of the base shape under every composition of m maps;
+ * out must hold ifs_leaf_count(ifs, m) * ifs->n_vertices * 2 floats.
+ * Returns the number of vertices written, 0 if out of memory. */
+size_t ifs_lines(const struct ifs *ifs, uint64_t m, GLfloat *out);
+
+/* Level m + 1 of ifs_lines() from the n vertices of level m, one copy
+ * of them under each map, since the compositions of m + 1 maps are every
+ * map applied to those of m.  out must hold n_maps * n vertices and may
+ * be in, grown to that size.  Returns n_maps * n. */
+size_t ifs_next_level(const struct ifs *ifs,
+                      const GLfloat *in,
+                      size_t n,
+                      GLfloat *out);
+
+/* column-major mat3 fitting the bounding box of n vertices into the unit
+ * square, centred and keeping the aspect ratio */
+void ifs_fit(const GLfloat *v, size_t n, GLfloat decode[9]);
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "inputlog.h"
+#include "trace.h"
+
+void input_log_live(struct input_log *l) {
+    memset(l, 0, sizeof *l);
+    l->mode = INPUT_LIVE;
+    l->seed = 0x9e3779b97f4a7c15ULL ^ trace_now();
+}
+
+int input_log_record(struct input_log *l, const char *path) {
+    struct input_log_header h;
+
+    input_log_live(l);
+
+    l->file = fopen(path, "wb");
+    if (!l->file) {
+        fprintf(stderr, "input log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    h.magic = INPUT_LOG_MAGIC;
+    h.version = INPUT_LOG_VERSION;
+    h.seed = l->seed;
+    fwrite(&h, sizeof h, 1, l->file);
+
+    l->mode = INPUT_RECORD;
+
+    return 0;
+}
+
+int input_log_replay(struct input_log *l, const char *path, int realtime) {
+    struct input_log_header h;
+
+    input_log_live(l);
+
+    l->file = fopen(path, "rb");
+    if (!l->file) {
+        fprintf(stderr, "input log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fread(&h, sizeof h, 1, l->file) != 1 ||
+        h.magic != INPUT_LOG_MAGIC || h.version != INPUT_LOG_VERSION) {
+        fprintf(stderr, "input log %s: not a version %d input log\n",
+                path, INPUT_LOG_VERSION);
+        fclose(l->file);
+        l->file = NULL;
+        return -1;
+    }
+
+    l->mode = INPUT_REPLAY;
+    l->realtime = realtime;
+    l->seed = h.seed;
+
+    return 0;
+}
+
+void input_log_close(struct input_log *l) {
+    double seconds;
+
+    if (!l->file)
+        return;
+
+    if (l->mode == INPUT_REPLAY && l->frames) {
+        seconds = (trace_now() - l->start_ns) / 1e9;
+        printf("input replay: %u frames in %.3f seconds (%.1f fps), "
+               "recorded in %.3f\n", l->frames, seconds,
+               l->frames / seconds, l->frame_ns / 1e9);
+    }
+
+    fclose(l->file);
+    l->file = NULL;
+    l->mode = INPUT_LIVE;
+}
+
+int input_log_event(struct input_log *l,
+                    enum input_type type,
+                    uint32_t time,
+                    int32_t a,
+                    int32_t b,
+                    int c) {
+    struct input_record r;
+
+    if (l->mode == INPUT_REPLAY)
+        return l->injecting;
+
+    if (l->mode == INPUT_RECORD) {
+        r.type = type;
+        r.c = c;
+        r.time = time;
+        r.a = a;
+        r.b = b;
+        fwrite(&r, sizeof r, 1, l->file);
+    }
+
+    return 1;
+}
+
+int input_log_frame(struct input_log *l,
+                    input_dispatch_fn dispatch,
+                    void *data) {
+    uint64_t now = trace_now(), due;
+    struct input_record r;
+    struct timespec ts;
+
+    if (!l->frames)
+        l->start_ns = now;
+
+    if (l->mode != INPUT_REPLAY) {
+        l->frame_ns = l->clock_ns ? *l->clock_ns : now - l->start_ns;
+        l->frames++;
+        input_log_event(l, INPUT_FRAME, 0, (uint32_t) l->frame_ns,
+                        (uint32_t) (l->frame_ns >> 32), 0);
+        return 1;
+    }
+
+    l->injecting = 1;
+    while (fread(&r, sizeof r, 1, l->file) == 1 && r.type != INPUT_FRAME)
+        dispatch(data, &r);
+    l->injecting = 0;
+
+    if (feof(l->file))
+        return 0;
+
+    l->frame_ns = (uint32_t) r.a | (uint64_t) (uint32_t) r.b << 32;
+    l->frames++;
+
+    if (l->realtime) {
+        due = l->start_ns + l->frame_ns;
+        ts.tv_sec = due / 1000000000;
+        ts.tv_nsec = due % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+               EINTR)
+            ;
+    }
+
+    return 1;
+}
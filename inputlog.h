@@ -0,0 +1,91 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Record and replay of input, for performance runs that can be repeated
+ * exactly.
+ *
+ * Every input handler passes its event through input_log_event() first.
+ * When recording it is appended to the log; when replaying, live events
+ * are dropped and the logged ones are fed back into the same handlers by
+ * input_log_frame(), each before the frame it originally preceded.  The
+ * log also carries the time of every frame and a seed for anything
+ * random, so a replay at either speed renders the same sequence of frames
+ * as the recording (only feedback from measured timing, such as dynamic
+ * resolution, can still differ).
+ *
+ * The file is a header followed by fixed size records, in host byte
+ * order. */
+#define INPUT_LOG_MAGIC 0x474f4c49 /* "ILOG" */
+#define INPUT_LOG_VERSION 1
+
+enum input_type {
+    INPUT_FRAME,          /* a, b: low and high half of the frame time */
+    INPUT_POINTER_ENTER,  /* a, b: surface position, wl_fixed_t */
+    INPUT_POINTER_LEAVE,
+    INPUT_POINTER_MOTION, /* a, b: surface position, wl_fixed_t */
+    INPUT_POINTER_BUTTON, /* a: button, b: state */
+    INPUT_POINTER_AXIS,   /* a: axis, b: value, wl_fixed_t */
+    INPUT_KEY,            /* a: key, b: state */
+    INPUT_CONFIGURE       /* a, b: size, c: fullscreen */
+};
+
+struct input_log_header {
+    uint32_t magic, version;
+    uint64_t seed;
+};
+
+struct input_record {
+    uint16_t type, c;
+    uint32_t time; /* the event's own timestamp, in ms */
+    int32_t a, b;
+};
+
+typedef void (*input_dispatch_fn)(void *data, const struct input_record *r);
+
+struct input_log {
+    enum {
+        INPUT_LIVE,
+        INPUT_RECORD,
+        INPUT_REPLAY
+    } mode;
+    FILE *file;
+    int realtime, injecting;
+    uint64_t seed, start_ns, frame_ns;
+    uint32_t frames;
+
+    /* if set, live frame times are read from here instead of the clock,
+     * such as a fixed timestep animation clock starting at 0 */
+    const uint64_t *clock_ns;
+};
+
+/* live input with a seed from the clock; nothing to close */
+void input_log_live(struct input_log *l);
+
+/* both return -1 and leave l live if path can't be used */
+int input_log_record(struct input_log *l, const char *path);
+/* realtime: keep the recorded frame times, else run flat out */
+int input_log_replay(struct input_log *l, const char *path, int realtime);
+
+void input_log_close(struct input_log *l);
+
+/* returns whether the caller should go on handling the event */
+int input_log_event(struct input_log *l,
+                    enum input_type type,
+                    uint32_t time,
+                    int32_t a,
+                    int32_t b,
+                    int c);
+
+/* Call once before every frame.  Sets l->frame_ns, the time of the frame
+ * since the first one (or l->clock_ns), which animation should use instead
+ * of the clock.
+ * When replaying, first dispatches the events that came before the
+ * frame, and returns 0 once the log is used up. */
+int input_log_frame(struct input_log *l,
+                    input_dispatch_fn dispatch,
+                    void *data);
+
+#endif
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "metrics.h"
+#include "trace.h"
+
+/* upper bounds of the histogram buckets, in seconds */
+static const double bounds[METRICS_BUCKETS] = {
+    0.001, 0.002, 0.004, 0.008, 0.0125, 0.0167,
+    0.025, 0.0334, 0.05, 0.1, 0.25, 1.0
+};
+
+/* how long a scraper gets to send its request */
+static const int request_timeout_ms = 100;
+
+static uint64_t load(const uint64_t *v) {
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+static void add(uint64_t *v, uint64_t n) {
+    __atomic_fetch_add(v, n, __ATOMIC_RELAXED);
+}
+
+static void observe(struct metrics_histogram *h, uint64_t ns) {
+    int i;
+
+    for (i = 0; i < METRICS_BUCKETS && ns > bounds[i] * 1e9; i++)
+        ;
+    add(&h->counts[i], 1);
+    add(&h->sum_ns, ns);
+}
+
+static void print_counter(FILE *f,
+                          const char *prefix,
+                          const char *name,
+                          const char *help,
+                          uint64_t value) {
+    fprintf(f, "# HELP %s_%s %s\n# TYPE %s_%s counter\n%s_%s %llu\n",
+            prefix, name, help, prefix, name, prefix, name,
+            (unsigned long long) value);
+}
+
+static void print_gauge(FILE *f,
+                        const char *prefix,
+                        const char *name,
+                        const char *help,
+                        double value) {
+    fprintf(f, "# HELP %s_%s %s\n# TYPE %s_%s gauge\n%s_%s %.17g\n",
+            prefix, name, help, prefix, name, prefix, name, value);
+}
+
+/* the count is the +Inf bucket summed from the same loads, so the two
+ * always agree */
+static void print_histogram(FILE *f,
+                            const char *prefix,
+                            const char *name,
+                            const char *help,
+                            struct metrics_histogram *h) {
+    uint64_t count = 0;
+    int i;
+
+    fprintf(f, "# HELP %s_%s %s\n# TYPE %s_%s histogram\n",
+            prefix, name, help, prefix, name);
+    for (i = 0; i < METRICS_BUCKETS; i++) {
+        count += load(&h->counts[i]);
+        fprintf(f, "%s_%s_bucket{le=\"%g\"} %llu\n",
+                prefix, name, bounds[i], (unsigned long long) count);
+    }
+    count += load(&h->counts[METRICS_BUCKETS]);
+    fprintf(f, "%s_%s_bucket{le=\"+Inf\"} %llu\n",
+            prefix, name, (unsigned long long) count);
+    fprintf(f, "%s_%s_sum %.9f\n", prefix, name, load(&h->sum_ns) / 1e9);
+    fprintf(f, "%s_%s_count %llu\n",
+            prefix, name, (unsigned long long) count);
+}
+
+static char *format(struct metrics *m, size_t *size) {
+    const char *p = m->prefix;
+    char *text = NULL;
+    FILE *f;
+
+    f = open_memstream(&text, size);
+    if (!f)
+        return NULL;
+
+    print_histogram(f, p, "frame_interval_seconds",
+                    "Time from one frame to the next.", &m->interval);
+    print_histogram(f, p, "frame_render_seconds",
+                    "Time from the start of a frame to its swap or commit.",
+                    &m->render);
+    print_counter(f, p, "frames_total", "Frames rendered.",
+                  load(&m->frames));
+    print_counter(f, p, "frames_dropped_total",
+                  "Output refreshes missed between frames.",
+                  load(&m->dropped));
+    print_counter(f, p, "frame_pauses_total",
+                  "Gaps between frames too long to be missed refreshes, "
+                  "such as while the window is hidden.",
+                  load(&m->pauses));
+    print_counter(f, p, "draw_calls_total",
+                  "GL draw calls drawing the scene.",
+                  load(&m->draw_calls));
+    print_gauge(f, p, "frame_draw_calls",
+                "GL draw calls drawing the last frame.",
+                load(&m->frame_draw_calls));
+    print_gauge(f, p, "geometry_resident_bytes",
+                "Vertex data held in buffers.", load(&m->geometry_bytes));
+    print_counter(f, p, "event_loop_wakeups_total",
+                  "Times the event loop woke up from waiting.",
+                  load(&m->wakeups));
+    print_gauge(f, p, "uptime_seconds", "Time since the metrics started.",
+                (trace_now() - m->start_ns) / 1e9);
+    print_counter(f, p, "metrics_scrapes_total", "Scrapes served.",
+                  ++m->scrapes);
+
+    if (fclose(f) != 0) {
+        free(text);
+        return NULL;
+    }
+
+    return text;
+}
+
+/* one scrape: wait briefly for a request, answer and hang up */
+static void answer(struct metrics *m, int fd) {
+    static const char header[] =
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Connection: close\r\n\r\n";
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    char request[1024];
+    char *text;
+    size_t size, done;
+    ssize_t n = 0;
+    int http;
+
+    if (poll(&pfd, 1, request_timeout_ms) > 0)
+        n = recv(fd, request, sizeof request, MSG_DONTWAIT);
+    http = n >= 4 && memcmp(request, "GET ", 4) == 0;
+
+    text = format(m, &size);
+    if (!text)
+        return;
+
+    /* small enough to fit the socket buffer, so this doesn't block the
+     * next scraper unless one stops reading */
+    if (http)
+        send(fd, header, sizeof header - 1, MSG_NOSIGNAL);
+    for (done = 0; done < size; done += n) {
+        n = send(fd, text + done, size - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            n = 0;
+        else if (n < 0)
+            break;
+    }
+
+    free(text);
+}
+
+static void *serve(void *data) {
+    struct metrics *m = data;
+    struct pollfd fds[2];
+    int fd;
+
+    trace_thread_init("metrics");
+
+    fds[0] = (struct pollfd) { m->listen_fd, POLLIN, 0 };
+    fds[1] = (struct pollfd) { m->wake_fd, POLLIN, 0 };
+
+    while (!__atomic_load_n(&m->quit, __ATOMIC_ACQUIRE)) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        fd = accept4(m->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        answer(m, fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+int metrics_init(struct metrics *m, const char *path, const char *prefix) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    memset(m, 0, sizeof *m);
+    m->listen_fd = m->wake_fd = -1;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "metrics: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    m->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                          SOCK_CLOEXEC, 0);
+    m->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    unlink(path);
+    if (m->listen_fd < 0 || m->wake_fd < 0 ||
+        bind(m->listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+        listen(m->listen_fd, 4) < 0) {
+        fprintf(stderr, "metrics %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    m->path = path;
+    m->prefix = prefix;
+    m->start_ns = trace_now();
+    if (pthread_create(&m->thread, NULL, serve, m) != 0) {
+        fprintf(stderr, "metrics: no thread\n");
+        goto fail;
+    }
+
+    m->enabled = 1;
+    printf("metrics: serving on %s\n", path);
+
+    return 0;
+
+fail:
+    if (m->listen_fd >= 0)
+        close(m->listen_fd);
+    if (m->wake_fd >= 0)
+        close(m->wake_fd);
+    m->listen_fd = m->wake_fd = -1;
+    return -1;
+}
+
+void metrics_fini(struct metrics *m) {
+    uint64_t one = 1;
+
+    if (!m->enabled)
+        return;
+
+    __atomic_store_n(&m->quit, 1, __ATOMIC_RELEASE);
+    if (write(m->wake_fd, &one, sizeof one) < 0)
+        fprintf(stderr, "metrics: %s\n", strerror(errno));
+    pthread_join(m->thread, NULL);
+
+    close(m->listen_fd);
+    close(m->wake_fd);
+    unlink(m->path);
+    m->enabled = 0;
+}
+
+void metrics_frame(struct metrics *m,
+                   uint64_t start_ns,
+                   uint64_t end_ns,
+                   uint64_t refresh_ns,
+                   uint64_t draw_calls,
+                   uint64_t geometry_bytes,
+                   uint64_t wakeups) {
+    uint64_t interval, missed;
+
+    if (!m->enabled)
+        return;
+
+    observe(&m->render, end_ns - start_ns);
+    if (m->last_frame_ns) {
+        interval = end_ns - m->last_frame_ns;
+        observe(&m->interval, interval);
+        /* a frame every refresh is none missed */
+        missed = refresh_ns ? (interval + refresh_ns / 2) / refresh_ns : 0;
+        if (missed > METRICS_MAX_MISSED + 1)
+            add(&m->pauses, 1);
+        else if (missed > 1)
+            add(&m->dropped, missed - 1);
+    }
+    m->last_frame_ns = end_ns;
+
+    add(&m->frames, 1);
+    add(&m->draw_calls, draw_calls);
+    __atomic_store_n(&m->frame_draw_calls, draw_calls, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->geometry_bytes, geometry_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->wakeups, wakeups, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,72 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+/* Live metrics for clients left running for days: a thread answers
+ * every connection to a Unix socket with the current values in the
+ * Prometheus text format, e.g.
+ *
+ *   curl -s --unix-socket /tmp/sierpinski.metrics http://localhost/metrics
+ *
+ * gets them with an HTTP header, and a bare connection (socat, nc -U)
+ * without one.
+ *
+ * The render thread is the only writer and never waits: it adds to the
+ * counters with relaxed atomics at the end of every frame, and the
+ * server thread reads them with relaxed loads while it formats them.  A
+ * scrape may catch a frame half accounted for, which only shifts it to
+ * the next scrape.
+ *
+ * A frame counts as dropped for every refresh of the output it missed,
+ * judged by the time since the frame before and the refresh rate the
+ * compositor reports; without frame sync nothing is dropped.  A gap of
+ * more than METRICS_MAX_MISSED refreshes is not the client missing
+ * frames but the compositor not asking for any, as it doesn't while the
+ * window is hidden, minimised or on another workspace: it counts as a
+ * pause instead, with no dropped frames. */
+#define METRICS_BUCKETS 12
+#define METRICS_MAX_MISSED 8
+
+struct metrics_histogram {
+    /* per bucket, not cumulative, and one more for +Inf */
+    uint64_t counts[METRICS_BUCKETS + 1];
+    uint64_t sum_ns;
+};
+
+struct metrics {
+    int enabled;
+    const char *path, *prefix;
+    int listen_fd, wake_fd;
+    pthread_t thread;
+    int quit;
+
+    /* written by the render thread alone */
+    struct metrics_histogram interval, render;
+    uint64_t frames, dropped, pauses, draw_calls, frame_draw_calls;
+    uint64_t geometry_bytes, wakeups;
+    uint64_t last_frame_ns, start_ns;
+
+    /* the server thread's */
+    uint64_t scrapes;
+};
+
+/* listen on the Unix socket path and start the thread; metric names
+ * start with prefix_.  -1 after printing why if it can't. */
+int metrics_init(struct metrics *m, const char *path, const char *prefix);
+void metrics_fini(struct metrics *m);
+
+/* At the end of every frame: when it started and ended (the swap or
+ * commit), the refresh interval of the output, 0 if unknown or not
+ * synced to it, the draw calls it took, the bytes of geometry held in
+ * buffers and the event loop wakeups so far. */
+void metrics_frame(struct metrics *m,
+                   uint64_t start_ns,
+                   uint64_t end_ns,
+                   uint64_t refresh_ns,
+                   uint64_t draw_calls,
+                   uint64_t geometry_bytes,
+                   uint64_t wakeups);
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "overdraw.h"
+#include "program.h"
+
+static const GLfloat quad[] = {
+    -1.0f, -1.0f,
+     1.0f, -1.0f,
+     1.0f,  1.0f,
+    -1.0f,  1.0f
+};
+
+/* colour of the pixels with at least min fragments */
+static const struct {
+    int min;
+    GLfloat r, g, b;
+    const char *name;
+} ramp[] = {
+    {  1, 0.0f, 0.0f, 0.5f, "dark blue" },
+    {  2, 0.0f, 0.3f, 1.0f, "blue" },
+    {  3, 0.0f, 0.8f, 0.8f, "cyan" },
+    {  4, 0.0f, 0.8f, 0.0f, "green" },
+    {  6, 0.6f, 0.9f, 0.0f, "yellow green" },
+    {  8, 1.0f, 1.0f, 0.0f, "yellow" },
+    { 12, 1.0f, 0.6f, 0.0f, "orange" },
+    { 16, 1.0f, 0.0f, 0.0f, "red" },
+    { 32, 1.0f, 0.0f, 1.0f, "magenta" },
+    { 64, 1.0f, 1.0f, 1.0f, "white" }
+};
+
+#define RAMP_BANDS (int) (sizeof ramp / sizeof ramp[0])
+
+void overdraw_init(struct overdraw *o) {
+    static const char *src_v = "attribute vec2 position;\n"
+
+                               "void main() {"
+                                   "gl_Position = vec4(position, 0, 1);"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "uniform vec4 color;\n"
+
+                               "void main() {"
+                                   "gl_FragColor = color;"
+                               "}";
+    GLint stencil_bits, red_bits;
+    int i;
+
+    memset(o, 0, sizeof *o);
+
+    glGetIntegerv(GL_STENCIL_BITS, &stencil_bits);
+    glGetIntegerv(GL_RED_BITS, &red_bits);
+    if (stencil_bits < 8) {
+        fprintf(stderr, "overdraw: %d stencil bits, need 8, disabled\n",
+                stencil_bits);
+        return;
+    }
+
+    o->program = program_create("overdraw", src_v, src_f);
+    if (!o->program) {
+        fprintf(stderr, "overdraw: disabled\n");
+        return;
+    }
+    o->enabled = 1;
+    o->counting = red_bits >= 8;
+    if (!o->counting)
+        fprintf(stderr, "overdraw: %d bit red, heatmap only, no counts\n",
+                red_bits);
+
+    o->position_l = glGetAttribLocation(o->program, "position");
+    o->color_l = glGetUniformLocation(o->program, "color");
+
+    printf("overdraw: fragments per pixel");
+    for (i = 0; i < RAMP_BANDS; i++)
+        printf("%s %d%s %s", i ? "," : "", ramp[i].min,
+               i == RAMP_BANDS - 1 ? "+" : "", ramp[i].name);
+    printf("\n");
+}
+
+void overdraw_fini(struct overdraw *o) {
+    if (!o->enabled)
+        return;
+
+    glDeleteProgram(o->program);
+    free(o->pixels);
+}
+
+void overdraw_begin(struct overdraw *o) {
+    if (!o->enabled)
+        return;
+
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    glStencilOp(GL_KEEP, GL_INCR, GL_INCR);
+}
+
+/* sum up the counts the bit passes left in the red channel */
+static void count(struct overdraw *o, int width, int height) {
+    size_t i, n = (size_t) width * height;
+    unsigned char c;
+
+    if (o->size < n * 4) {
+        free(o->pixels);
+        o->pixels = malloc(n * 4);
+        o->size = o->pixels ? n * 4 : 0;
+        if (!o->pixels)
+            return;
+    }
+
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                 o->pixels);
+    for (i = 0; i < n; i++) {
+        c = o->pixels[i * 4];
+        o->fragments += c;
+        o->covered += c != 0;
+        if (c > o->peak)
+            o->peak = c;
+    }
+    o->area += n;
+}
+
+void overdraw_end(struct overdraw *o, int width, int height) {
+    GLint prev, blend_func[4];
+    GLfloat clear[4];
+    GLboolean depth_test, cull_face, blend;
+    int i;
+
+    if (!o->enabled)
+        return;
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prev);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clear);
+    depth_test = glIsEnabled(GL_DEPTH_TEST);
+    cull_face = glIsEnabled(GL_CULL_FACE);
+    blend = glIsEnabled(GL_BLEND);
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blend_func[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blend_func[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blend_func[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blend_func[3]);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glUseProgram(o->program);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glVertexAttribPointer(o->position_l, 2, GL_FLOAT, GL_FALSE, 0, quad);
+    glEnableVertexAttribArray(o->position_l);
+
+    if (o->counting) {
+        /* 2^i / 255 is exactly 2^i in an 8 bit channel */
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        for (i = 0; i < 8; i++) {
+            glStencilFunc(GL_EQUAL, 1 << i, 1 << i);
+            glUniform4f(o->color_l, (1 << i) / 255.0f, 0.0f, 0.0f, 0.0f);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        }
+        glDisable(GL_BLEND);
+        count(o, width, height);
+    }
+
+    for (i = 0; i < RAMP_BANDS; i++) {
+        glStencilFunc(GL_LEQUAL, ramp[i].min, 0xff);
+        glUniform4f(o->color_l, ramp[i].r, ramp[i].g, ramp[i].b, 1.0f);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    }
+
+    glDisable(GL_STENCIL_TEST);
+    glClearColor(clear[0], clear[1], clear[2], clear[3]);
+    glUseProgram(prev);
+    if (depth_test)
+        glEnable(GL_DEPTH_TEST);
+    if (cull_face)
+        glEnable(GL_CULL_FACE);
+    if (blend)
+        glEnable(GL_BLEND);
+    glBlendFuncSeparate(blend_func[0], blend_func[1],
+                        blend_func[2], blend_func[3]);
+
+    o->frames++;
+}
+
+void overdraw_report(struct overdraw *o) {
+    if (!o->enabled || !o->frames)
+        return;
+
+    if (o->counting && o->area)
+        printf("overdraw: %.0f fragments/frame, %.2f per covered pixel, "
+               "%.1f%% covered, peak %d%s\n",
+               (double) o->fragments / o->frames,
+               o->covered ? (double) o->fragments / o->covered : 0.0,
+               100.0 * o->covered / o->area, o->peak,
+               o->peak == 255 ? " (saturated)" : "");
+
+    o->fragments = 0;
+    o->covered = 0;
+    o->area = 0;
+    o->peak = 0;
+    o->frames = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+/* Overdraw: how many fragments every pixel of a frame gets, shown as a
+ * heatmap in place of the frame, to see where the fill rate goes.
+ *
+ * Between overdraw_begin() and overdraw_end() every fragment that reaches
+ * the per-fragment operations increments the stencil buffer, whichever
+ * program drew it, so the scene needs no counting variant of its
+ * shaders.  Fragments that fail the depth test are counted, discarded ones
+ * are not even though they were shaded, and counts saturate at 255.
+ *
+ * overdraw_end() turns the counts into colours.  One additive pass per
+ * stencil bit writes the count into the red channel, which is read back
+ * and summed into the fragments of the frame; then one pass per band of a
+ * colour ramp paints the pixels with at least that many fragments.  The
+ * read back waits for the frame to be drawn, so frame times in this mode
+ * are not worth much.
+ *
+ * The surface needs a stencil buffer, i.e. an EGL config with
+ * EGL_STENCIL_SIZE 8, and a colour buffer with 8 bit red for the count. */
+struct overdraw {
+    int enabled, counting;
+    GLuint program;
+    GLint position_l, color_l;
+
+    unsigned char *pixels;
+    size_t size;
+
+    /* accumulated since the last overdraw_report() */
+    uint64_t fragments, covered, area;
+    int peak, frames;
+};
+
+/* disables o after printing why if the current surface can't count */
+void overdraw_init(struct overdraw *o);
+void overdraw_fini(struct overdraw *o);
+
+/* before the scene, after the colour buffer is cleared */
+void overdraw_begin(struct overdraw *o);
+
+/* after the scene: replaces the frame in the default framebuffer of
+ * width x height by the heatmap */
+void overdraw_end(struct overdraw *o, int width, int height);
+
+/* fragments per frame and per covered pixel since the last report */
+void overdraw_report(struct overdraw *o);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "overlay.h"
+
+enum {
+    MARGIN = 4,
+    BAR = 2
+};
+
+/* an interval this long fills the graph, longer ones than a refresh at
+ * 60 Hz are red */
+static const float graph_ms = 33.3f;
+static const float refresh_ms = 16.7f;
+
+static const uint32_t background = 0x202020;
+static const uint32_t frame = 0x808080;
+static const uint32_t short_bar = 0x40c040;
+static const uint32_t long_bar = 0xe04040;
+
+int overlay_init(struct overlay *o,
+                 struct wl_compositor *compositor,
+                 struct wl_subcompositor *subcompositor,
+                 struct wl_shm *shm,
+                 struct wl_surface *parent) {
+    struct wl_region *region;
+
+    memset(o, 0, sizeof *o);
+
+    if (!subcompositor || !shm) {
+        fprintf(stderr, "overlay: compositor has no %s\n",
+                subcompositor ? "wl_shm" : "wl_subcompositor");
+        return -1;
+    }
+
+    o->surface = wl_compositor_create_surface(compositor);
+    o->subsurface = wl_subcompositor_get_subsurface(subcompositor,
+                                                    o->surface, parent);
+    wl_subsurface_set_desync(o->subsurface);
+
+    region = wl_compositor_create_region(compositor);
+    wl_surface_set_input_region(o->surface, region);
+    wl_region_destroy(region);
+
+    shm_buffers_init(&o->shm, shm);
+
+    return 0;
+}
+
+void overlay_fini(struct overlay *o) {
+    if (!o->surface)
+        return;
+
+    shm_buffers_fini(&o->shm);
+    wl_subsurface_destroy(o->subsurface);
+    wl_surface_destroy(o->surface);
+    o->surface = NULL;
+}
+
+int overlay_place(struct overlay *o, int x, int y, int scale) {
+    wl_subsurface_set_position(o->subsurface, x, y);
+
+    if (scale == o->scale)
+        return 0;
+    if (shm_buffers_resize(&o->shm, OVERLAY_WIDTH * scale,
+                           OVERLAY_HEIGHT * scale) < 0)
+        return -1;
+    /* a new surface is at scale 1 already, and with a wl_compositor
+     * older than version 3, which has no buffer scales, it stays there */
+    if (scale != 1 || o->scale > 1)
+        wl_surface_set_buffer_scale(o->surface, scale);
+    o->scale = scale;
+
+    return 0;
+}
+
+/* in surface coordinates */
+static void fill(struct overlay *o,
+                 uint32_t *pixels,
+                 int x, int y, int width, int height,
+                 uint32_t color) {
+    int i, j, s = o->scale;
+
+    for (j = y * s; j < (y + height) * s; j++) {
+        for (i = x * s; i < (x + width) * s; i++)
+            pixels[j * o->shm.stride + i] = color;
+    }
+}
+
+int overlay_frame(struct overlay *o,
+                  struct wl_display *display,
+                  int color,
+                  uint64_t now_ns) {
+    struct shm_buffer *buffer;
+    int graph = OVERLAY_HEIGHT - 2 * MARGIN;
+    int i, height;
+    float ms;
+
+    if (o->last_ns) {
+        o->intervals[o->head] = (now_ns - o->last_ns) / 1e6;
+        o->head = (o->head + 1) % OVERLAY_BARS;
+    }
+    o->last_ns = now_ns;
+
+    buffer = shm_buffers_next(&o->shm, display);
+    if (!buffer)
+        return -1;
+
+    fill(o, buffer->pixels, 0, 0, OVERLAY_WIDTH, OVERLAY_HEIGHT,
+         background);
+
+    fill(o, buffer->pixels, MARGIN, MARGIN, graph, graph, frame);
+    fill(o, buffer->pixels, MARGIN + 1, MARGIN + 1, graph - 2, graph - 2,
+         color < 0 ? background : (uint32_t) color);
+
+    height = graph * refresh_ms / graph_ms;
+    fill(o, buffer->pixels, OVERLAY_HEIGHT, MARGIN + graph - height,
+         OVERLAY_BARS * BAR, 1, frame);
+    for (i = 0; i < OVERLAY_BARS; i++) {
+        ms = o->intervals[(o->head + i) % OVERLAY_BARS];
+        height = ms < graph_ms ? graph * ms / graph_ms : graph;
+        fill(o, buffer->pixels, OVERLAY_HEIGHT + i * BAR,
+             MARGIN + graph - height, BAR, height,
+             ms > refresh_ms ? long_bar : short_bar);
+    }
+
+    shm_buffers_commit(&o->shm, buffer, o->surface);
+
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#include "shmbuf.h"
+
+/* A small overlay on a subsurface of its own, for what changes every
+ * frame while the rest of the window doesn't: a swatch of a colour and
+ * the last frame intervals as bars.
+ *
+ * It is drawn on the CPU into wl_shm buffers, so a frame that only
+ * changes the overlay costs the GPU nothing and the compositor only an
+ * upload and a repaint of its area.  The subsurface is desynchronized,
+ * so its commits show up without a commit of the parent, and takes no
+ * input, so the pointer goes through to the parent. */
+#define OVERLAY_WIDTH 160
+#define OVERLAY_HEIGHT 40
+/* 2 px each, right of the swatch */
+#define OVERLAY_BARS 58
+
+struct overlay {
+    struct wl_surface *surface;
+    struct wl_subsurface *subsurface;
+    struct shm_buffers shm;
+    int scale;
+
+    /* in ms, the oldest at head */
+    float intervals[OVERLAY_BARS];
+    int head;
+    uint64_t last_ns;
+};
+
+/* above parent; -1 after printing why if the compositor can't */
+int overlay_init(struct overlay *o,
+                 struct wl_compositor *compositor,
+                 struct wl_subcompositor *subcompositor,
+                 struct wl_shm *shm,
+                 struct wl_surface *parent);
+void overlay_fini(struct overlay *o);
+
+/* top left corner in the parent's surface coordinates, which takes
+ * effect with the parent's next commit, and the buffer scale, which
+ * takes effect with the overlay's next; -1 if the buffers couldn't be
+ * reallocated */
+int overlay_place(struct overlay *o, int x, int y, int scale);
+
+/* draw the swatch in color, 0xrrggbb or -1 for none, and the interval
+ * since the last call ending at now_ns, and commit, after any
+ * wl_surface_frame() on o->surface; -1 if the connection broke */
+int overlay_frame(struct overlay *o,
+                  struct wl_display *display,
+                  int color,
+                  uint64_t now_ns);
+
+#endif
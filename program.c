@@ -0,0 +1,67 @@
+#include <stdio.h>
+
+#include "program.h"
+
+/* info logs come with or without a newline of their own */
+static void print_log(const char *what, const char *failed, char *log,
+                      GLsizei length) {
+    while (length > 0 && log[length - 1] == '\n')
+        length--;
+    log[length] = '\0';
+    fprintf(stderr, "%s: %s: %s\n", what, failed, log);
+}
+
+static GLuint compile(const char *what, GLenum type, const char *src) {
+    GLuint s;
+    GLint ok;
+    GLsizei length;
+    char msg[512];
+
+    s = glCreateShader(type);
+    glShaderSource(s, 1, &src, NULL);
+    glCompileShader(s);
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        glGetShaderInfoLog(s, sizeof msg, &length, msg);
+        print_log(what, type == GL_VERTEX_SHADER ?
+                  "vertex shader doesn't compile" :
+                  "fragment shader doesn't compile", msg, length);
+        glDeleteShader(s);
+        return 0;
+    }
+
+    return s;
+}
+
+GLuint program_create(const char *what, const char *src_v, const char *src_f) {
+    GLuint s_v, s_f, p;
+    GLint ok;
+    GLsizei length;
+    char msg[512];
+
+    s_v = compile(what, GL_VERTEX_SHADER, src_v);
+    s_f = compile(what, GL_FRAGMENT_SHADER, src_f);
+    if (!s_v || !s_f) {
+        glDeleteShader(s_v);
+        glDeleteShader(s_f);
+        return 0;
+    }
+
+    p = glCreateProgram();
+    glAttachShader(p, s_v);
+    glAttachShader(p, s_f);
+    glLinkProgram(p);
+    /* they go with the program */
+    glDeleteShader(s_v);
+    glDeleteShader(s_f);
+
+    glGetProgramiv(p, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        glGetProgramInfoLog(p, sizeof msg, &length, msg);
+        print_log(what, "program doesn't link", msg, length);
+        glDeleteProgram(p);
+        return 0;
+    }
+
+    return p;
+}
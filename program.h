@@ -0,0 +1,12 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <GLES2/gl2.h>
+
+/* Compile src_v and src_f and link them, for the modules that draw with
+ * a program of their own.  The info logs are only printed, prefixed by
+ * what, when a shader doesn't compile or the program doesn't link, and
+ * then it returns 0 with nothing left to delete. */
+GLuint program_create(const char *what, const char *src_v, const char *src_f);
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "program.h"
+#include "rastercache.h"
+
+void raster_cache_init(struct raster_cache *c,
+                       int budget_mb,
+                       raster_render_fn render,
+                       void *data) {
+    /* quads are in scene units relative to the view centre, which keeps
+     * them precise however far the view is zoomed in */
+    static const char *src_v = "uniform vec2 scale;\n"
+
+                               "attribute vec2 position;\n"
+                               "attribute vec2 uv;\n"
+
+                               "varying vec2 texcoord;\n"
+
+                               "void main() {"
+                                   "texcoord = uv;\n"
+                                   "gl_Position = vec4(position * scale, 0, 1);"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "uniform sampler2D source;\n"
+
+                               "varying vec2 texcoord;\n"
+
+                               "void main() {"
+                                   "gl_FragColor = texture2D(source, texcoord);"
+                               "}";
+    GLint prev;
+
+    memset(c, 0, sizeof *c);
+
+    c->program = program_create("raster cache", src_v, src_f);
+    if (!c->program) {
+        fprintf(stderr, "raster cache: disabled\n");
+        return;
+    }
+    c->enabled = 1;
+    c->budget_mb = budget_mb;
+    c->render = render;
+    c->data = data;
+
+    c->size = (uint64_t) budget_mb * 1000000 /
+              (RASTER_TILE_SIZE * RASTER_TILE_SIZE * 4);
+    if (c->size < 1)
+        c->size = 1;
+    c->tiles = calloc(c->size, sizeof *c->tiles);
+    assert(c->tiles);
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prev);
+    glUseProgram(c->program);
+
+    c->position_l = glGetAttribLocation(c->program, "position");
+    c->uv_l = glGetAttribLocation(c->program, "uv");
+    c->scale_l = glGetUniformLocation(c->program, "scale");
+    c->texture_l = glGetUniformLocation(c->program, "source");
+    glUniform1i(c->texture_l, 0);
+
+    glUseProgram(prev);
+
+    glGenFramebuffers(1, &c->fbo);
+
+    printf("raster cache: %d tiles of %dx%d (%.1f MB)\n", c->size,
+           RASTER_TILE_SIZE, RASTER_TILE_SIZE,
+           c->size * RASTER_TILE_SIZE * RASTER_TILE_SIZE * 4 / 1e6);
+}
+
+void raster_cache_fini(struct raster_cache *c) {
+    int i;
+
+    if (!c->tiles)
+        return;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->tiles[i].used)
+            glDeleteTextures(1, &c->tiles[i].texture);
+    }
+
+    glDeleteFramebuffers(1, &c->fbo);
+    glDeleteProgram(c->program);
+    free(c->tiles);
+    c->tiles = NULL;
+}
+
+void raster_cache_invalidate(struct raster_cache *c) {
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->tiles[i].used)
+            glDeleteTextures(1, &c->tiles[i].texture);
+        c->tiles[i].used = 0;
+    }
+    c->cached = 0;
+}
+
+static struct raster_tile *find(struct raster_cache *c,
+                                int level,
+                                uint64_t i,
+                                uint64_t j) {
+    struct raster_tile *t;
+    int k;
+
+    for (k = 0; k < c->size; k++) {
+        t = &c->tiles[k];
+        if (t->used && t->level == level && t->i == i && t->j == j)
+            return t;
+    }
+
+    return NULL;
+}
+
+/* tile (i, j) of the current level or, if it is missing, the ancestor
+ * covering it that stands in for it */
+static struct raster_tile *find_drawn(struct raster_cache *c,
+                                      uint64_t i,
+                                      uint64_t j) {
+    struct raster_tile *t;
+    int k;
+
+    t = find(c, c->level, i, j);
+    for (k = 1; !t && k <= RASTER_FALLBACK_LEVELS && k <= c->level; k++)
+        t = find(c, c->level - k, i >> k, j >> k);
+
+    return t;
+}
+
+/* tiles t0 to t1 of 0 to n - 1 overlapping [lo, hi], in tile units */
+static int range(double lo, double hi, double n, uint64_t *t0, uint64_t *t1) {
+    if (hi < 0 || lo >= n)
+        return 0;
+
+    *t0 = lo < 0 ? 0 : (uint64_t) lo;
+    *t1 = hi >= n ? n - 1 : (uint64_t) hi;
+
+    return 1;
+}
+
+static double pixels_per_unit(struct raster_cache *c) {
+    return c->zoom * (c->width < c->height ? c->width : c->height);
+}
+
+static int visible(struct raster_cache *c,
+                   uint64_t *i0,
+                   uint64_t *i1,
+                   uint64_t *j0,
+                   uint64_t *j1) {
+    double ppu = pixels_per_unit(c), n = ldexp(1, c->level);
+    double hw = c->width / 2.0 / ppu, hh = c->height / 2.0 / ppu;
+
+    return range((c->x - hw) * n, (c->x + hw) * n, n, i0, i1) &&
+           range((c->y - hh) * n, (c->y + hh) * n, n, j0, j1);
+}
+
+/* Render tile (level, i, j) into a free texture or the least recently
+ * drawn one, but never into one that is on screen this frame. */
+static int render_tile(struct raster_cache *c,
+                       int level,
+                       uint64_t i,
+                       uint64_t j) {
+    struct raster_tile *t = NULL;
+    double size = ldexp(1, -level);
+    GLenum status;
+    int k;
+
+    for (k = 0; k < c->size; k++) {
+        if (c->tiles[k].used < c->frame &&
+            (!t || c->tiles[k].used < t->used))
+            t = &c->tiles[k];
+    }
+    if (!t)
+        return 0;
+
+    if (t->used) {
+        c->evictions++;
+    } else {
+        glGenTextures(1, &t->texture);
+        glBindTexture(GL_TEXTURE_2D, t->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA,
+                     RASTER_TILE_SIZE, RASTER_TILE_SIZE, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        c->cached++;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, c->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, t->texture, 0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "raster cache framebuffer incomplete: 0x%x, "
+                "disabled\n", status);
+        c->enabled = 0;
+        return 0;
+    }
+
+    glViewport(0, 0, RASTER_TILE_SIZE, RASTER_TILE_SIZE);
+    glClear(GL_COLOR_BUFFER_BIT);
+    c->render(c->data, i * size, j * size, size);
+
+    t->level = level;
+    t->i = i;
+    t->j = j;
+    t->used = c->frame;
+    c->rendered++;
+
+    return 1;
+}
+
+void raster_cache_update(struct raster_cache *c,
+                         double x,
+                         double y,
+                         double zoom,
+                         int width,
+                         int height,
+                         uint64_t now_ns) {
+    uint64_t i, j, i0, i1, j0, j1;
+    struct raster_tile *t;
+    int budget, rendered = 0;
+
+    if (x != c->x || y != c->y || zoom != c->zoom)
+        c->moved_ns = now_ns;
+
+    c->x = x;
+    c->y = y;
+    c->zoom = zoom;
+    c->width = width;
+    c->height = height;
+    c->frame++;
+    c->frames++;
+
+    c->level = ceil(log2(pixels_per_unit(c) / RASTER_TILE_SIZE));
+    if (c->level < 0)
+        c->level = 0;
+    if (c->level > RASTER_MAX_LEVEL)
+        c->level = RASTER_MAX_LEVEL;
+
+    if (!visible(c, &i0, &i1, &j0, &j1))
+        return;
+
+    /* claim what is already there before anything gets evicted,
+     * including the ancestors drawn in place of the missing tiles */
+    for (j = j0; j <= j1; j++) {
+        for (i = i0; i <= i1; i++) {
+            t = find_drawn(c, i, j);
+            if (t)
+                t->used = c->frame;
+        }
+    }
+
+    budget = now_ns - c->moved_ns < RASTER_SETTLE_MS * 1000000ULL ?
+             1 : RASTER_IDLE_BUDGET;
+
+    for (j = j0; j <= j1 && rendered < budget; j++) {
+        for (i = i0; i <= i1 && rendered < budget; i++) {
+            if (find(c, c->level, i, j))
+                continue;
+            if (!render_tile(c, c->level, i, j)) {
+                budget = 0;
+                break;
+            }
+            rendered++;
+        }
+    }
+
+    if (rendered || !c->enabled) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+    }
+}
+
+void raster_cache_draw(struct raster_cache *c) {
+    double size = ldexp(1, -c->level), ppu = pixels_per_unit(c);
+    uint64_t i, j, i0, i1, j0, j1;
+    GLfloat v[16], x0, y0, x1, y1, u0, v0, span;
+    struct raster_tile *t;
+    GLboolean depth_test;
+    GLint prev;
+    int k;
+
+    if (!visible(c, &i0, &i1, &j0, &j1))
+        return;
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &prev);
+    depth_test = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    glUseProgram(c->program);
+    glUniform2f(c->scale_l, 2 * ppu / c->width, 2 * ppu / c->height);
+    glActiveTexture(GL_TEXTURE0);
+    glVertexAttribPointer(c->position_l, 2, GL_FLOAT, GL_FALSE,
+                          4 * sizeof(GLfloat), v);
+    glVertexAttribPointer(c->uv_l, 2, GL_FLOAT, GL_FALSE,
+                          4 * sizeof(GLfloat), v + 2);
+    glEnableVertexAttribArray(c->position_l);
+    glEnableVertexAttribArray(c->uv_l);
+
+    for (j = j0; j <= j1; j++) {
+        for (i = i0; i <= i1; i++) {
+            /* stand in for a missing tile with the part of an ancestor
+             * covering it */
+            t = find_drawn(c, i, j);
+            if (!t)
+                continue;
+
+            k = c->level - t->level;
+            span = ldexp(1, -k);
+            u0 = (i & ((1ULL << k) - 1)) * span;
+            v0 = (j & ((1ULL << k) - 1)) * span;
+            if (k)
+                c->fallbacks++;
+            t->used = c->frame;
+
+            x0 = i * size - c->x;
+            y0 = j * size - c->y;
+            x1 = x0 + size;
+            y1 = y0 + size;
+
+            v[0] = x0;   v[1] = y0;   v[2] = u0;          v[3] = v0;
+            v[4] = x1;   v[5] = y0;   v[6] = u0 + span;   v[7] = v0;
+            v[8] = x1;   v[9] = y1;   v[10] = u0 + span;  v[11] = v0 + span;
+            v[12] = x0;  v[13] = y1;  v[14] = u0;         v[15] = v0 + span;
+
+            glBindTexture(GL_TEXTURE_2D, t->texture);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+            c->quads++;
+        }
+    }
+
+    /* v goes out of scope */
+    glDisableVertexAttribArray(c->position_l);
+    glDisableVertexAttribArray(c->uv_l);
+
+    glUseProgram(prev);
+    if (depth_test)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void raster_cache_report(struct raster_cache *c) {
+    if (!c->enabled || !c->frames)
+        return;
+
+    printf("raster cache: level %d, %.1f quads/frame (%.1f from coarser "
+           "levels), %llu rendered, %llu evicted, %d of %d cached\n",
+           c->level, (double) c->quads / c->frames,
+           (double) c->fallbacks / c->frames,
+           (unsigned long long) c->rendered,
+           (unsigned long long) c->evictions, c->cached, c->size);
+
+    c->frames = 0;
+    c->quads = 0;
+    c->fallbacks = 0;
+    c->rendered = 0;
+    c->evictions = 0;
+}
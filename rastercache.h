@@ -0,0 +1,86 @@
+#ifndef RASTERCACHE_H
+#define RASTERCACHE_H
+
+#include <stdint.h>
+#include <GLES2/gl2.h>
+
+#define RASTER_TILE_SIZE 256
+#define RASTER_MAX_LEVEL 40
+#define RASTER_FALLBACK_LEVELS 4 /* coarsest stand-in for a missing tile */
+#define RASTER_IDLE_BUDGET 4     /* tiles rendered per frame once settled */
+#define RASTER_SETTLE_MS 150
+
+/* Map-style cache of pre-rendered tiles for panning and zooming.
+ *
+ * At level L the unit square of the scene is split into 2^L x 2^L tiles
+ * which a callback renders once each into a RASTER_TILE_SIZE texture.
+ * Every frame uses the level at which a texel is no bigger than a pixel
+ * and draws one textured quad per visible tile, so a moving view only
+ * renders the tiles it uncovers.
+ *
+ * Missing tiles are rendered a few per frame, one while the view is
+ * moving and RASTER_IDLE_BUDGET once it has been still for
+ * RASTER_SETTLE_MS.  Until then they are drawn from a cached tile of a
+ * coarser level, so the picture starts blurry and sharpens.  Textures
+ * come from a fixed pool sized by the budget and the least recently drawn
+ * tile is reused. */
+typedef void (*raster_render_fn)(void *data, double x, double y, double size);
+
+struct raster_tile {
+    int level;
+    uint64_t i, j;
+    GLuint texture;
+    uint64_t used; /* frame last drawn in, 0 for a free slot */
+};
+
+struct raster_cache {
+    int enabled, budget_mb;
+    raster_render_fn render;
+    void *data;
+
+    struct raster_tile *tiles;
+    int size, cached;
+
+    GLuint fbo, program;
+    GLint position_l, uv_l, scale_l, texture_l;
+
+    /* the view of the current frame */
+    double x, y, zoom;
+    int width, height, level;
+    uint64_t frame, moved_ns;
+
+    /* accumulated since the last raster_cache_report() */
+    uint64_t frames, quads, fallbacks, rendered, evictions;
+};
+
+/* render(data, x, y, size) must draw the scene square from (x, y) to
+ * (x + size, y + size) into the whole of the bound framebuffer */
+void raster_cache_init(struct raster_cache *c,
+                       int budget_mb,
+                       raster_render_fn render,
+                       void *data);
+void raster_cache_fini(struct raster_cache *c);
+
+/* Start a frame showing the scene point (x, y) at the centre of a
+ * width x height surface, with zoom * min(width, height) pixels per
+ * scene unit, at time now_ns of any monotonic clock.  Renders some of
+ * the missing tiles, so it must not be called inside another render
+ * pass; leaves framebuffer 0 bound. */
+void raster_cache_update(struct raster_cache *c,
+                         double x,
+                         double y,
+                         double zoom,
+                         int width,
+                         int height,
+                         uint64_t now_ns);
+
+/* drop every tile, for when the scene itself has changed */
+void raster_cache_invalidate(struct raster_cache *c);
+
+/* composite the view into the current framebuffer */
+void raster_cache_draw(struct raster_cache *c);
+
+/* print averages since the last report and reset them */
+void raster_cache_report(struct raster_cache *c);
+
+#endif
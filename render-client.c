@@ -0,0 +1,228 @@
+/* Producer end of the render server of squares-wayland -L
+ * (renderserver.h), as a starting point for other processes drawing on
+ * screen and to measure the server.
+ *
+ * Sends a frame of N rectangles or triangles, swirling about the centre,
+ * one batch of commands and a commit after another:
+ *
+ *   squares-wayland -L /tmp/squares.sock &
+ *   render-client /tmp/squares.sock -n 100000 -w
+ *
+ * With -w it waits for the frame before last to be presented before it
+ * sends the next, so at most two are on their way at any time; without,
+ * it sends as fast as the server reads and the server draws the newest
+ * whenever the display is ready.  Every few seconds it prints what it
+ * sent, how much of it was presented and how long it was blocked on the
+ * socket. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "renderserver.h"
+#include "trace.h"
+
+static const int report_interval = 5;
+
+/* commands per batch */
+#define BATCH 4096
+
+static void usage(int error_code) {
+    fprintf(stderr, "Usage: render-client SOCKET [OPTIONS]\n\n"
+            "  -n N\tShapes per frame (default 10000)\n"
+            "  -t\tTriangles instead of rectangles\n"
+            "  -w\tWait for frames to be presented instead of sending\n"
+            "    \tas fast as the server reads\n"
+            "  -f N\tExit after N frames\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
+}
+
+/* all of it, blocking, adding the time blocked to *blocked_ns */
+static int send_all(int fd, const void *data, size_t size,
+                    uint64_t *blocked_ns) {
+    const char *p = data;
+    uint64_t start;
+    ssize_t n;
+
+    while (size) {
+        n = send(fd, p, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = { fd, POLLOUT, 0 };
+
+            start = trace_now();
+            poll(&pfd, 1, -1);
+            *blocked_ns += trace_now() - start;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        p += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+/* the newest frame presented so far, waiting for one if wait, and how
+ * many were */
+static int read_presented(int fd,
+                          uint64_t *presented,
+                          uint64_t *shown,
+                          int wait) {
+    struct render_event ev;
+    ssize_t n;
+
+    for (;;) {
+        n = recv(fd, &ev, sizeof ev, wait ? 0 : MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != sizeof ev)
+            return -1;
+        if (ev.type == RENDER_PRESENTED && ev.seq > *presented) {
+            *presented = ev.seq;
+            (*shown)++;
+        }
+        wait = 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    const char *path = NULL;
+    int fd, i, k, n = 10000, triangles = 0, wait = 0, max_frames = 0;
+    size_t record, size;
+    uint64_t seq = 0, presented = 0, shown = 0, blocked_ns = 0;
+    uint64_t start, report_start, total = 0;
+    uint64_t frames = 0, commands = 0, bytes = 0;
+    char *buf, *p;
+    double t, a, r;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-n", argv[i]) == 0 && i + 1 < argc)
+            n = atoi(argv[++i]);
+        else if (strcmp("-t", argv[i]) == 0)
+            triangles = 1;
+        else if (strcmp("-w", argv[i]) == 0)
+            wait = 1;
+        else if (strcmp("-f", argv[i]) == 0 && i + 1 < argc)
+            max_frames = atoi(argv[++i]);
+        else if (strcmp("-h", argv[i]) == 0)
+            usage(EXIT_SUCCESS);
+        else if (argv[i][0] != '-' && !path)
+            path = argv[i];
+        else
+            usage(EXIT_FAILURE);
+    }
+
+    if (!path || n < 1 || strlen(path) >= sizeof addr.sun_path)
+        usage(EXIT_FAILURE);
+    strcpy(addr.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    record = triangles ? sizeof(struct render_triangle) :
+                         sizeof(struct render_rect);
+    buf = malloc(sizeof(struct render_batch) + BATCH * record);
+    if (!buf)
+        exit(EXIT_FAILURE);
+
+    start = report_start = trace_now();
+    while (!max_frames || total < (uint64_t) max_frames) {
+        /* no more than two frames on their way */
+        if (wait && seq >= presented + 2 &&
+            read_presented(fd, &presented, &shown, 1) < 0)
+            break;
+        if (!wait && read_presented(fd, &presented, &shown, 0) < 0)
+            break;
+
+        t = (trace_now() - start) / 1e9;
+        for (i = 0; i < n; i += BATCH) {
+            struct render_batch b = {
+                triangles ? RENDER_TRIANGLES : RENDER_RECTS,
+                n - i < BATCH ? n - i : BATCH
+            };
+
+            memcpy(buf, &b, sizeof b);
+            p = buf + sizeof b;
+            for (k = i; k < i + (int) b.count; k++, p += record) {
+                /* a spiral of shapes turning at a speed of their own */
+                r = 0.95 * sqrt((k + 0.5) / n);
+                a = k * 2.39996 + t * (0.2 + r);
+                if (triangles) {
+                    struct render_triangle tr = {
+                        r * cos(a), r * sin(a),
+                        r * cos(a) + 0.02f, r * sin(a),
+                        r * cos(a), r * sin(a) + 0.02f,
+                        0xff000000 | (k * 2654435761u & 0xffffff)
+                    };
+
+                    memcpy(p, &tr, sizeof tr);
+                } else {
+                    struct render_rect rc = {
+                        r * cos(a) - 0.01f, r * sin(a) - 0.01f, 0.02f, 0.02f,
+                        0xff000000 | (k * 2654435761u & 0xffffff)
+                    };
+
+                    memcpy(p, &rc, sizeof rc);
+                }
+            }
+
+            size = p - buf;
+            if (send_all(fd, buf, size, &blocked_ns) < 0)
+                goto gone;
+            commands += b.count;
+            bytes += size;
+        }
+
+        {
+            struct render_batch b = { RENDER_COMMIT, 0 };
+
+            if (send_all(fd, &b, sizeof b, &blocked_ns) < 0)
+                goto gone;
+        }
+        seq++;
+        frames++;
+        total++;
+
+        if (trace_now() - report_start >= report_interval * 1000000000ull) {
+            double seconds = (trace_now() - report_start) / 1e9;
+
+            printf("%.1f frames/s sent, %.0f commands/s (%.1f MB/s), "
+                   "%.1f frames/s presented, blocked %.1f%% of the "
+                   "time\n", (double) frames / seconds,
+                   commands / seconds, bytes / seconds / 1e6,
+                   shown / seconds,
+                   100.0 * blocked_ns / 1e9 / seconds);
+            report_start = trace_now();
+            frames = commands = bytes = shown = blocked_ns = 0;
+        }
+    }
+
+    close(fd);
+    free(buf);
+    return 0;
+
+gone:
+    fprintf(stderr, "render server gone\n");
+    close(fd);
+    free(buf);
+    return 1;
+}
@@ -0,0 +1,459 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "renderserver.h"
+#include "trace.h"
+
+/* bytes read from a client at a time */
+#define READ_SIZE 65536
+
+struct render_client {
+    int fd, gone;
+
+    /* the reader thread's alone */
+    unsigned char buf[READ_SIZE];
+    size_t have;
+    struct render_batch batch; /* the one being read, count to go */
+    struct render_frame back;
+
+    /* under the lock */
+    struct render_frame pending;
+    int has_pending;
+    uint64_t seq, taken, presented;
+
+    /* the renderer's alone */
+    struct render_frame front;
+};
+
+static void free_client(struct render_client *c) {
+    if (c->fd >= 0)
+        close(c->fd);
+    free(c->back.vertices);
+    free(c->pending.vertices);
+    free(c->front.vertices);
+    free(c);
+}
+
+static size_t record_size(uint32_t type) {
+    switch (type) {
+    case RENDER_RECTS:
+        return sizeof(struct render_rect);
+    case RENDER_TRIANGLES:
+        return sizeof(struct render_triangle);
+    default:
+        return 0;
+    }
+}
+
+/* room for n more vertices in f, 0 past RENDER_MAX_VERTICES */
+static int reserve(struct render_frame *f, size_t n) {
+    struct render_vertex *v;
+    size_t size = f->size ? f->size : 4096;
+
+    if (f->count + n <= f->size)
+        return 1;
+    if (f->count + n > RENDER_MAX_VERTICES)
+        return 0;
+
+    while (size < f->count + n)
+        size *= 2;
+    if (size > RENDER_MAX_VERTICES)
+        size = RENDER_MAX_VERTICES;
+
+    v = realloc(f->vertices, size * sizeof *v);
+    if (!v)
+        return 0;
+    f->vertices = v;
+    f->size = size;
+
+    return 1;
+}
+
+/* a rectangle as two counter-clockwise triangles */
+static int emit(struct render_frame *f, uint32_t type, const void *record) {
+    struct render_vertex *v;
+    struct render_rect r;
+    struct render_triangle t;
+
+    if (!reserve(f, type == RENDER_RECTS ? 6 : 3))
+        return 0;
+    v = f->vertices + f->count;
+
+    if (type == RENDER_RECTS) {
+        memcpy(&r, record, sizeof r);
+        v[0] = (struct render_vertex) { r.x, r.y, r.color };
+        v[1] = (struct render_vertex) { r.x + r.width, r.y, r.color };
+        v[2] = (struct render_vertex) { r.x, r.y + r.height, r.color };
+        v[3] = v[2];
+        v[4] = v[1];
+        v[5] = (struct render_vertex) { r.x + r.width, r.y + r.height,
+                                        r.color };
+        f->count += 6;
+    } else {
+        memcpy(&t, record, sizeof t);
+        v[0] = (struct render_vertex) { t.x0, t.y0, t.color };
+        v[1] = (struct render_vertex) { t.x1, t.y1, t.color };
+        v[2] = (struct render_vertex) { t.x2, t.y2, t.color };
+        f->count += 3;
+    }
+
+    return 1;
+}
+
+static void commit(struct render_server *s, struct render_client *c) {
+    struct render_frame f;
+
+    pthread_mutex_lock(&s->lock);
+    if (c->has_pending)
+        s->superseded++;
+    f = c->pending;
+    c->pending = c->back;
+    c->back = f;
+    c->pending.seq = ++c->seq;
+    c->has_pending = 1;
+    s->commits++;
+    pthread_mutex_unlock(&s->lock);
+
+    c->back.count = 0;
+}
+
+/* Every complete record read so far; -1 for a batch of unknown type. */
+static int parse(struct render_server *s, struct render_client *c) {
+    unsigned char *p = c->buf, *end = c->buf + c->have;
+    uint64_t commands = 0, overflowed = 0;
+    size_t size;
+    int ret = 0;
+
+    for (;;) {
+        if (!c->batch.count) {
+            if ((size_t) (end - p) < sizeof c->batch)
+                break;
+            memcpy(&c->batch, p, sizeof c->batch);
+            p += sizeof c->batch;
+
+            if (c->batch.type == RENDER_COMMIT) {
+                c->batch.count = 0;
+                commit(s, c);
+            } else if (!record_size(c->batch.type)) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        size = record_size(c->batch.type);
+        if ((size_t) (end - p) < size)
+            break;
+        if (!emit(&c->back, c->batch.type, p))
+            overflowed++;
+        p += size;
+        c->batch.count--;
+        commands++;
+    }
+
+    memmove(c->buf, p, end - p);
+    c->have = end - p;
+
+    pthread_mutex_lock(&s->lock);
+    s->commands += commands;
+    s->overflowed += overflowed;
+    pthread_mutex_unlock(&s->lock);
+
+    return ret;
+}
+
+/* Read and parse at most one buffer, so a client that keeps its socket
+ * full can't keep the thread from the others, the presented events and
+ * quitting; the rest waits in the socket for the next poll().  -1 once
+ * the client is gone. */
+static int read_client(struct render_server *s, struct render_client *c) {
+    ssize_t n;
+
+    do {
+        n = read(c->fd, c->buf + c->have, READ_SIZE - c->have);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (n <= 0)
+        return -1;
+
+    c->have += n;
+    pthread_mutex_lock(&s->lock);
+    s->bytes += n;
+    pthread_mutex_unlock(&s->lock);
+
+    if (parse(s, c) < 0) {
+        fprintf(stderr, "render server: bad batch type %u\n",
+                c->batch.type);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void accept_client(struct render_server *s) {
+    struct render_client *c;
+    int fd, i;
+
+    fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    c = calloc(1, sizeof *c);
+    if (!c) {
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < RENDER_MAX_CLIENTS && s->clients[i]; i++)
+        ;
+    if (i < RENDER_MAX_CLIENTS)
+        s->clients[i] = c;
+    pthread_mutex_unlock(&s->lock);
+
+    if (i == RENDER_MAX_CLIENTS) {
+        fprintf(stderr, "render server: more than %d clients\n",
+                RENDER_MAX_CLIENTS);
+        free_client(c);
+        return;
+    }
+
+    printf("render server: client %d connected\n", i);
+}
+
+/* the renderer frees it when it takes the slot next */
+static void drop_client(struct render_server *s, int slot) {
+    struct render_client *c = s->clients[slot];
+
+    pthread_mutex_lock(&s->lock);
+    close(c->fd);
+    c->fd = -1;
+    c->gone = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    printf("render server: client %d gone\n", slot);
+}
+
+static void send_presented(struct render_server *s) {
+    struct render_event ev = { RENDER_PRESENTED, 0, 0 };
+    struct render_client *c;
+    uint64_t value;
+    int i;
+
+    if (read(s->wake_fd, &value, sizeof value) < 0)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+        c = s->clients[i];
+        if (!c || c->gone || c->taken == c->presented)
+            continue;
+        ev.seq = c->presented = c->taken;
+        /* not read, not waited for */
+        send(c->fd, &ev, sizeof ev, MSG_DONTWAIT | MSG_NOSIGNAL);
+        s->presented++;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *serve(void *data) {
+    struct render_server *s = data;
+    struct pollfd fds[RENDER_MAX_CLIENTS + 2];
+    int slots[RENDER_MAX_CLIENTS + 2];
+    int i, n;
+
+    trace_thread_init("render_server");
+
+    fds[0] = (struct pollfd) { s->listen_fd, POLLIN, 0 };
+    fds[1] = (struct pollfd) { s->wake_fd, POLLIN, 0 };
+
+    while (!__atomic_load_n(&s->quit, __ATOMIC_ACQUIRE)) {
+        /* only this thread adds clients or closes their sockets */
+        n = 2;
+        pthread_mutex_lock(&s->lock);
+        for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+            if (s->clients[i] && !s->clients[i]->gone) {
+                fds[n] = (struct pollfd) { s->clients[i]->fd, POLLIN, 0 };
+                slots[n++] = i;
+            }
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (poll(fds, n, -1) < 0)
+            continue;
+
+        if (fds[1].revents & POLLIN)
+            send_presented(s);
+        if (fds[0].revents & POLLIN)
+            accept_client(s);
+
+        for (i = 2; i < n; i++) {
+            if (fds[i].revents &&
+                read_client(s, s->clients[slots[i]]) < 0)
+                drop_client(s, slots[i]);
+        }
+    }
+
+    return NULL;
+}
+
+int render_server_init(struct render_server *s, const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    memset(s, 0, sizeof *s);
+    s->listen_fd = s->wake_fd = -1;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "render server: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                          SOCK_CLOEXEC, 0);
+    s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    unlink(path);
+    if (s->listen_fd < 0 || s->wake_fd < 0 ||
+        bind(s->listen_fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+        listen(s->listen_fd, RENDER_MAX_CLIENTS) < 0) {
+        fprintf(stderr, "render server %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    if (pthread_create(&s->thread, NULL, serve, s) != 0) {
+        fprintf(stderr, "render server: no thread\n");
+        pthread_mutex_destroy(&s->lock);
+        goto fail;
+    }
+
+    s->path = path;
+    s->enabled = 1;
+    s->start_ns = trace_now();
+    printf("render server: listening on %s\n", path);
+
+    return 0;
+
+fail:
+    if (s->listen_fd >= 0)
+        close(s->listen_fd);
+    if (s->wake_fd >= 0)
+        close(s->wake_fd);
+    s->listen_fd = s->wake_fd = -1;
+    return -1;
+}
+
+void render_server_fini(struct render_server *s) {
+    uint64_t one = 1;
+    int i;
+
+    if (!s->enabled)
+        return;
+
+    __atomic_store_n(&s->quit, 1, __ATOMIC_RELEASE);
+    if (write(s->wake_fd, &one, sizeof one) < 0)
+        fprintf(stderr, "render server: %s\n", strerror(errno));
+    pthread_join(s->thread, NULL);
+
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+        if (s->clients[i])
+            free_client(s->clients[i]);
+        s->clients[i] = NULL;
+    }
+
+    close(s->listen_fd);
+    close(s->wake_fd);
+    unlink(s->path);
+    pthread_mutex_destroy(&s->lock);
+    s->enabled = 0;
+}
+
+int render_server_take(struct render_server *s,
+                       int slot,
+                       const struct render_frame **frame) {
+    static const struct render_frame empty;
+    struct render_client *c;
+    struct render_frame f;
+
+    pthread_mutex_lock(&s->lock);
+    c = s->clients[slot];
+    if (!c || (!c->gone && !c->has_pending)) {
+        pthread_mutex_unlock(&s->lock);
+        return 0;
+    }
+
+    if (c->gone) {
+        s->clients[slot] = NULL;
+        pthread_mutex_unlock(&s->lock);
+        free_client(c);
+        *frame = &empty;
+        return 1;
+    }
+
+    f = c->front;
+    c->front = c->pending;
+    c->pending = f;
+    c->pending.count = 0;
+    c->has_pending = 0;
+    c->taken = c->front.seq;
+    pthread_mutex_unlock(&s->lock);
+
+    *frame = &c->front;
+    return 1;
+}
+
+void render_server_presented(struct render_server *s) {
+    uint64_t one = 1;
+    int i, any = 0;
+
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+        if (s->clients[i] && !s->clients[i]->gone &&
+            s->clients[i]->taken != s->clients[i]->presented)
+            any = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (any && write(s->wake_fd, &one, sizeof one) < 0)
+        fprintf(stderr, "render server: %s\n", strerror(errno));
+}
+
+void render_server_report(struct render_server *s, int frames) {
+    uint64_t now = trace_now();
+    double seconds = (now - s->start_ns) / 1e9;
+    int i, clients = 0;
+
+    if (!s->enabled)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++)
+        clients += s->clients[i] && !s->clients[i]->gone;
+
+    printf("render server: %d clients, %.0f commands/s (%.1f MB/s), "
+           "%.1f commits/s, %.2f presented/frame, %llu superseded, "
+           "%llu overflowed\n", clients, s->commands / seconds,
+           s->bytes / seconds / 1e6, s->commits / seconds,
+           frames ? (double) s->presented / frames : 0.0,
+           (unsigned long long) s->superseded,
+           (unsigned long long) s->overflowed);
+
+    s->commands = s->bytes = s->commits = 0;
+    s->superseded = s->overflowed = s->presented = 0;
+    pthread_mutex_unlock(&s->lock);
+    s->start_ns = now;
+}
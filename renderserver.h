@@ -0,0 +1,113 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Render server: other processes on the host draw in squares-wayland -L
+ * by streaming commands to it over a SOCK_STREAM Unix socket.
+ *
+ * The stream is a sequence of batches, each a render_batch header
+ * followed by count records of its type, in host byte order:
+ *
+ *   RENDER_RECTS      render_rect records
+ *   RENDER_TRIANGLES  render_triangle records
+ *   RENDER_COMMIT     none: everything since the client's previous commit
+ *                     is its next frame
+ *
+ * Coordinates are those of the four squares, [-1, 1] on both axes fitted
+ * into the window, y up, and colours are RGBA bytes.  Every client is a
+ * layer of its own, drawn over the layers of the clients before it, and
+ * keeps showing its last frame until it commits another or disconnects.
+ *
+ * A thread reads the clients in turn, a buffer of each at a time, and
+ * expands their commands into triangles in each client's back buffer, so
+ * producers never wait for rendering, only for the socket if they outrun
+ * the parsing.  A commit swaps the back buffer with the pending one,
+ * which the renderer takes at the start of its next frame; a pending
+ * frame that is replaced before that is never drawn (superseded).  Once
+ * a frame is on screen the client gets a RENDER_PRESENTED event with its
+ * commit number, which a producer can wait for to send one frame per
+ * display refresh, much like a Wayland frame callback.  Events are
+ * dropped rather than waited for if the client doesn't read them. */
+#define RENDER_MAX_CLIENTS 8
+/* per client frame, beyond which commands are dropped (overflowed) */
+#define RENDER_MAX_VERTICES (6 << 20)
+
+enum render_batch_type {
+    RENDER_RECTS = 1,
+    RENDER_TRIANGLES,
+    RENDER_COMMIT
+};
+
+struct render_batch {
+    uint32_t type, count;
+};
+
+struct render_rect {
+    float x, y, width, height;
+    uint32_t color;
+};
+
+struct render_triangle {
+    float x0, y0, x1, y1, x2, y2;
+    uint32_t color;
+};
+
+enum render_event_type {
+    RENDER_PRESENTED = 1
+};
+
+struct render_event {
+    uint32_t type, pad;
+    uint64_t seq;
+};
+
+/* what a client's frame is expanded into, ready for glBufferData() */
+struct render_vertex {
+    float x, y;
+    uint32_t color;
+};
+
+struct render_frame {
+    struct render_vertex *vertices;
+    size_t count, size;
+    uint64_t seq;
+};
+
+struct render_client;
+
+struct render_server {
+    int enabled;
+    const char *path;
+    int listen_fd, wake_fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int quit;
+    struct render_client *clients[RENDER_MAX_CLIENTS];
+
+    /* accumulated since the last render_server_report(), under lock */
+    uint64_t commands, bytes, commits, superseded, overflowed, presented;
+    uint64_t start_ns;
+};
+
+/* listen on the Unix socket path and start the thread; -1 after printing
+ * why if it can't */
+int render_server_init(struct render_server *s, const char *path);
+void render_server_fini(struct render_server *s);
+
+/* Before drawing a frame, for each slot from 0 to RENDER_MAX_CLIENTS - 1:
+ * 1 if the client in it committed a new frame since the last call, which
+ * is then *frame until the next call that returns 1 for the slot, with no
+ * vertices once the client is gone.  0 if nothing changed. */
+int render_server_take(struct render_server *s,
+                       int slot,
+                       const struct render_frame **frame);
+
+/* after the frames taken are on screen */
+void render_server_presented(struct render_server *s);
+
+void render_server_report(struct render_server *s, int frames);
+
+#endif
@@ -0,0 +1,159 @@
+/* Writes synthetic scenes for squares-wayland -s (scene.h), to stress
+ * loading, uploading and drawing millions of rectangles:
+ *
+ *   scene-gen /tmp/grid.scene -n 4000000
+ *   squares-wayland -s /tmp/grid.scene
+ *
+ * grid lays the rectangles out edge to edge in a square, random throws
+ * them anywhere in [-1, 1] at random sizes, overlapping.  The file is
+ * sized up front and written through a shared mapping, column by column,
+ * so it never needs more memory than the page cache gives it. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "scene.h"
+#include "trace.h"
+
+/* splitmix64 */
+static uint64_t next(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static float uniform(uint64_t *state) {
+    return (next(state) >> 40) / (float) (1 << 24);
+}
+
+static void usage(int error_code) {
+    fprintf(stderr, "Usage: scene-gen FILE [OPTIONS]\n\n"
+            "  -n N\tRectangles (default 1000000)\n"
+            "  -p PATTERN\tgrid or random (default grid)\n"
+            "  -r SEED\tSeed for positions, sizes and colours\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
+}
+
+int main(int argc, char **argv) {
+    struct scene_header layout, *h;
+    const char *path = NULL, *pattern = "grid";
+    uint64_t count = 1000000, seed = 1, state, i, side, file_size, start;
+    float *positions, *sizes, cell, x0, y0, x1, y1, w;
+    uint32_t *colors;
+    void *map;
+    int fd, a;
+
+    for (a = 1; a < argc; a++) {
+        if (strcmp("-n", argv[a]) == 0 && a + 1 < argc)
+            count = strtoull(argv[++a], NULL, 0);
+        else if (strcmp("-p", argv[a]) == 0 && a + 1 < argc)
+            pattern = argv[++a];
+        else if (strcmp("-r", argv[a]) == 0 && a + 1 < argc)
+            seed = strtoull(argv[++a], NULL, 0);
+        else if (strcmp("-h", argv[a]) == 0)
+            usage(EXIT_SUCCESS);
+        else if (argv[a][0] != '-' && !path)
+            path = argv[a];
+        else
+            usage(EXIT_FAILURE);
+    }
+
+    if (!path || count < 1 ||
+        (strcmp(pattern, "grid") != 0 && strcmp(pattern, "random") != 0))
+        usage(EXIT_FAILURE);
+
+    start = trace_now();
+
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    file_size = scene_layout(&layout, count);
+    if (ftruncate(fd, file_size) < 0 ||
+        (map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    h = map;
+    *h = layout;
+
+    positions = (float *) ((char *) map + h->position_offset);
+    sizes = (float *) ((char *) map + h->size_offset);
+    colors = (uint32_t *) ((char *) map + h->color_offset);
+
+    side = ceil(sqrt((double) count));
+    cell = 2.0f / side;
+    x0 = y0 = 1;
+    x1 = y1 = -1;
+
+    /* a column at a time, each from its own stream */
+    state = seed;
+    for (i = 0; i < count; i++) {
+        if (pattern[0] == 'g') {
+            positions[2 * i] = -1 + (i % side) * cell;
+            positions[2 * i + 1] = -1 + (i / side) * cell;
+        } else {
+            positions[2 * i] = uniform(&state) * 2 - 1;
+            positions[2 * i + 1] = uniform(&state) * 2 - 1;
+        }
+    }
+
+    state = seed ^ 0x5a5a5a5a5a5a5a5aULL;
+    for (i = 0; i < count; i++) {
+        if (pattern[0] == 'g') {
+            sizes[2 * i] = sizes[2 * i + 1] = cell;
+        } else {
+            /* a few times a grid cell, so they overlap */
+            w = cell * (0.5f + 4 * uniform(&state));
+            sizes[2 * i] = w;
+            sizes[2 * i + 1] = w * (0.5f + uniform(&state));
+        }
+        x0 = fminf(x0, positions[2 * i]);
+        y0 = fminf(y0, positions[2 * i + 1]);
+        x1 = fmaxf(x1, positions[2 * i] + sizes[2 * i]);
+        y1 = fmaxf(y1, positions[2 * i + 1] + sizes[2 * i + 1]);
+    }
+
+    state = seed ^ 0xa5a5a5a5a5a5a5a5ULL;
+    for (i = 0; i < count; i++) {
+        uint8_t *c = (uint8_t *) &colors[i];
+        uint64_t r = next(&state);
+
+        c[0] = 64 + (r & 0xbf);
+        c[1] = 64 + ((r >> 8) & 0xbf);
+        c[2] = 64 + ((r >> 16) & 0xbf);
+        c[3] = 255;
+    }
+
+    h->bounds[0] = x0;
+    h->bounds[1] = y0;
+    h->bounds[2] = x1;
+    h->bounds[3] = y1;
+
+    if (msync(map, file_size, MS_SYNC) < 0)
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    munmap(map, file_size);
+
+    printf("%s: %llu %s rectangles, %.1f MB in %.2f s\n", path,
+           (unsigned long long) count, pattern, file_size / 1e6,
+           (trace_now() - start) / 1e9);
+
+    return 0;
+}
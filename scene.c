@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scene.h"
+#include "trace.h"
+
+static uint64_t align(uint64_t offset) {
+    return (offset + SCENE_ALIGN - 1) & ~(uint64_t) (SCENE_ALIGN - 1);
+}
+
+uint64_t scene_layout(struct scene_header *h, uint64_t count) {
+    memset(h, 0, sizeof *h);
+    h->magic = SCENE_MAGIC;
+    h->version = SCENE_VERSION;
+    h->count = count;
+
+    h->position_offset = align(sizeof *h);
+    h->size_offset = align(h->position_offset + count * 2 * sizeof(float));
+    h->color_offset = align(h->size_offset + count * 2 * sizeof(float));
+    h->file_size = h->color_offset + count * sizeof(uint32_t);
+
+    return h->file_size;
+}
+
+int scene_open(struct scene *s, const char *path) {
+    struct scene_header expected;
+    const struct scene_header *h;
+    struct stat st;
+    uint64_t start = trace_now();
+    int fd;
+
+    memset(s, 0, sizeof *s);
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "scene %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    if ((size_t) st.st_size < sizeof *h) {
+        fprintf(stderr, "scene %s: too short\n", path);
+        close(fd);
+        return -1;
+    }
+
+    s->map_size = st.st_size;
+    s->map = mmap(NULL, s->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (s->map == MAP_FAILED) {
+        fprintf(stderr, "scene %s: %s\n", path, strerror(errno));
+        s->map = NULL;
+        return -1;
+    }
+
+    /* the columns are uploaded front to back right after this */
+    madvise(s->map, s->map_size, MADV_SEQUENTIAL);
+    madvise(s->map, s->map_size, MADV_WILLNEED);
+
+    h = s->map;
+    scene_layout(&expected, h->count);
+    if (h->magic != SCENE_MAGIC || h->version != SCENE_VERSION ||
+        h->count > (uint64_t) st.st_size ||
+        h->position_offset != expected.position_offset ||
+        h->size_offset != expected.size_offset ||
+        h->color_offset != expected.color_offset ||
+        h->file_size != expected.file_size ||
+        h->file_size > (uint64_t) st.st_size) {
+        fprintf(stderr, "scene %s: not a version %d scene\n",
+                path, SCENE_VERSION);
+        scene_close(s);
+        return -1;
+    }
+
+    s->header = h;
+    s->count = h->count;
+    s->positions = (const float *) ((char *) s->map + h->position_offset);
+    s->sizes = (const float *) ((char *) s->map + h->size_offset);
+    s->colors = (const uint32_t *) ((char *) s->map + h->color_offset);
+    s->map_ms = (trace_now() - start) / 1e6;
+
+    return 0;
+}
+
+void scene_close(struct scene *s) {
+    if (s->map)
+        munmap(s->map, s->map_size);
+    memset(s, 0, sizeof *s);
+}
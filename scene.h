@@ -0,0 +1,53 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCENE_MAGIC 0x4e435351 /* "QSCN" */
+#define SCENE_VERSION 1
+#define SCENE_ALIGN 4096 /* of every column in the file */
+
+/* Binary scene of coloured rectangles, for squares-wayland -s.
+ *
+ * A fixed header followed by three columns, each starting on a
+ * SCENE_ALIGN boundary, with element i of every column describing
+ * rectangle i:
+ *
+ *   position  2 floats, x and y of the lower left corner
+ *   size      2 floats, width and height
+ *   color     4 bytes, R G B A
+ *
+ * These are vertex attribute arrays as they are, so the file is mapped
+ * and the columns handed to glBufferData() without touching a single
+ * element.  Later rectangles are drawn over earlier ones.  Everything is
+ * in host byte order; scene-gen writes synthetic ones. */
+struct scene_header {
+    uint32_t magic, version;
+    uint64_t count;
+    float bounds[4];   /* x0, y0, x1, y1 around every rectangle */
+    uint64_t position_offset, size_offset, color_offset;
+    uint64_t file_size;
+};
+
+struct scene {
+    const struct scene_header *header;
+    void *map;
+    size_t map_size;
+
+    uint64_t count;
+    const float *positions, *sizes;
+    const uint32_t *colors;
+
+    double map_ms;
+};
+
+/* Fill in the header of a scene of count rectangles but for its bounds,
+ * and return the size of the file. */
+uint64_t scene_layout(struct scene_header *h, uint64_t count);
+
+/* map path read only; -1 after printing why if it isn't a scene */
+int scene_open(struct scene *s, const char *path);
+void scene_close(struct scene *s);
+
+#endif
@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "shmbuf.h"
+#include "trace.h"
+
+static void buffer_release(void *data, struct wl_buffer *buffer) {
+    struct shm_buffer *b = data;
+
+    b->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    buffer_release
+};
+
+void shm_buffers_init(struct shm_buffers *b, struct wl_shm *shm) {
+    memset(b, 0, sizeof *b);
+    b->shm = shm;
+}
+
+static void release_all(struct shm_buffers *b) {
+    int i;
+
+    /* the compositor keeps whatever it has already taken from a busy
+     * buffer, destroying it is allowed */
+    for (i = 0; i < SHM_BUFFERS; i++) {
+        if (b->buffers[i].buffer)
+            wl_buffer_destroy(b->buffers[i].buffer);
+    }
+    memset(b->buffers, 0, sizeof b->buffers);
+
+    if (b->map)
+        munmap(b->map, b->size);
+    b->map = NULL;
+    b->size = 0;
+}
+
+void shm_buffers_fini(struct shm_buffers *b) {
+    release_all(b);
+}
+
+int shm_buffers_resize(struct shm_buffers *b, int width, int height) {
+    struct wl_shm_pool *pool;
+    size_t one;
+    int fd, i;
+
+    release_all(b);
+
+    /* rows start on a cache line, so bands on different threads never
+     * share one */
+    b->width = width;
+    b->height = height;
+    b->stride = (width + 15) & ~15;
+    one = (size_t) b->stride * 4 * height;
+    b->size = one * SHM_BUFFERS;
+
+    fd = memfd_create("shm-buffers", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, b->size) < 0) {
+        fprintf(stderr, "shm buffers: %s\n", strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        b->size = 0;
+        return -1;
+    }
+
+    b->map = mmap(NULL, b->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (b->map == MAP_FAILED) {
+        fprintf(stderr, "shm buffers: mmap: %s\n", strerror(errno));
+        close(fd);
+        b->map = NULL;
+        b->size = 0;
+        return -1;
+    }
+
+    /* the fd is duplicated when the request is marshalled */
+    pool = wl_shm_create_pool(b->shm, fd, b->size);
+    for (i = 0; i < SHM_BUFFERS; i++) {
+        b->buffers[i].pixels = (uint32_t *) ((char *) b->map + i * one);
+        b->buffers[i].buffer =
+            wl_shm_pool_create_buffer(pool, i * one, width, height,
+                                      b->stride * 4,
+                                      WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(b->buffers[i].buffer, &buffer_listener,
+                               &b->buffers[i]);
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    return 0;
+}
+
+struct shm_buffer *shm_buffers_next(struct shm_buffers *b,
+                                    struct wl_display *display) {
+    uint64_t start = 0;
+    int i;
+
+    for (;;) {
+        for (i = 0; i < SHM_BUFFERS; i++) {
+            if (b->buffers[i].buffer && !b->buffers[i].busy) {
+                b->frames++;
+                if (start) {
+                    b->waits++;
+                    b->wait_ns += trace_now() - start;
+                }
+                return &b->buffers[i];
+            }
+        }
+
+        if (!start)
+            start = trace_now();
+        if (wl_display_dispatch(display) < 0)
+            return NULL;
+    }
+}
+
+void shm_buffers_commit(struct shm_buffers *b,
+                        struct shm_buffer *buffer,
+                        struct wl_surface *surface) {
+    wl_surface_attach(surface, buffer->buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, INT32_MAX, INT32_MAX);
+    wl_surface_commit(surface);
+    buffer->busy = 1;
+}
+
+void shm_buffers_report(struct shm_buffers *b) {
+    if (!b->frames)
+        return;
+
+    printf("shm: %d buffers of %dx%d (%.1f MB), waited for a release in "
+           "%.1f%% of frames, %.2f ms/frame\n", SHM_BUFFERS, b->width,
+           b->height, b->size / 1e6, 100.0 * b->waits / b->frames,
+           b->wait_ns / 1e6 / b->frames);
+
+    b->frames = 0;
+    b->waits = 0;
+    b->wait_ns = 0;
+}
@@ -0,0 +1,52 @@
+#ifndef SHMBUF_H
+#define SHMBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client.h>
+
+#define SHM_BUFFERS 2
+
+/* Double-buffered XRGB8888 wl_shm buffers for the software backend.
+ *
+ * Both buffers live in one memfd mapped once.  A buffer is busy from
+ * the commit it is attached in until the compositor's wl_buffer.release,
+ * and is never drawn into in between; if both are busy the client
+ * dispatches events until one comes back. */
+struct shm_buffer {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    int busy;
+};
+
+struct shm_buffers {
+    struct wl_shm *shm;
+    struct shm_buffer buffers[SHM_BUFFERS];
+    int width, height, stride; /* stride in pixels */
+    void *map;
+    size_t size;
+
+    /* accumulated since the last shm_buffers_report() */
+    uint64_t frames, waits, wait_ns;
+};
+
+void shm_buffers_init(struct shm_buffers *b, struct wl_shm *shm);
+void shm_buffers_fini(struct shm_buffers *b);
+
+/* (re)allocate both buffers at width x height; -1 if that failed */
+int shm_buffers_resize(struct shm_buffers *b, int width, int height);
+
+/* a buffer the compositor is done with, NULL if the connection broke */
+struct shm_buffer *shm_buffers_next(struct shm_buffers *b,
+                                    struct wl_display *display);
+
+/* attach, damage all and commit, after any wl_surface_frame(); the
+ * buffer is busy from here on */
+void shm_buffers_commit(struct shm_buffers *b,
+                        struct shm_buffer *buffer,
+                        struct wl_surface *surface);
+
+void shm_buffers_report(struct shm_buffers *b);
+
+#endif
@@ -29,7 +29,9 @@
 #include <stdbool.h>
 #include <math.h>
 #include <assert.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/resource.h>
 
 #include <linux/input.h>
 
@@ -47,6 +49,21 @@
 
 #include "shared/platform.h"
 
+#include "dynres.h"
+#include "eventloop.h"
+#include "frameexport.h"
+#include "geometry.h"
+#include "gputimer.h"
+#include "ifs.h"
+#include "inputlog.h"
+#include "metrics.h"
+#include "overdraw.h"
+#include "rastercache.h"
+#include "shmbuf.h"
+#include "swraster.h"
+#include "trace.h"
+#include "wlprof.h"
+
 #ifndef EGL_EXT_swap_buffers_with_damage
 #define EGL_EXT_swap_buffers_with_damage 1
 typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)(EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint n_rects);
@@ -60,10 +77,20 @@ typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)(EGLDisplay
 struct window;
 struct seat;
 
+#define MAX_OUTPUTS 8
+
+struct output {
+    struct wl_output *output;
+    uint32_t name;
+    int scale;
+    int refresh; /* mHz of the current mode, 0 until known */
+};
+
 struct display {
     struct wl_display *display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
+    uint32_t compositor_version;
     struct xdg_shell *shell;
     struct wl_seat *seat;
     struct wl_pointer *pointer;
@@ -73,12 +100,15 @@ struct display {
     struct wl_cursor_theme *cursor_theme;
     struct wl_cursor *default_cursor;
     struct wl_surface *cursor_surface;
+    struct output outputs[MAX_OUTPUTS];
     struct {
         EGLDisplay dpy;
         EGLContext ctx;
         EGLConfig conf;
     } egl;
     struct window *window;
+    struct input_log input;
+    struct event_loop loop;
 
     PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 };
@@ -87,9 +117,23 @@ struct geometry {
     int width, height;
 };
 
+enum render_mode {
+    MODE_RECURSIVE,
+    MODE_CHAOS,
+    MODE_SHADER,
+    MODE_MESH,
+    MODE_TILES
+};
+
+/* the scene point at the centre of the window and the number of window
+ * sizes per scene unit */
+struct view {
+    double x, y, zoom;
+};
+
 struct window {
     struct display *display;
-    struct geometry geometry, window_size;
+    struct geometry geometry, window_size, allocated;
     struct {
         GLuint rotation_uniform;
         GLuint pos;
@@ -97,16 +141,82 @@ struct window {
     } gl;
 
     uint32_t benchmark_time, frames;
+    uint64_t benchmark_cpu_ns;
     struct wl_egl_window *native;
     struct wl_surface *surface;
     struct xdg_surface *xdg_surface;
     EGLSurface egl_surface;
     struct wl_callback *callback;
     int fullscreen, opaque, buffer_size, frame_sync;
+    /* -B, -D: what the surface costs to fill and hand over */
+    int dither;
+    uint64_t swap_ns;
+    /* configure and scale changes are only recorded by the listeners and
+     * applied once at the start of the next frame */
+    int scale, resize_pending, configure_pending;
+    uint32_t configure_serial, outputs;
+    struct dynres dynres;
+    struct gpu_timer gpu_timer;
+    struct overdraw overdraw;
+    struct metrics metrics;
+    enum render_mode mode;
+    int depth, chaos_batch, packed, tile_budget;
+    /* levels the depth keys asked for since the last frame, and the depth
+     * the raster cache was drawn at */
+    int depth_pending, raster_depth;
+    struct ifs *ifs;
+    struct view view;
+    struct raster_cache raster;
+    int dragging, fly;
+    /* -S: no EGL, the CPU draws into wl_shm buffers */
+    int software, sw_threads;
+    struct shm_buffers shm;
+    struct sw_pool sw_pool;
+    struct frame_export export;
 };
 
 static int running = 1;
 
+static const int benchmark_interval = 5;
+
+/* animation steps per second with -z */
+static const int animation_hz = 120;
+
+enum {
+    PASS_RASTER,
+    PASS_SCENE,
+    PASS_DYNRES
+};
+
+static const char *pass_names[] = { "raster", "scene", "dynres" };
+
+/* Startup timeline: every phase up to the first frame on screen, in ms
+ * since main() started */
+static uint64_t startup_ns;
+static int startup_done;
+
+static void startup_mark(const char *phase) {
+    if (!startup_done)
+        printf("startup: %7.2f ms  %s\n", (trace_now() - startup_ns) / 1e6,
+               phase);
+}
+
+/* user and system time of every thread in the process, llvmpipe's
+ * included, and the peak resident set size, to compare the EGL and
+ * software paths */
+static uint64_t process_cpu_ns(double *peak_mb) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    if (peak_mb)
+        *peak_mb = usage.ru_maxrss * 1024 / 1e6;
+
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+           1000000000 +
+           (uint64_t) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) *
+           1000;
+}
+
 static void init_egl(struct display *display,
                      struct window *window)
 {
@@ -123,15 +233,22 @@ static void init_egl(struct display *display,
         EGL_BLUE_SIZE, 1,
         EGL_ALPHA_SIZE, 1,
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_BUFFER_SIZE, 0,
+        EGL_STENCIL_SIZE, 0,
         EGL_NONE
     };
 
-    EGLint major, minor, n, count, i, size;
+    EGLint major, minor, n, count, i, size, r, g, b, a;
     EGLConfig *configs;
     EGLBoolean ret;
 
-    if (window->opaque || window->buffer_size == 16)
+    if (window->opaque || window->buffer_size < 32)
         config_attribs[9] = 0;
+    /* at least that size, so only the candidates are fetched and scanned */
+    config_attribs[13] = window->buffer_size;
+    /* -O counts fragments in the stencil buffer */
+    if (window->overdraw.enabled)
+        config_attribs[15] = 8;
 
     display->egl.dpy =
         weston_platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
@@ -143,7 +260,8 @@ static void init_egl(struct display *display,
     ret = eglBindAPI(EGL_OPENGL_ES_API);
     assert(ret == EGL_TRUE);
 
-    if (!eglGetConfigs(display->egl.dpy, NULL, 0, &count) || count < 1)
+    if (!eglChooseConfig(display->egl.dpy, config_attribs,
+                         NULL, 0, &count) || count < 1)
         assert(0);
 
     configs = calloc(count, sizeof *configs);
@@ -156,7 +274,10 @@ static void init_egl(struct display *display,
     for (i = 0; i < n; i++) {
         eglGetConfigAttrib(display->egl.dpy,
                    configs[i], EGL_BUFFER_SIZE, &size);
-        if (window->buffer_size == size) {
+        eglGetConfigAttrib(display->egl.dpy,
+                   configs[i], EGL_ALPHA_SIZE, &a);
+        /* 16 bit means RGB565, not RGBA4444 or RGBA5551 */
+        if (window->buffer_size == size && (size == 32 || a == 0)) {
             display->egl.conf = configs[i];
             break;
         }
@@ -168,6 +289,17 @@ static void init_egl(struct display *display,
         exit(EXIT_FAILURE);
     }
 
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_RED_SIZE, &r);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_GREEN_SIZE, &g);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_BLUE_SIZE, &b);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_ALPHA_SIZE, &a);
+    printf("EGL config: %d bit, R%d G%d B%d A%d\n",
+           window->buffer_size, r, g, b, a);
+
     display->egl.ctx = eglCreateContext(display->egl.dpy,
                         display->egl.conf,
                         EGL_NO_CONTEXT, context_attribs);
@@ -193,6 +325,26 @@ static void fini_egl(struct display *display)
     eglReleaseThread();
 }
 
+static void window_configure(struct window *window,
+                             int32_t width,
+                             int32_t height,
+                             int fullscreen) {
+    window->fullscreen = fullscreen;
+
+    if (width > 0 && height > 0) {
+        if (!window->fullscreen) {
+            window->window_size.width = width;
+            window->window_size.height = height;
+        }
+        window->geometry.width = width;
+        window->geometry.height = height;
+    } else if (!window->fullscreen) {
+        window->geometry = window->window_size;
+    }
+
+    window->resize_pending = 1;
+}
+
 static void handle_surface_configure(void *data,
                                      struct xdg_surface *surface,
                                      int32_t width,
@@ -200,35 +352,30 @@ static void handle_surface_configure(void *data,
                                      struct wl_array *states,
                                      uint32_t serial) {
     struct window *window = data;
+    int fullscreen = 0;
     uint32_t *p;
 
-    window->fullscreen = 0;
     wl_array_for_each(p, states) {
         uint32_t state = *p;
         switch (state) {
         case XDG_SURFACE_STATE_FULLSCREEN:
-            window->fullscreen = 1;
+            fullscreen = 1;
             break;
         }
     }
 
-    if (width > 0 && height > 0) {
-        if (!window->fullscreen) {
-            window->window_size.width = width;
-            window->window_size.height = height;
-        }
-        window->geometry.width = width;
-        window->geometry.height = height;
-    } else if (!window->fullscreen) {
-        window->geometry = window->window_size;
-    }
-
-    if (window->native)
-        wl_egl_window_resize(window->native,
-                     window->geometry.width,
-                     window->geometry.height, 0, 0);
-
-    xdg_surface_ack_configure(surface, serial);
+    /* a replay keeps the recorded size, but the configure must still be
+     * acked */
+    if (input_log_event(&window->display->input, INPUT_CONFIGURE, 0,
+                        width, height, fullscreen))
+        window_configure(window, width, height, fullscreen);
+
+    /* Interactive resizes send configures in bursts; only remember the
+     * latest one and let window_apply_resize() reallocate and ack once
+     * per frame. */
+    window->resize_pending = 1;
+    window->configure_pending = 1;
+    window->configure_serial = serial;
 }
 
 static void handle_surface_delete(void *data,
@@ -252,16 +399,159 @@ static void create_xdg_surface(struct window *window,
     xdg_surface_set_title(window->xdg_surface, "squares-wayland");
 }
 
+static void window_update_scale(struct window *window) {
+    struct display *display = window->display;
+    int i, scale = 1;
+
+    /* render for the densest output we are on, the compositor
+     * downscales for the others */
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if ((window->outputs & (1 << i)) &&
+            display->outputs[i].scale > scale)
+            scale = display->outputs[i].scale;
+    }
+
+    /* buffer scales came with wl_compositor version 3 */
+    if (display->compositor_version < 3)
+        scale = 1;
+
+    if (scale != window->scale) {
+        window->scale = scale;
+        window->resize_pending = 1;
+    }
+}
+
+/* Refresh interval of the fastest output we are on, which is the one the
+ * compositor paces frame callbacks by; 0 if unknown or not synced to it. */
+static uint64_t window_refresh_ns(struct window *window) {
+    struct display *display = window->display;
+    int i, refresh = 0;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if ((window->outputs & (1 << i)) &&
+            display->outputs[i].refresh > refresh)
+            refresh = display->outputs[i].refresh;
+    }
+
+    if (!window->frame_sync || refresh <= 0)
+        return 0;
+    return 1000000000000ull / refresh;
+}
+
+static struct output *display_find_output(struct display *display,
+                                          struct wl_output *wl_output) {
+    int i;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (display->outputs[i].output == wl_output)
+            return &display->outputs[i];
+    }
+
+    return NULL;
+}
+
+static void surface_handle_enter(void *data,
+                                 struct wl_surface *surface,
+                                 struct wl_output *wl_output) {
+    struct window *window = data;
+    struct output *output = display_find_output(window->display, wl_output);
+
+    if (!output)
+        return;
+
+    window->outputs |= 1 << (output - window->display->outputs);
+    window_update_scale(window);
+}
+
+static void surface_handle_leave(void *data,
+                                 struct wl_surface *surface,
+                                 struct wl_output *wl_output) {
+    struct window *window = data;
+    struct output *output = display_find_output(window->display, wl_output);
+
+    if (!output)
+        return;
+
+    window->outputs &= ~(1 << (output - window->display->outputs));
+    window_update_scale(window);
+}
+
+static const struct wl_surface_listener surface_listener = {
+    surface_handle_enter,
+    surface_handle_leave
+};
+
+static void output_handle_geometry(void *data,
+                                   struct wl_output *wl_output,
+                                   int32_t x,
+                                   int32_t y,
+                                   int32_t physical_width,
+                                   int32_t physical_height,
+                                   int32_t subpixel,
+                                   const char *make,
+                                   const char *model,
+                                   int32_t transform) {}
+
+static void output_handle_mode(void *data,
+                               struct wl_output *wl_output,
+                               uint32_t flags,
+                               int32_t width,
+                               int32_t height,
+                               int32_t refresh) {
+    struct output *output = display_find_output(data, wl_output);
+
+    if (output && (flags & WL_OUTPUT_MODE_CURRENT))
+        output->refresh = refresh;
+}
+
+static void output_handle_done(void *data,
+                               struct wl_output *wl_output) {
+    struct display *d = data;
+
+    if (d->window && d->window->surface)
+        window_update_scale(d->window);
+}
+
+static void output_handle_scale(void *data,
+                                struct wl_output *wl_output,
+                                int32_t scale) {
+    struct output *output = display_find_output(data, wl_output);
+
+    if (output)
+        output->scale = scale;
+}
+
+static const struct wl_output_listener output_listener = {
+    output_handle_geometry,
+    output_handle_mode,
+    output_handle_done,
+    output_handle_scale
+};
+
 static void create_surface(struct window *window) {
     struct display *display = window->display;
     EGLBoolean ret;
 
     window->surface = wl_compositor_create_surface(display->compositor);
+    wl_surface_add_listener(window->surface, &surface_listener, window);
+
+    if (window->software) {
+        shm_buffers_init(&window->shm, display->shm);
+        if (shm_buffers_resize(&window->shm, window->geometry.width,
+                               window->geometry.height) < 0)
+            exit(EXIT_FAILURE);
+        window->allocated = window->geometry;
+        create_xdg_surface(window, display);
+        if (window->fullscreen)
+            xdg_surface_set_fullscreen(window->xdg_surface, NULL);
+        return;
+    }
 
     window->native =
         wl_egl_window_create(window->surface,
                      window->geometry.width,
                      window->geometry.height);
+    window->allocated = window->geometry;
     window->egl_surface =
         weston_platform_create_egl_surface(display->egl.dpy,
                            display->egl.conf,
@@ -273,8 +563,8 @@ static void create_surface(struct window *window) {
                  window->egl_surface, window->display->egl.ctx);
     assert(ret == EGL_TRUE);
 
-    if (!window->frame_sync)
-        eglSwapInterval(display->egl.dpy, 0);
+    /* the main loop waits for the frame callback itself */
+    eglSwapInterval(display->egl.dpy, 0);
 
     if (!display->shell)
         return;
@@ -284,6 +574,15 @@ static void create_surface(struct window *window) {
 }
 
 static void destroy_surface(struct window *window) {
+    if (window->software) {
+        shm_buffers_fini(&window->shm);
+        xdg_surface_destroy(window->xdg_surface);
+        wl_surface_destroy(window->surface);
+        if (window->callback)
+            wl_callback_destroy(window->callback);
+        return;
+    }
+
     /* Required, otherwise segfault in egl_dri2.c: dri2_make_current()
      * on eglReleaseThread(). */
     eglMakeCurrent(window->display->egl.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -299,15 +598,105 @@ static void destroy_surface(struct window *window) {
         wl_callback_destroy(window->callback);
 }
 
-uint32_t p_x, p_y;
+double p_x, p_y;
+
+static void update_projection(struct window *window);
+
+#define VIEW_MIN_ZOOM 0.25
+#define VIEW_MAX_ZOOM 1e12
+
+/* surface pixels per scene unit */
+static double view_pixels(struct window *window) {
+    int size = window->geometry.width < window->geometry.height ?
+               window->geometry.width : window->geometry.height;
+
+    return window->view.zoom * size;
+}
+
+static void view_pan(struct window *window, double dx, double dy) {
+    double ppu = view_pixels(window);
+
+    window->view.x -= dx / ppu;
+    window->view.y += dy / ppu;
+    update_projection(window);
+}
+
+/* zoom by factor, keeping the scene point under (px, py) in place */
+static void view_zoom(struct window *window,
+                      double factor,
+                      double px,
+                      double py) {
+    double ppu = view_pixels(window), zoom = window->view.zoom * factor;
+    double qx, qy;
+
+    if (zoom < VIEW_MIN_ZOOM)
+        zoom = VIEW_MIN_ZOOM;
+    if (zoom > VIEW_MAX_ZOOM)
+        zoom = VIEW_MAX_ZOOM;
+
+    qx = window->view.x + (px - window->geometry.width / 2.0) / ppu;
+    qy = window->view.y - (py - window->geometry.height / 2.0) / ppu;
+    window->view.x = qx - (qx - window->view.x) * window->view.zoom / zoom;
+    window->view.y = qy - (qy - window->view.y) * window->view.zoom / zoom;
+    window->view.zoom = zoom;
+    update_projection(window);
+}
+
+/* -z: zoom in on the fixed point of top, then right, then left corner
+ * maps, (5/14, sqrt(3)/14), at one octave per second.  The picture
+ * repeats every factor of 8 while the depth needed keeps growing. */
+static void view_fly(struct window *window) {
+    double t = window->display->input.frame_ns / 1e9;
+
+    window->view.x = 5.0 / 14;
+    window->view.y = sqrt(3) / 14;
+    window->view.zoom = pow(2, fmod(t, log2(VIEW_MAX_ZOOM)));
+    update_projection(window);
+}
+
+static void pointer_handle_enter(void *data,
+                                 struct wl_pointer *pointer,
+                                 uint32_t serial,
+                                 struct wl_surface *surface,
+                                 wl_fixed_t sx,
+                                 wl_fixed_t sy) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_ENTER, 0, sx, sy, 0))
+        return;
+
+    p_x = wl_fixed_to_double(sx);
+    p_y = wl_fixed_to_double(sy);
+}
+
+static void pointer_handle_leave(void *data,
+                                 struct wl_pointer *pointer,
+                                 uint32_t serial,
+                                 struct wl_surface *surface) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_LEAVE, 0, 0, 0, 0))
+        return;
+
+    d->window->dragging = 0;
+}
 
 static void pointer_handle_motion(void *data,
                                   struct wl_pointer *pointer,
                                   uint32_t time,
                                   wl_fixed_t sx,
                                   wl_fixed_t sy) {
-    p_x = wl_fixed_to_int(sx);
-    p_y = wl_fixed_to_int(sy);
+    struct display *d = data;
+    double x = wl_fixed_to_double(sx), y = wl_fixed_to_double(sy);
+
+    if (!input_log_event(&d->input, INPUT_POINTER_MOTION, time, sx, sy, 0))
+        return;
+
+    if (d->window->dragging)
+        view_pan(d->window, x - p_x, y - p_y);
+
+    p_x = x;
+    p_y = y;
 }
 
 static void pointer_handle_button(void *data,
@@ -316,6 +705,15 @@ static void pointer_handle_button(void *data,
                                   uint32_t time,
                                   uint32_t button,
                                   uint32_t state) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_BUTTON, time,
+                         button, state, 0))
+        return;
+
+    if (button == BTN_LEFT)
+        d->window->dragging = state == WL_POINTER_BUTTON_STATE_PRESSED;
+
     if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
                if (p_x < 128 && p_y < 128) {
             printf("cyan\n");
@@ -329,15 +727,129 @@ static void pointer_handle_button(void *data,
     }
 }
 
+/* a wheel click is 10 axis units, four of them double the zoom */
+static void pointer_handle_axis(void *data,
+                                struct wl_pointer *wl_pointer,
+                                uint32_t time,
+                                uint32_t axis,
+                                wl_fixed_t value) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_AXIS, time,
+                         axis, value, 0))
+        return;
+
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL && !d->window->fly)
+        view_zoom(d->window, pow(2, -wl_fixed_to_double(value) / 40),
+                  p_x, p_y);
+}
+
 /* this can't be allocated on the stack or it will get clobbered */
 static const struct wl_pointer_listener pointer_listener = {
-    NULL,
-    NULL,
+    pointer_handle_enter,
+    pointer_handle_leave,
     pointer_handle_motion,
     pointer_handle_button,
-    NULL,
+    pointer_handle_axis,
+};
+
+static void keyboard_handle_keymap(void *data,
+                                   struct wl_keyboard *keyboard,
+                                   uint32_t format,
+                                   int fd,
+                                   uint32_t size) {
+    /* keys are only told apart by their evdev codes */
+    close(fd);
+}
+
+static void keyboard_handle_enter(void *data,
+                                  struct wl_keyboard *keyboard,
+                                  uint32_t serial,
+                                  struct wl_surface *surface,
+                                  struct wl_array *keys) {
+}
+
+static void keyboard_handle_leave(void *data,
+                                  struct wl_keyboard *keyboard,
+                                  uint32_t serial,
+                                  struct wl_surface *surface) {
+}
+
+/* Up or + one level deeper, Down or - one level shallower */
+static void keyboard_handle_key(void *data,
+                                struct wl_keyboard *keyboard,
+                                uint32_t serial,
+                                uint32_t time,
+                                uint32_t key,
+                                uint32_t state) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_KEY, time, key, state, 0))
+        return;
+
+    if (state != WL_KEYBOARD_KEY_STATE_PRESSED)
+        return;
+
+    switch (key) {
+    case KEY_UP:
+    case KEY_EQUAL:
+    case KEY_KPPLUS:
+        d->window->depth_pending++;
+        break;
+    case KEY_DOWN:
+    case KEY_MINUS:
+    case KEY_KPMINUS:
+        d->window->depth_pending--;
+        break;
+    }
+}
+
+static void keyboard_handle_modifiers(void *data,
+                                      struct wl_keyboard *keyboard,
+                                      uint32_t serial,
+                                      uint32_t mods_depressed,
+                                      uint32_t mods_latched,
+                                      uint32_t mods_locked,
+                                      uint32_t group) {
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    keyboard_handle_keymap,
+    keyboard_handle_enter,
+    keyboard_handle_leave,
+    keyboard_handle_key,
+    keyboard_handle_modifiers,
 };
 
+/* replay: logged input goes through the same handlers as live input */
+static void input_dispatch(void *data, const struct input_record *r) {
+    struct display *d = data;
+
+    switch (r->type) {
+    case INPUT_POINTER_ENTER:
+        pointer_handle_enter(d, NULL, 0, NULL, r->a, r->b);
+        break;
+    case INPUT_POINTER_LEAVE:
+        pointer_handle_leave(d, NULL, 0, NULL);
+        break;
+    case INPUT_POINTER_MOTION:
+        pointer_handle_motion(d, NULL, r->time, r->a, r->b);
+        break;
+    case INPUT_POINTER_BUTTON:
+        pointer_handle_button(d, NULL, 0, r->time, r->a, r->b);
+        break;
+    case INPUT_POINTER_AXIS:
+        pointer_handle_axis(d, NULL, r->time, r->a, r->b);
+        break;
+    case INPUT_KEY:
+        keyboard_handle_key(d, NULL, 0, r->time, r->a, r->b);
+        break;
+    case INPUT_CONFIGURE:
+        window_configure(d->window, r->a, r->b, r->c);
+        break;
+    }
+}
+
 static void seat_handle_capabilities(struct display *d,
                                      struct wl_seat *seat,
                                      enum wl_seat_capability caps) {
@@ -348,6 +860,14 @@ static void seat_handle_capabilities(struct display *d,
         wl_pointer_destroy(d->pointer);
         d->pointer = NULL;
     }
+
+    if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !d->keyboard) {
+        d->keyboard = wl_seat_get_keyboard(seat);
+        wl_keyboard_add_listener(d->keyboard, &keyboard_listener, d);
+    } else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && d->keyboard) {
+        wl_keyboard_destroy(d->keyboard);
+        d->keyboard = NULL;
+    }
 }
 
 static const struct wl_seat_listener seat_listener = {
@@ -378,38 +898,66 @@ static void registry_handle_global(void *data,
     struct display *d = data;
 
     if (strcmp(interface, "wl_compositor") == 0) {
+        d->compositor_version = version < 3 ? version : 3;
         d->compositor =
             wl_registry_bind(registry, name,
-                     &wl_compositor_interface, 1);
+                     &wl_compositor_interface,
+                     d->compositor_version);
     } else if (strcmp(interface, "xdg_shell") == 0) {
         d->shell = wl_registry_bind(registry, name,
                         &xdg_shell_interface, 1);
         xdg_shell_add_listener(d->shell, &xdg_shell_listener, d);
         xdg_shell_use_unstable_version(d->shell, XDG_VERSION);
+    } else if (strcmp(interface, "wl_shm") == 0) {
+        d->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
     } else if (strcmp(interface, "wl_seat") == 0) {
         d->seat = wl_registry_bind(registry, name,
                        &wl_seat_interface, 1);
         wl_seat_add_listener(d->seat, &seat_listener, d);
+    } else if (strcmp(interface, "wl_output") == 0) {
+        struct output *output = display_find_output(d, NULL);
+
+        if (!output)
+            return;
+
+        output->output = wl_registry_bind(registry, name,
+                                          &wl_output_interface,
+                                          version < 2 ? version : 2);
+        output->name = name;
+        output->scale = 1;
+        wl_output_add_listener(output->output, &output_listener, d);
     }
 }
 
 static void registry_handle_global_remove(void *data,
                                           struct wl_registry *registry,
-                                          uint32_t name) {}
+                                          uint32_t name) {
+    struct display *d = data;
+    int i;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (d->outputs[i].output && d->outputs[i].name == name) {
+            wl_output_destroy(d->outputs[i].output);
+            memset(&d->outputs[i], 0, sizeof d->outputs[i]);
+            if (d->window) {
+                d->window->outputs &= ~(1 << i);
+                window_update_scale(d->window);
+            }
+        }
+    }
+}
 
 static const struct wl_registry_listener registry_listener = {
     registry_handle_global,
     registry_handle_global_remove
 };
 
-static void signal_int(int signum) {
-    running = 0;
-}
-
 static GLuint position_l,
               projection_l,
               model_l,
-              color_l;
+              color_l,
+              point_size_l,
+              decode_l;
 
 static const GLfloat triangle_up[] = {
     0.0,     0.0,
@@ -433,6 +981,25 @@ GLfloat projection[] = {
     0.0f, 0.0f, 0.0f,  1.0f
 };
 
+/* keep the scene square in non-square windows, centred on the view */
+static void update_projection(struct window *window) {
+    int width = window->geometry.width, height = window->geometry.height;
+    double sx = 1.0, sy = 1.0;
+
+    if (width > height)
+        sx = (double) height / width;
+    else
+        sy = (double) width / height;
+
+    sx *= 2 * window->view.zoom;
+    sy *= 2 * window->view.zoom;
+
+    projection[0] = sx;
+    projection[3] = -sx * window->view.x;
+    projection[5] = sy;
+    projection[7] = -sy * window->view.y;
+}
+
 GLfloat model[] = {
     1.0f, 0.0f, 0.0f, 0.0f,
     0.0f, 1.0f, 0.0f, 0.0f,
@@ -440,6 +1007,23 @@ GLfloat model[] = {
     0.0f, 0.0f, 0.0f, 1.0f
 };
 
+/* Applied to the position attribute before model and projection, so
+ * that vertex data can be stored in a packed integer format and decoded
+ * in the shader.  Float positions use the identity. */
+static const GLfloat decode_identity[] = {
+    1.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 1.0f
+};
+
+/* vertex data handed to GL, for the benchmark output */
+static struct {
+    uint64_t uploaded, resident;
+} vertex_bytes;
+
+/* GL draw calls of the frame being drawn, for the metrics */
+static uint64_t draw_calls;
+
 void draw_triangle(GLfloat x,
                    GLfloat y,
                    GLfloat s,
@@ -465,9 +1049,13 @@ void draw_triangle(GLfloat x,
     glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, b);
     glEnableVertexAttribArray(position_l);
     glDrawArrays(GL_LINE_STRIP, 0, 4);
+    draw_calls++;
+
+    /* client side array, copied by the driver on every draw */
+    vertex_bytes.uploaded += sizeof triangle_up;
 
-    model[12] = 0;
-    model[13] = 0;
+    model[3] = 0;
+    model[7] = 0;
     model[0] = 1;
     model[5] = 1;
 
@@ -497,57 +1085,1308 @@ void sierpinski(GLfloat x,
     sierpinski(x + 2 * v, y, i, m);
 }
 
-void sierpinski2_(GLfloat x,
-                  GLfloat y,
-                  uint64_t i,
-                  uint64_t m) {
-    if (i > m) return;
+/* sierpinski2_() lives in geometry.c, this draws what it emits */
+static void emit_triangle(void *data, GLfloat x, GLfloat y, GLfloat s) {
+    draw_triangle(x, y, s, color, 1);
+}
 
-    draw_triangle(x,
-                  y,
-                  1.0 / pow(2, i),
-                  color,
-                  1);
+static void window_apply_resize(struct window *window) {
+    int width, height;
+
+    if (!window->resize_pending)
+        return;
+    window->resize_pending = 0;
+
+    width = window->geometry.width * window->scale;
+    height = window->geometry.height * window->scale;
+
+    /* the new buffer size takes effect at the next eglSwapBuffers(),
+     * or shm commit, together with the buffer scale and the ack below */
+    if (width != window->allocated.width ||
+        height != window->allocated.height) {
+        if (window->software) {
+            if (shm_buffers_resize(&window->shm, width, height) < 0)
+                exit(EXIT_FAILURE);
+        } else {
+            wl_egl_window_resize(window->native, width, height, 0, 0);
+        }
+        window->allocated.width = width;
+        window->allocated.height = height;
+    }
+    if (window->display->compositor_version >= 3)
+        wl_surface_set_buffer_scale(window->surface, window->scale);
 
-    i++;
+    if (!window->software) {
+        glViewport(0, 0, width, height);
+        dynres_resize(&window->dynres, width, height);
+    }
+    frame_export_resize(&window->export, width, height);
+    update_projection(window);
 
-    sierpinski2_(x, y, i, m);
-    sierpinski2_(x + 1.0 / pow(2, i), y, i, m);
-    sierpinski2_(x + 1.0 / pow(2, i + 1), y + sqrt(3) / pow(2, i + 1), i, m);
+    if (window->configure_pending) {
+        xdg_surface_ack_configure(window->xdg_surface,
+                                  window->configure_serial);
+        window->configure_pending = 0;
+    }
+}
+
+/* Chaos game: instead of emitting 3^depth triangles, walk a random
+ * point halfway towards a randomly chosen corner of triangle_up and plot
+ * every step.  Each frame generates one batch of points into the oldest
+ * buffer of a fixed ring and draws the whole ring, so the picture
+ * accumulates over CHAOS_RING frames while memory stays bounded. */
+#define CHAOS_RING 8
+/* points per batch, which makes 1 GB resident in floats */
+#define CHAOS_MAX_BATCH (1 << 24)
+
+static struct {
+    GLuint vbo[CHAOS_RING];
+    GLsizei count[CHAOS_RING];
+    int head;
+    void *batch;
+    size_t point_size;
+    uint64_t state;
+    GLfloat x, y;
+    uint64_t points, gen_ns, upload_ns;
+} chaos;
+
+/* xorshift64*, good enough for picking corners and much cheaper than
+ * rand() */
+static inline uint64_t xorshift64s(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static void chaos_init(struct window *window) {
+    chaos.point_size = window->packed ? 2 * sizeof(GLushort) :
+                                        2 * sizeof(GLfloat);
+    chaos.batch = malloc((size_t) window->chaos_batch * chaos.point_size);
+    assert(chaos.batch);
+
+    glGenBuffers(CHAOS_RING, chaos.vbo);
+    chaos.state = window->display->input.seed;
+
+    /* start on a corner, which is already on the attractor */
+    chaos.x = triangle_up[0];
+    chaos.y = triangle_up[1];
+}
+
+static void chaos_fini(void) {
+    glDeleteBuffers(CHAOS_RING, chaos.vbo);
+    free(chaos.batch);
+}
+
+/* Packed points are normalized GLushorts over the bounding box of
+ * triangle_up; unlike the mesh they are not lattice points, but the
+ * rounding error of 2^-16 is far below a pixel. */
+static const GLfloat chaos_decode_packed[] = {
+    1.0f, 0.0f,      0.0f,
+    0.0f, sqrt(3)/2, 0.0f,
+    0.0f, 0.0f,      1.0f
+};
+
+static void chaos_generate(void *out, int n, int packed) {
+    GLfloat *f = out;
+    GLushort *p = out;
+    GLfloat x = chaos.x, y = chaos.y;
+    uint64_t r = 0;
+    uint32_t k;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        /* two picks per 64 bit draw, mapped onto [0, 3) without a
+         * division */
+        if (!(i & 1))
+            r = xorshift64s(&chaos.state);
+        k = ((r & 0xffffffff) * 3) >> 32;
+        r >>= 32;
+
+        x = (x + triangle_up[2 * k]) * 0.5f;
+        y = (y + triangle_up[2 * k + 1]) * 0.5f;
+        if (packed) {
+            p[2 * i] = x * 65535.0f + 0.5f;
+            p[2 * i + 1] = y * (65535.0f / chaos_decode_packed[4]) + 0.5f;
+        } else {
+            f[2 * i] = x;
+            f[2 * i + 1] = y;
+        }
+    }
+
+    chaos.x = x;
+    chaos.y = y;
+}
+
+static void chaos_draw(struct window *window) {
+    int n = window->chaos_batch;
+    size_t size = (size_t) n * chaos.point_size;
+    uint64_t t0, t1, t2;
+    int i;
+
+    t0 = trace_now();
+    chaos_generate(chaos.batch, n, window->packed);
+    t1 = trace_now();
+
+    /* glBufferData orphans the old store, so we never wait on a draw
+     * that is still reading this slot */
+    glBindBuffer(GL_ARRAY_BUFFER, chaos.vbo[chaos.head]);
+    glBufferData(GL_ARRAY_BUFFER, size, chaos.batch, GL_STREAM_DRAW);
+    vertex_bytes.uploaded += size;
+    vertex_bytes.resident = CHAOS_RING * size;
+    chaos.count[chaos.head] = n;
+    chaos.head = (chaos.head + 1) % CHAOS_RING;
+    t2 = trace_now();
+
+    chaos.points += n;
+    chaos.gen_ns += t1 - t0;
+    chaos.upload_ns += t2 - t1;
+    trace_record("chaos_generate", t0, t1);
+    trace_record("chaos_upload", t1, t2);
+
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glUniform4fv(color_l, 1, color);
+    glUniformMatrix3fv(decode_l, 1, GL_FALSE,
+                       window->packed ? chaos_decode_packed : decode_identity);
+
+    TRACE_SCOPE("chaos_submit");
+    glEnableVertexAttribArray(position_l);
+    for (i = 0; i < CHAOS_RING; i++) {
+        if (!chaos.count[i])
+            continue;
+        glBindBuffer(GL_ARRAY_BUFFER, chaos.vbo[i]);
+        if (window->packed)
+            glVertexAttribPointer(position_l, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+                                  0, 0);
+        else
+            glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, 0);
+        glDrawArrays(GL_POINTS, 0, chaos.count[i]);
+        draw_calls++;
+    }
+
+    /* draw_triangle() uses client side arrays */
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Mesh and software modes keep the leaf lines of every level up to the
+ * depth, each made from the one above it by geometry.c or ifs.c, so that
+ * the depth can be changed at runtime without starting over: one level
+ * deeper is generated from the deepest there is, one level shallower is
+ * already there and simply drawn instead.  Drawing the leaves of a level
+ * draws every level above it too (see geometry.h), so a frame only ever
+ * draws one of them. */
+#define LEVEL_MAX_DEPTH 24
+
+struct level {
+    void *data;   /* NULL once it is only in vbos */
+    size_t count; /* vertices */
+    GLfloat decode[9];
+    GLuint *vbos;
+    int n_vbos;
+};
+
+static size_t level_vertex_size(int packed) {
+    return packed ? 2 * sizeof(GLushort) : 2 * sizeof(GLfloat);
 }
 
-void sierpinski2(uint64_t m) {
-    sierpinski2_(0, 0, 0, m);
+/* the triangles, or shapes of an IFS, of a level */
+static uint64_t level_shapes(const struct window *window,
+                             const struct level *l) {
+    return l->count / (window->ifs ? window->ifs->n_vertices : 6);
+}
+
+/* levels[m] from levels[m - 1], which must still be in memory, or from
+ * scratch for m = 0.  No GL calls, so any thread can do it.  Returns -1
+ * if out of memory. */
+static int level_generate(const struct window *window,
+                          int packed,
+                          struct level *levels,
+                          int m) {
+    const struct ifs *ifs = window->ifs;
+    const struct level *up = m ? &levels[m - 1] : NULL;
+    struct level *l = &levels[m];
+    size_t count;
+
+    if (ifs)
+        count = up ? up->count * ifs->n_maps : (size_t) ifs->n_vertices;
+    else
+        count = up ? up->count * 3 : 6;
+
+    l->data = malloc(count * level_vertex_size(packed));
+    if (!l->data)
+        return -1;
+
+    if (ifs) {
+        l->count = up ? ifs_next_level(ifs, up->data, up->count, l->data) :
+                        ifs_lines(ifs, 0, l->data);
+        ifs_fit(l->data, l->count, l->decode);
+    } else if (packed) {
+        l->count = up ? sierpinski2_next_level_lines_packed(m - 1, up->data,
+                                                            up->count,
+                                                            l->data) :
+                        sierpinski2_leaf_lines_packed(0, l->data);
+        sierpinski2_lattice_decode(m, l->decode);
+    } else {
+        l->count = up ? sierpinski2_next_level_lines(m - 1, up->data,
+                                                     up->count, l->data) :
+                        sierpinski2_leaf_lines(0, l->data);
+        memcpy(l->decode, decode_identity, sizeof l->decode);
+    }
+
+    if (!l->count) {
+        free(l->data);
+        l->data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Mesh mode: the levels in static vertex buffers, each drawn with one
+ * call.  With -p the vertices are the raw GLushort lattice coordinates
+ * from geometry.c, decoded by the vertex shader, which halves the size of
+ * the buffers.  With -i the mesh is some other IFS from ifs.c instead,
+ * fitted into the unit square by the decode matrix.
+ *
+ * Every level is split into vertex buffers of MESH_CHUNK_VERTICES.  A
+ * level deeper than those at startup is generated by a worker thread
+ * from the deepest one, whose vertices stay in memory for that, then
+ * uploaded a buffer per frame, while the frames go on drawing the deepest
+ * level uploaded so far.  A single buffer for the whole level would do as
+ * well for drawing, but allocating one of tens of MB alone can take a
+ * frame or three. */
+#define MESH_CHUNK_VERTICES (1 << 19)
+
+static struct {
+    struct level levels[LEVEL_MAX_DEPTH + 1];
+    int packed;
+    GLenum type;
+    /* levels below built are uploaded */
+    int built;
+
+    /* level built, on its way */
+    pthread_t worker;
+    int working, ready, uploading;
+    uint64_t generate_ns;
+} mesh;
+
+/* the vertex data of levels 0 to the depth */
+static void mesh_generate(struct window *window) {
+    int m;
+
+    mesh.packed = window->packed && !window->ifs;
+    mesh.type = mesh.packed ? GL_UNSIGNED_SHORT : GL_FLOAT;
+
+    for (m = 0; m <= window->depth; m++) {
+        if (level_generate(window, mesh.packed, mesh.levels, m) < 0) {
+            fprintf(stderr, "mesh: out of memory at depth %d\n", m);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* vertices of buffer i of a level */
+static GLsizei mesh_chunk_count(const struct level *l, int i) {
+    size_t first = (size_t) i * MESH_CHUNK_VERTICES;
+
+    return l->count - first < MESH_CHUNK_VERTICES ?
+           l->count - first : MESH_CHUNK_VERTICES;
+}
+
+static void mesh_upload_chunk(struct level *l, int i) {
+    size_t vertex_size = level_vertex_size(mesh.packed);
+    size_t size = mesh_chunk_count(l, i) * vertex_size;
+
+    glGenBuffers(1, &l->vbos[i]);
+    glBindBuffer(GL_ARRAY_BUFFER, l->vbos[i]);
+    glBufferData(GL_ARRAY_BUFFER, size,
+                 (const char *) l->data +
+                 (size_t) i * MESH_CHUNK_VERTICES * vertex_size,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    vertex_bytes.resident += size;
+}
+
+static int mesh_alloc_vbos(struct level *l) {
+    l->n_vbos = (l->count + MESH_CHUNK_VERTICES - 1) / MESH_CHUNK_VERTICES;
+    l->vbos = calloc(l->n_vbos, sizeof *l->vbos);
+    if (!l->vbos) {
+        l->n_vbos = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void mesh_init(struct window *window) {
+    struct level *l;
+    int m, i;
+
+    mesh_generate(window);
+    startup_mark("mesh generated");
+
+    vertex_bytes.resident = 0;
+    for (m = 0; m <= window->depth; m++) {
+        l = &mesh.levels[m];
+        if (mesh_alloc_vbos(l) < 0) {
+            fprintf(stderr, "mesh: out of memory at depth %d\n", m);
+            exit(EXIT_FAILURE);
+        }
+        for (i = 0; i < l->n_vbos; i++)
+            mesh_upload_chunk(l, i);
+
+        /* the deepest one is needed for the next */
+        if (m < window->depth) {
+            free(l->data);
+            l->data = NULL;
+        }
+    }
+    mesh.built = window->depth + 1;
+
+    l = &mesh.levels[window->depth];
+    printf("mesh: depth %d, %llu %s, %.1f MB %s, %.1f MB with the levels "
+           "above\n", window->depth,
+           (unsigned long long) level_shapes(window, l),
+           window->ifs ? "shapes" : "triangles",
+           l->count * level_vertex_size(mesh.packed) / 1e6,
+           mesh.packed ? "packed" : "float", vertex_bytes.resident / 1e6);
+}
+
+static void *mesh_worker(void *data) {
+    uint64_t start = trace_now();
+
+    if (level_generate(data, mesh.packed, mesh.levels, mesh.built) < 0)
+        mesh.levels[mesh.built].data = NULL;
+    mesh.generate_ns = trace_now() - start;
+
+    __atomic_store_n(&mesh.ready, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+/* Before every frame: carry on with the level on its way, if any, and
+ * start on the next one if the depth is deeper than the levels built. */
+static void mesh_update(struct window *window) {
+    TRACE_SCOPE("mesh_update");
+    struct level *l = &mesh.levels[mesh.built];
+    int i;
+
+    if (mesh.working) {
+        if (!__atomic_load_n(&mesh.ready, __ATOMIC_ACQUIRE))
+            return;
+        pthread_join(mesh.worker, NULL);
+        mesh.working = 0;
+
+        if (!l->data || mesh_alloc_vbos(l) < 0) {
+            fprintf(stderr, "mesh: out of memory at depth %d\n",
+                    mesh.built);
+            free(l->data);
+            l->data = NULL;
+            window->depth = mesh.built - 1;
+            return;
+        }
+
+        mesh.uploading = 1;
+    }
+
+    if (mesh.uploading) {
+        i = mesh.uploading - 1;
+        mesh_upload_chunk(l, i);
+        vertex_bytes.uploaded += mesh_chunk_count(l, i) *
+                                 level_vertex_size(mesh.packed);
+        if (++mesh.uploading <= l->n_vbos)
+            return;
+
+        /* this one is the one the next is made from now */
+        mesh.uploading = 0;
+        free(mesh.levels[mesh.built - 1].data);
+        mesh.levels[mesh.built - 1].data = NULL;
+
+        printf("mesh: depth %d, %llu %s, %.1f MB generated in %.1f ms, "
+               "uploaded over %d frames\n", mesh.built,
+               (unsigned long long) level_shapes(window, l),
+               window->ifs ? "shapes" : "triangles",
+               l->count * level_vertex_size(mesh.packed) / 1e6,
+               mesh.generate_ns / 1e6, l->n_vbos);
+        mesh.built++;
+    }
+
+    if (window->depth >= mesh.built) {
+        mesh.ready = 0;
+        mesh.working = pthread_create(&mesh.worker, NULL, mesh_worker,
+                                      window) == 0;
+    }
+}
+
+/* the depth actually drawn, which lags behind while a level is on its
+ * way */
+static int mesh_depth(struct window *window) {
+    return window->depth < mesh.built ? window->depth : mesh.built - 1;
+}
+
+static void mesh_fini(void) {
+    int m;
+
+    if (mesh.working)
+        pthread_join(mesh.worker, NULL);
+
+    for (m = 0; m <= LEVEL_MAX_DEPTH; m++) {
+        free(mesh.levels[m].data);
+        if (mesh.levels[m].vbos)
+            glDeleteBuffers(mesh.levels[m].n_vbos, mesh.levels[m].vbos);
+        free(mesh.levels[m].vbos);
+    }
+}
+
+static void mesh_draw(struct window *window) {
+    const struct level *l = &mesh.levels[mesh_depth(window)];
+    int i;
+
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glUniform4fv(color_l, 1, color);
+    glUniformMatrix3fv(decode_l, 1, GL_FALSE, l->decode);
+
+    glEnableVertexAttribArray(position_l);
+    for (i = 0; i < l->n_vbos; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, l->vbos[i]);
+        glVertexAttribPointer(position_l, 2, mesh.type, GL_FALSE, 0, 0);
+        glDrawArrays(GL_LINES, 0, mesh_chunk_count(l, i));
+        draw_calls++;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Tile mode: depths whose geometry does not fit in memory.  The depth
+ * is the deepest at which leaf triangles are still TILE_LEAF_PIXELS
+ * across, up to -d, and its lattice is split into tiles of 2^TILE_SHIFT
+ * cells square (see geometry.h).  Only tiles overlapping the view are
+ * drawn, generated on first use into a fixed number of vertex buffers
+ * from which the least recently drawn tile is evicted, so memory is set
+ * by the cache budget and the view is only ever a few tiles across
+ * whatever the depth.
+ *
+ * Tile vertices are relative to the tile's corner and the decode matrix
+ * adds the corner's offset from the view centre, worked out in double,
+ * so zooming in does not run out of float precision. */
+#define TILE_SHIFT 6
+#define TILE_LEAF_PIXELS 2.0
+#define TILE_MAX_DEPTH 44
+
+struct tile {
+    uint64_t ta, tb;
+    int depth;
+    GLuint vbo;
+    GLsizei count;
+    uint64_t used;      /* frame last drawn in, 0 for a free slot */
+};
+
+static struct {
+    struct tile *cache;
+    int size, cached, depth;
+    GLushort *scratch;
+    uint64_t frame;
+    uint64_t drawn, hits, misses, evictions, gen_ns;
+} tiles;
+
+static size_t tile_max_bytes(void) {
+    return sierpinski2_leaf_count(TILE_SHIFT) * 12 * sizeof(GLushort);
+}
+
+static void tiles_init(struct window *window) {
+    tiles.size = (uint64_t) window->tile_budget * 1000000 / tile_max_bytes();
+    if (tiles.size < 1)
+        tiles.size = 1;
+
+    tiles.cache = calloc(tiles.size, sizeof *tiles.cache);
+    tiles.scratch = malloc(tile_max_bytes());
+    assert(tiles.cache && tiles.scratch);
+
+    printf("tiles: %d cells square, cache of %d tiles (%.1f MB)\n",
+           1 << TILE_SHIFT, tiles.size, tiles.size * tile_max_bytes() / 1e6);
+}
+
+static void tiles_fini(void) {
+    int i;
+
+    for (i = 0; i < tiles.size; i++) {
+        if (tiles.cache[i].used)
+            glDeleteBuffers(1, &tiles.cache[i].vbo);
+    }
+
+    free(tiles.cache);
+    free(tiles.scratch);
+}
+
+static struct tile *tile_get(int depth, uint64_t ta, uint64_t tb) {
+    struct tile *t, *victim = &tiles.cache[0];
+    int i, k = depth < TILE_SHIFT ? depth : TILE_SHIFT;
+    uint64_t start;
+    size_t size;
+
+    /* a linear scan costs nothing next to generating a tile */
+    for (i = 0; i < tiles.size; i++) {
+        t = &tiles.cache[i];
+        if (t->used && t->depth == depth && t->ta == ta && t->tb == tb) {
+            t->used = tiles.frame;
+            tiles.hits++;
+            return t;
+        }
+        if (t->used < victim->used)
+            victim = t;
+    }
+
+    t = victim;
+    if (t->used) {
+        vertex_bytes.resident -= t->count * 2 * sizeof(GLushort);
+        tiles.evictions++;
+    } else {
+        glGenBuffers(1, &t->vbo);
+        tiles.cached++;
+    }
+
+    start = trace_now();
+    t->count = sierpinski2_tile_lines_packed(depth, k, ta, tb, tiles.scratch);
+    tiles.gen_ns += trace_now() - start;
+    tiles.misses++;
+
+    t->ta = ta;
+    t->tb = tb;
+    t->depth = depth;
+    t->used = tiles.frame;
+
+    /* an evicted tile may have been drawn earlier in this frame, which
+     * glBufferData orphans rather than waits for */
+    size = t->count * 2 * sizeof(GLushort);
+    glBindBuffer(GL_ARRAY_BUFFER, t->vbo);
+    glBufferData(GL_ARRAY_BUFFER, size, tiles.scratch, GL_STATIC_DRAW);
+    vertex_bytes.uploaded += size;
+    vertex_bytes.resident += size;
+
+    return t;
+}
+
+/* tiles t0 to t1 of 0 to n - 1 overlapping [lo, hi], in tile units */
+static int tile_range(double lo,
+                      double hi,
+                      uint64_t n,
+                      uint64_t *t0,
+                      uint64_t *t1) {
+    if (hi < 0 || lo >= n)
+        return 0;
+
+    *t0 = lo < 0 ? 0 : (uint64_t) lo;
+    *t1 = hi >= n ? n - 1 : (uint64_t) hi;
+
+    return 1;
+}
+
+static void tiles_draw(struct window *window) {
+    int width = window->allocated.width, height = window->allocated.height;
+    double h = sqrt(3) / 2, cx = window->view.x, cy = window->view.y;
+    double ppu, s, size, x0, x1, y0, y1;
+    uint64_t n, ta, tb, ta0, ta1, tb0, tb1;
+    GLfloat centred[16], decode[9];
+    struct tile *t;
+    int depth, k;
+
+    tiles.frame++;
+
+    ppu = window->view.zoom * (width < height ? width : height);
+    depth = floor(log2(ppu / TILE_LEAF_PIXELS));
+    if (depth > window->depth)
+        depth = window->depth;
+    if (depth < 0)
+        depth = 0;
+    tiles.depth = depth;
+
+    k = depth < TILE_SHIFT ? depth : TILE_SHIFT;
+    n = (uint64_t) 1 << (depth - k);
+    s = ldexp(1, -depth);
+    size = ldexp(1, k - depth);
+
+    /* the visible part of the scene, from update_projection(), in tile
+     * units of the lattice: b = y / (h * size), a = x / size - b / 2 */
+    x0 = (cx - 1 / projection[0]) / size;
+    x1 = (cx + 1 / projection[0]) / size;
+    y0 = (cy - 1 / projection[5]) / (h * size);
+    y1 = (cy + 1 / projection[5]) / (h * size);
+    if (!tile_range(y0, y1, n, &tb0, &tb1) ||
+        !tile_range(x0 - y1 / 2, x1 - y0 / 2, n, &ta0, &ta1))
+        return;
+
+    /* the view centre is the origin, the decode matrix does the rest */
+    memcpy(centred, projection, sizeof centred);
+    centred[3] = 0;
+    centred[7] = 0;
+
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, centred);
+    glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
+    glUniform4fv(color_l, 1, color);
+    glEnableVertexAttribArray(position_l);
+
+    decode[0] = s;      decode[1] = 0;      decode[2] = 0;
+    decode[3] = s / 2;  decode[4] = s * h;  decode[5] = 0;
+    decode[8] = 1;
+
+    for (tb = tb0; tb <= tb1; tb++) {
+        for (ta = ta0; ta <= ta1; ta++) {
+            /* empty, see geometry.c */
+            if (ta & tb)
+                continue;
+
+            t = tile_get(depth, ta, tb);
+            if (!t->count)
+                continue;
+
+            decode[6] = (ta + tb / 2.0) * size - cx;
+            decode[7] = tb * h * size - cy;
+            glUniformMatrix3fv(decode_l, 1, GL_FALSE, decode);
+
+            glBindBuffer(GL_ARRAY_BUFFER, t->vbo);
+            glVertexAttribPointer(position_l, 2, GL_UNSIGNED_SHORT, GL_FALSE,
+                                  0, 0);
+            glDrawArrays(GL_LINES, 0, t->count);
+            draw_calls++;
+            tiles.drawn++;
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/* Software mode: the levels of mesh mode, always as floats, drawn by the
+ * CPU (swraster.c) into wl_shm buffers with no EGL at all.  Every band of
+ * the frame is cleared and drawn on its own thread.  A deeper level is
+ * generated right away when the depth asks for it, which takes less time
+ * than drawing it. */
+static struct {
+    struct level levels[LEVEL_MAX_DEPTH + 1];
+    int built;
+    /* the level drawn this frame */
+    const struct level *level;
+    struct sw_surface target;
+    double m[6];
+    uint32_t color;
+    uint64_t render_ns;
+} sw;
+
+/* generate the levels down to the depth that aren't there yet */
+static void sw_update(struct window *window) {
+    const struct level *l;
+
+    for (; sw.built <= window->depth; sw.built++) {
+        if (level_generate(window, 0, sw.levels, sw.built) < 0) {
+            fprintf(stderr, "software: out of memory at depth %d\n",
+                    sw.built);
+            if (!sw.built)
+                exit(EXIT_FAILURE);
+            window->depth = sw.built - 1;
+            break;
+        }
+
+        l = &sw.levels[sw.built];
+        vertex_bytes.resident += l->count * level_vertex_size(0);
+        printf("software: depth %d, %llu %s, %.1f MB\n", sw.built,
+               (unsigned long long) level_shapes(window, l),
+               window->ifs ? "shapes" : "triangles",
+               l->count * level_vertex_size(0) / 1e6);
+    }
+
+    sw.level = &sw.levels[window->depth];
+}
+
+static void sw_init(struct window *window) {
+    sw_update(window);
+
+    sw.color = 0xff000000 |
+               (uint32_t) (color[0] * 255) << 16 |
+               (uint32_t) (color[1] * 255) << 8 |
+               (uint32_t) (color[2] * 255);
+
+    sw_pool_init(&window->sw_pool, window->sw_threads);
+}
+
+static void sw_fini(struct window *window) {
+    int m;
+
+    sw_pool_fini(&window->sw_pool);
+    for (m = 0; m < sw.built; m++)
+        free(sw.levels[m].data);
+}
+
+static void sw_band(void *data, int y0, int y1) {
+    sw_clear(&sw.target, y0, y1, 0xff000000);
+    sw_lines(&sw.target, y0, y1, sw.level->data, sw.level->count, sw.m,
+             sw.color);
+}
+
+static void benchmark(struct window *window) {
+    uint32_t time = trace_now() / 1000000;
+    uint64_t cpu_ns;
+    double peak_mb;
+    float seconds;
+
+    if (window->frames == 0) {
+        window->benchmark_time = time;
+        window->benchmark_cpu_ns = process_cpu_ns(NULL);
+    }
+
+    window->frames++;
+    wlprof_frame();
+    if (time - window->benchmark_time < benchmark_interval * 1000)
+        return;
+
+    seconds = (time - window->benchmark_time) / 1000.0f;
+    printf("%d frames in %.1f seconds: %f fps\n",
+           window->frames, seconds, window->frames / seconds);
+
+    cpu_ns = process_cpu_ns(&peak_mb);
+    printf("process: %.2f ms CPU/frame over all threads, %.1f MB peak "
+           "resident\n",
+           (cpu_ns - window->benchmark_cpu_ns) / 1e6 / window->frames,
+           peak_mb);
+
+    if (window->mode == MODE_CHAOS && chaos.points) {
+        /* a coarse clock can make every upload take 0 ns */
+        printf("chaos: %.2f Mpoints/s, generate %.2f ns/point, "
+               "upload %.1f MB/s, %zu points resident\n",
+               chaos.points / seconds / 1e6,
+               (double) chaos.gen_ns / chaos.points,
+               chaos.upload_ns ? chaos.points * chaos.point_size /
+                                 (chaos.upload_ns / 1e9) / 1e6 : 0.0,
+               (size_t) CHAOS_RING * window->chaos_batch);
+        chaos.points = 0;
+        chaos.gen_ns = 0;
+        chaos.upload_ns = 0;
+    }
+
+    if (window->mode == MODE_TILES) {
+        uint64_t lookups = tiles.hits + tiles.misses;
+
+        printf("tiles: depth %d, %.1f drawn/frame, %.1f%% hits, "
+               "%llu generated at %.1f us, %llu evicted, %d of %d cached\n",
+               tiles.depth, (double) tiles.drawn / window->frames,
+               lookups ? 100.0 * tiles.hits / lookups : 100.0,
+               (unsigned long long) tiles.misses,
+               tiles.misses ? tiles.gen_ns / 1e3 / tiles.misses : 0.0,
+               (unsigned long long) tiles.evictions,
+               tiles.cached, tiles.size);
+        tiles.drawn = 0;
+        tiles.hits = 0;
+        tiles.misses = 0;
+        tiles.evictions = 0;
+        tiles.gen_ns = 0;
+    }
+
+    printf("vertex data (%s): %.1f KB/frame uploaded, %.1f KB resident\n",
+           window->packed ? "packed" : "float",
+           vertex_bytes.uploaded / 1e3 / window->frames,
+           vertex_bytes.resident / 1e3);
+    vertex_bytes.uploaded = 0;
+
+    if (!window->software) {
+        int bytes = window->buffer_size == 16 ? 2 : 4;
+        double mb = (double) window->allocated.width *
+                    window->allocated.height * bytes / 1e6;
+
+        printf("framebuffer: %d bit%s, %.2f MB/frame (%.0f MB/s), "
+               "swap %.2f ms/frame\n", window->buffer_size,
+               window->dither ? " dithered" : "", mb,
+               mb * window->frames / seconds,
+               window->swap_ns / 1e6 / window->frames);
+        window->swap_ns = 0;
+    }
+
+    if (window->dynres.enabled)
+        printf("dynres: scale %.2f (%dx%d), frame %.2f ms, target %.2f ms\n",
+               window->dynres.scale,
+               window->dynres.scaled_width, window->dynres.scaled_height,
+               window->dynres.frame_ms, window->dynres.target_ms);
+
+    if (window->software) {
+        printf("software: drawn in %.2f ms/frame by %d threads\n",
+               sw.render_ns / 1e6 / window->frames,
+               window->sw_pool.n_threads);
+        shm_buffers_report(&window->shm);
+        sw.render_ns = 0;
+    }
+
+    raster_cache_report(&window->raster);
+    gpu_timer_report(&window->gpu_timer);
+    overdraw_report(&window->overdraw);
+    frame_export_report(&window->export);
+    wlprof_report();
+    event_loop_report(&window->display->loop, window->frames);
+
+    window->benchmark_time = time;
+    window->frames = 0;
+}
+
+/* Shader mode: no geometry at all.  One quad covers the viewport and the
+ * fragment shader decides per pixel whether it lies in the fractal, so
+ * the cost scales with the number of pixels and the CPU does nothing but
+ * issue a single draw.
+ *
+ * The fragment is mapped onto lattice coordinates (u, v) in which
+ * triangle_up is the right triangle u >= 0, v >= 0, u + v <= 1.  Each
+ * iteration doubles the coordinates and folds the point back into
+ * whichever corner sub-triangle it landed in; if it is in none of them it
+ * sits in the removed middle triangle and is discarded.  GLSL ES 1.00 has
+ * no integer bit operations, so this is the fold form of the Pascal's
+ * triangle mod 2 test (u_i & v_i) == 0. */
+#define SHADER_MAX_DEPTH 24
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+static GLuint shader_program,
+              shader_position_l,
+              shader_projection_l,
+              shader_color_l,
+              shader_depth_l;
+
+static const GLfloat fullscreen_quad[] = {
+    -1.0f, -1.0f,
+     1.0f, -1.0f,
+     1.0f,  1.0f,
+    -1.0f,  1.0f
+};
+
+static void shader_draw(struct window *window) {
+    glUniformMatrix4fv(shader_projection_l, 1, GL_FALSE, projection);
+    glUniform1i(shader_depth_l, window->depth);
+    vertex_bytes.uploaded += sizeof fullscreen_quad;
+    glVertexAttribPointer(shader_position_l, 2, GL_FLOAT, GL_FALSE, 0,
+                          fullscreen_quad);
+    glEnableVertexAttribArray(shader_position_l);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    draw_calls++;
+}
+
+static void scene_draw(struct window *window) {
+    switch (window->mode) {
+    case MODE_CHAOS:
+        chaos_draw(window);
+        break;
+    case MODE_SHADER: {
+        TRACE_SCOPE("shader_draw");
+        shader_draw(window);
+        break;
+    }
+    case MODE_MESH: {
+        TRACE_SCOPE("mesh_draw");
+        mesh_draw(window);
+        break;
+    }
+    case MODE_TILES: {
+        TRACE_SCOPE("tiles_draw");
+        tiles_draw(window);
+        break;
+    }
+    default: {
+        /* geometry generation and GL submission are interleaved in the
+         * recursion */
+        TRACE_SCOPE("sierpinski2");
+        glUniformMatrix3fv(decode_l, 1, GL_FALSE, decode_identity);
+        sierpinski2(window->depth, emit_triangle, NULL);
+        break;
+    }
+    }
+}
+
+/* Raster cache callback: point the view at the tile and draw the scene
+ * as for a square window of the tile's size. */
+static void raster_render(void *data, double x, double y, double size) {
+    TRACE_SCOPE("raster_render");
+    struct window *window = data;
+    struct geometry geometry = window->geometry;
+    struct geometry allocated = window->allocated;
+    struct view view = window->view;
+
+    window->geometry.width = window->geometry.height = RASTER_TILE_SIZE;
+    window->allocated = window->geometry;
+    window->view.x = x + size / 2;
+    window->view.y = y + size / 2;
+    window->view.zoom = 1 / size;
+    update_projection(window);
+
+    scene_draw(window);
+
+    window->geometry = geometry;
+    window->allocated = allocated;
+    window->view = view;
+    update_projection(window);
+}
+
+/* -E: read the finished frame back straight into a slot of the export
+ * ring.  GLES2 has no pixel buffer objects, so the readback waits for
+ * the GPU; with no consumer connected nothing is read at all. */
+static void frame_export(struct window *window) {
+    TRACE_SCOPE("frame_export");
+    uint64_t start;
+    void *pixels;
+
+    pixels = frame_export_begin(&window->export);
+    if (!pixels)
+        return;
+
+    start = trace_now();
+    glReadPixels(0, 0, window->export.width, window->export.height,
+                 GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    window->export.readback_ns += trace_now() - start;
+
+    frame_export_end(&window->export, window->display->input.frame_ns);
+}
+
+static void frame_done(void *data,
+                       struct wl_callback *callback,
+                       uint32_t time) {
+    struct window *window = data;
+
+    wl_callback_destroy(callback);
+    window->callback = NULL;
+
+    if (!startup_done) {
+        startup_mark("first frame shown");
+        startup_done = 1;
+    }
+}
+
+static const struct wl_callback_listener frame_listener = {
+    frame_done
+};
+
+/* The deepest level of mesh and software modes may take this much
+ * vertex data; every level above it is kept too, which adds up to half
+ * as much again (less for an IFS of more maps). */
+#define LEVEL_BUDGET_BYTES ((size_t) 512 << 20)
+
+/* Recursive mode makes a draw call per triangle of every level, every
+ * frame. */
+#define RECURSIVE_MAX_TRIANGLES 100000
+
+/* the deepest level whose vertices fit the budget */
+static int level_depth_limit(const struct window *window, int packed) {
+    const struct ifs *ifs = window->ifs;
+    size_t vertices = ifs ? ifs->n_vertices : 6;
+    size_t maps = ifs ? ifs->n_maps : 3;
+    int m = 0, max;
+
+    if (packed)
+        max = SIERPINSKI_PACKED_MAX_DEPTH;
+    else
+        max = ifs ? LEVEL_MAX_DEPTH : SIERPINSKI_FLOAT_MAX_DEPTH;
+
+    while (m < max &&
+           vertices * maps * level_vertex_size(packed) <= LEVEL_BUDGET_BYTES) {
+        vertices *= maps;
+        m++;
+    }
+
+    return m;
+}
+
+/* the deepest depth a mode can draw */
+static int depth_limit(const struct window *window) {
+    int m;
+
+    if (window->software)
+        return level_depth_limit(window, 0);
+
+    switch (window->mode) {
+    case MODE_SHADER:
+        return SHADER_MAX_DEPTH;
+    case MODE_MESH:
+        return level_depth_limit(window, window->packed && !window->ifs);
+    case MODE_TILES:
+        return TILE_MAX_DEPTH;
+    default:
+        for (m = 0; sierpinski2_count(m + 1) <= RECURSIVE_MAX_TRIANGLES; m++)
+            ;
+        return m;
+    }
+}
+
+/* the depth keys are only counted by the listener and applied here, at
+ * the start of the next frame; chaos mode has no depth */
+static void window_apply_depth(struct window *window) {
+    int depth = window->depth + window->depth_pending;
+
+    window->depth_pending = 0;
+    if (depth < 0)
+        depth = 0;
+    if (depth > depth_limit(window))
+        depth = depth_limit(window);
+    if (depth == window->depth || window->mode == MODE_CHAOS)
+        return;
+
+    window->depth = depth;
+    printf("depth %d\n", depth);
 }
 
 void triangles(struct window *window) {
+    TRACE_SCOPE("frame");
     EGLint buffer_age = 0;
+    uint64_t start;
+    int depth;
+
+    start = trace_now();
+    draw_calls = 0;
+
+    window_apply_resize(window);
+    window_apply_depth(window);
+    if (window->mode == MODE_MESH)
+        mesh_update(window);
+
+    /* the tiles cached so far show the old depth */
+    depth = window->mode == MODE_MESH ? mesh_depth(window) : window->depth;
+    if (window->raster.enabled && depth != window->raster_depth) {
+        raster_cache_invalidate(&window->raster);
+        window->raster_depth = depth;
+    }
+    if (window->fly)
+        view_fly(window);
+    gpu_timer_frame(&window->gpu_timer);
+
+    if (window->raster.enabled) {
+        TRACE_SCOPE("raster_cache_update");
+        gpu_timer_begin(&window->gpu_timer, PASS_RASTER);
+        raster_cache_update(&window->raster,
+                            window->view.x, window->view.y,
+                            window->view.zoom,
+                            window->allocated.width,
+                            window->allocated.height,
+                            window->display->input.frame_ns);
+        gpu_timer_end(&window->gpu_timer, PASS_RASTER);
+    }
+
+    if (window->dynres.enabled)
+        dynres_begin(&window->dynres);
+
+    gpu_timer_begin(&window->gpu_timer, PASS_SCENE);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    overdraw_begin(&window->overdraw);
 
-    sierpinski2(6);
+    if (window->raster.enabled) {
+        TRACE_SCOPE("raster_cache_draw");
+        uint64_t quads = window->raster.quads;
+
+        raster_cache_draw(&window->raster);
+        draw_calls += window->raster.quads - quads;
+    } else {
+        scene_draw(window);
+    }
 
     //draw_triangle(0, 0, 1, (GLfloat[]){1.0f, 0.0f, 1.0f, 1.0f}, 1);
     //sierpinski(0, 0, 0, 5);
 
+    gpu_timer_end(&window->gpu_timer, PASS_SCENE);
+
+    if (window->overdraw.enabled) {
+        TRACE_SCOPE("overdraw_end");
+        overdraw_end(&window->overdraw,
+                     window->allocated.width, window->allocated.height);
+    }
+
+    if (window->dynres.enabled) {
+        {
+            TRACE_SCOPE("dynres_end");
+            gpu_timer_begin(&window->gpu_timer, PASS_DYNRES);
+            dynres_end(&window->dynres);
+            gpu_timer_end(&window->gpu_timer, PASS_DYNRES);
+        }
+        /* wait for the rendering itself, but not for vblank in
+         * eglSwapBuffers(), or the controller would only ever see the
+         * refresh interval */
+        {
+            TRACE_SCOPE("glFinish");
+            glFinish();
+        }
+        dynres_update(&window->dynres, (trace_now() - start) / 1e6);
+    }
+
+    frame_export(window);
+
     eglQuerySurface(window->display->egl.dpy,
                     window->egl_surface,
                     EGL_BUFFER_AGE_EXT,
                     &buffer_age);
-    wl_surface_set_opaque_region(window->surface, NULL);
-    eglSwapBuffers(window->display->egl.dpy, window->egl_surface);
+    gpu_timer_cpu(&window->gpu_timer, (trace_now() - start) / 1e6);
+    if (window->frame_sync) {
+        window->callback = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->callback, &frame_listener, window);
+    }
+    {
+        TRACE_SCOPE("eglSwapBuffers");
+        uint64_t swap_start = trace_now();
+
+        eglSwapBuffers(window->display->egl.dpy, window->egl_surface);
+        window->swap_ns += trace_now() - swap_start;
+    }
+
+    metrics_frame(&window->metrics, start, trace_now(),
+                  window_refresh_ns(window), draw_calls,
+                  vertex_bytes.resident,
+                  window->display->loop.wakeups_total);
+    benchmark(window);
 }
 
-void init_gl() {
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
+void triangles_software(struct window *window) {
+    TRACE_SCOPE("frame");
+    struct wl_display *display = window->display->display;
+    const GLfloat *d;
+    struct shm_buffer *buffer;
+    double hw, hh;
+    uint64_t start;
+
+    start = trace_now();
+
+    window_apply_resize(window);
+    window_apply_depth(window);
+    sw_update(window);
+    d = sw.level->decode;
+    if (window->fly)
+        view_fly(window);
+
+    {
+        TRACE_SCOPE("shm_buffers_next");
+        buffer = shm_buffers_next(&window->shm, display);
+    }
+    if (!buffer) {
+        running = 0;
+        return;
+    }
+
+    sw.target.pixels = buffer->pixels;
+    sw.target.width = window->shm.width;
+    sw.target.height = window->shm.height;
+    sw.target.stride = window->shm.stride;
+
+    /* decode, projection and viewport in one, with y pointing down */
+    hw = sw.target.width / 2.0;
+    hh = sw.target.height / 2.0;
+    sw.m[0] = hw * projection[0] * d[0];
+    sw.m[1] = hw * projection[0] * d[3];
+    sw.m[2] = hw * (projection[0] * d[6] + projection[3] + 1);
+    sw.m[3] = -hh * projection[5] * d[1];
+    sw.m[4] = -hh * projection[5] * d[4];
+    sw.m[5] = hh * (1 - projection[5] * d[7] - projection[7]);
+
+    /* only the drawing, to compare with the GPU; the wait for a buffer is
+     * in the shm report */
+    {
+        TRACE_SCOPE("sw_draw");
+        uint64_t draw_start = trace_now();
+
+        sw_pool_run(&window->sw_pool, sw_band, NULL, sw.target.height);
+        sw.render_ns += trace_now() - draw_start;
+    }
 
+    if (window->frame_sync) {
+        window->callback = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->callback, &frame_listener, window);
+    }
+
+    shm_buffers_commit(&window->shm, buffer, window->surface);
+    wl_display_flush(display);
+
+    metrics_frame(&window->metrics, start, trace_now(),
+                  window_refresh_ns(window), 0, 0,
+                  window->display->loop.wakeups_total);
+    benchmark(window);
+}
+
+static GLuint create_program(const char *src_v, const char *src_f) {
     GLuint s_v, s_f, p;
     char msg[512];
 
+    s_v = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(s_v, 1, &src_v, NULL);
+    glCompileShader(s_v);
+    glGetShaderInfoLog(s_v, sizeof msg, NULL, msg);
+    printf("vertex shader info: %s\n", msg);
+
+    s_f = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(s_f, 1, &src_f, NULL);
+    glCompileShader(s_f);
+    glGetShaderInfoLog(s_f, sizeof msg, NULL, msg);
+    printf("fragment shader info: %s\n", msg);
+
+    p = glCreateProgram();
+    glAttachShader(p, s_v);
+    glAttachShader(p, s_f);
+    glLinkProgram(p);
+
+    return p;
+}
+
+static void init_shader_mode(struct window *window) {
+    static const char *src_v = "uniform mat4 projection;\n"
+
+                               "attribute vec2 position;\n"
+
+                               "varying vec2 lattice;\n"
+
+                               "void main() {"
+                                   /* clip space back to the scene space
+                                    * of projection[], then to lattice
+                                    * coordinates */
+                                   "vec2 p = (position - vec2(projection[0][3], projection[1][3])) /"
+                                            "vec2(projection[0][0], projection[1][1]);\n"
+                                   "lattice = vec2(p.x - p.y / sqrt(3.0),"
+                                                  "2.0 * p.y / sqrt(3.0));\n"
+                                   "gl_Position = vec4(position, 0, 1);"
+                               "}";
+    static const char *src_f = "#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+                               "precision highp float;\n"
+                               "#else\n"
+                               "precision mediump float;\n"
+                               "#endif\n"
+                               "uniform vec4 color_u;\n"
+                               "uniform int depth;\n"
+
+                               "varying vec2 lattice;\n"
+
+                               "void main() {"
+                                   "vec2 l = lattice;\n"
+                                   "if (l.x < 0.0 || l.y < 0.0 || l.x + l.y > 1.0)"
+                                       "discard;\n"
+                                   "for (int i = 0; i < " XSTR(SHADER_MAX_DEPTH) "; i++) {"
+                                       "if (i >= depth) break;\n"
+                                       "l *= 2.0;\n"
+                                       "if (l.x >= 1.0) l.x -= 1.0;\n"
+                                       "else if (l.y >= 1.0) l.y -= 1.0;\n"
+                                       "else if (l.x + l.y > 1.0) discard;\n"
+                                   "}\n"
+                                   "gl_FragColor = color_u;"
+                               "}";
+
+    shader_program = create_program(src_v, src_f);
+    glUseProgram(shader_program);
+
+    shader_position_l = glGetAttribLocation(shader_program, "position");
+    shader_projection_l = glGetUniformLocation(shader_program, "projection");
+    shader_color_l = glGetUniformLocation(shader_program, "color_u");
+    shader_depth_l = glGetUniformLocation(shader_program, "depth");
+
+    /* nothing changes between frames, so set it once */
+    glUniform4fv(shader_color_l, 1, color);
+}
+
+/* the program of every mode but the shader one */
+static GLuint create_main_program(void) {
     static const char *src_v = "uniform mat4 projection;\n"
                                "uniform mat4 model;\n"
                                "uniform vec4 color_u;\n"
                                "uniform int identifier_u;\n"
+                               "uniform float point_size;\n"
+                               "uniform mat3 decode;\n"
 
                                "attribute vec2 position;\n"
 
@@ -555,8 +2394,8 @@ void init_gl() {
 
                                "void main() {"
                                    "color = color_u;\n"
-
-                                   "gl_Position = vec4(position, 0, 1) * model * projection;"
+                                   "gl_PointSize = point_size;\n"
+                                   "gl_Position = vec4((decode * vec3(position, 1)).xy, 0, 1) * model * projection;"
                                "}";
     static const char *src_f = "precision mediump float;\n"
                                "varying vec4 color;\n"
@@ -565,41 +2404,113 @@ void init_gl() {
                                    "gl_FragColor = color;"
                                "}";
 
-    s_v = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(s_v, 1, &src_v, NULL);
-    glCompileShader(s_v);
-    glGetShaderInfoLog(s_v, sizeof msg, NULL, msg);
-    printf("vertex shader info: %s\n", msg);
+    return create_program(src_v, src_f);
+}
 
-    s_f = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(s_f, 1, &src_f, NULL);
-    glCompileShader(s_f);
-    glGetShaderInfoLog(s_f, sizeof msg, NULL, msg);
-    printf("fragment shader info: %s\n", msg);
+void init_gl(struct window *window) {
+    GLuint p;
 
-    p = glCreateProgram();
-    glAttachShader(p, s_v);
-    glAttachShader(p, s_f);
-    glLinkProgram(p);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    /* GL starts out dithering; only -D keeps it, so the cost of a 16 bit
+     * framebuffer can be measured with and without */
+    if (window->dither)
+        glEnable(GL_DITHER);
+    else
+        glDisable(GL_DITHER);
+
+    p = create_main_program();
+    startup_mark("program compiled");
     glUseProgram(p);
 
     projection_l = glGetUniformLocation(p, "projection");
     model_l = glGetUniformLocation(p, "model");
     color_l = glGetUniformLocation(p, "color_u");
+    point_size_l = glGetUniformLocation(p, "point_size");
+    decode_l = glGetUniformLocation(p, "decode");
     position_l = glGetAttribLocation(p, "position");
 
+    glUniform1f(point_size_l, 1.0f);
+    glUniformMatrix3fv(decode_l, 1, GL_FALSE, decode_identity);
+
+    if (window->dynres.target_ms > 0)
+        dynres_init(&window->dynres, window->dynres.target_ms);
+    if (window->gpu_timer.enabled)
+        gpu_timer_init(&window->gpu_timer, pass_names, 3);
+    if (window->overdraw.enabled)
+        overdraw_init(&window->overdraw);
+
+    if (window->mode == MODE_CHAOS)
+        chaos_init(window);
+    else if (window->mode == MODE_SHADER)
+        init_shader_mode(window);
+    else if (window->mode == MODE_MESH)
+        mesh_init(window);
+    else if (window->mode == MODE_TILES)
+        tiles_init(window);
+
+    if (window->raster.budget_mb > 0)
+        raster_cache_init(&window->raster, window->raster.budget_mb,
+                          raster_render, window);
+
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 }
 
 static void usage(int error_code) {
-    fprintf(stderr, "Usage: squares-wayland\n\n");
+    fprintf(stderr, "Usage: sierpinski [OPTIONS]\n\n"
+            "  -c\tChaos game point cloud instead of recursive triangles\n"
+            "  -n N\tPoints generated per frame in chaos mode, up to 2^24\n"
+            "    \t(default 65536)\n"
+            "  -a\tEvaluate the fractal per pixel in the fragment shader\n"
+            "  -m\tDraw the leaf triangles from one static vertex buffer\n"
+            "  -i IFS\tDraw another fractal in mesh mode: sierpinski, carpet,\n"
+            "    \tkoch, fern or a file of \"map a b c d e f\" and\n"
+            "    \t\"line x0 y0 x1 y1\" lines\n"
+            "  -l\tGenerate the visible tiles of the leaf triangles on demand,\n"
+            "    \tas deep as the zoom needs\n"
+            "  -C MB\tTile cache budget (default 16)\n"
+            "  -p\tPacked 16 bit vertex data for mesh and chaos modes\n"
+            "  -d N\tRecursion depth for recursive, mesh and shader modes,\n"
+            "    \tthe limit in tile mode (default 6); Up and Down, or +\n"
+            "    \tand -, change it while running\n"
+            "  -z\tZoom in continuously; scroll to zoom and drag to pan\n"
+            "  -R MB\tDraw from a cache of pre-rendered texture tiles of MB\n"
+            "    \t(not in chaos mode)\n"
+            "  -r FILE\tRecord input to FILE\n"
+            "  -P FILE\tReplay input recorded in FILE, then exit\n"
+            "  -f\tReplay as fast as possible instead of at recorded speed\n"
+            "  -t MS\tScale the render resolution to hold a frame time of MS\n"
+            "  -T FILE\tWrite a Chrome trace-event JSON timeline to FILE\n"
+            "  -g\tMeasure GPU time per render pass\n"
+            "  -O\tShow how many fragments each pixel gets as a heatmap and\n"
+            "    \tcount them (not with -t)\n"
+            "  -S\tDraw on the CPU into wl_shm buffers, without EGL\n"
+            "    \t(recursive and mesh modes only)\n"
+            "  -j N\tThreads drawing with -S (default one per CPU)\n"
+            "  -b\tDon't sync to compositor redraw\n"
+            "  -B BITS\tFramebuffer of 16 (RGB565), 24 (XRGB8888) or 32\n"
+            "    \t(ARGB8888, default) bits per pixel; -g times the fill\n"
+            "  -D\tDither when drawing into fewer bits than the colours have\n"
+            "  -W\tCount Wayland requests and events per frame by message\n"
+            "  -M SOCKET\tServe live metrics in the Prometheus text format\n"
+            "    \ton the Unix socket SOCKET\n"
+            "  -E SOCKET\tExport frames to a consumer connecting to the\n"
+            "    \tUnix socket SOCKET, such as frame-consumer (not with -S)\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
 }
 
 int main(int argc, char **argv) {
-    struct sigaction sigint;
+    static struct ifs ifs;
     struct display display = { 0 };
     struct window  window  = { 0 };
-    int i, ret = 0;
+    const char *trace_path = NULL, *record_path = NULL, *replay_path = NULL;
+    const char *export_path = NULL, *metrics_path = NULL;
+    int i, ret = 0, realtime = 1, profile_wayland = 0;
+    long chaos_batch = 1 << 16;
+
+    startup_ns = trace_now();
 
     window.display = &display;
     display.window = &window;
@@ -608,9 +2519,140 @@ int main(int argc, char **argv) {
     window.window_size = window.geometry;
     window.buffer_size = 32;
     window.frame_sync = 1;
+    window.scale = 1;
+    window.resize_pending = 1;
+    window.mode = MODE_RECURSIVE;
+    window.depth = 6;
+    window.tile_budget = 16;
+    window.view.x = 0.5;
+    window.view.y = 0.5;
+    window.view.zoom = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-c", argv[i]) == 0)
+            window.mode = MODE_CHAOS;
+        else if (strcmp("-n", argv[i]) == 0 && i + 1 < argc)
+            chaos_batch = strtol(argv[++i], NULL, 10);
+        else if (strcmp("-a", argv[i]) == 0)
+            window.mode = MODE_SHADER;
+        else if (strcmp("-m", argv[i]) == 0)
+            window.mode = MODE_MESH;
+        else if (strcmp("-i", argv[i]) == 0 && i + 1 < argc) {
+            if (ifs_find(&ifs, argv[++i]) < 0)
+                exit(EXIT_FAILURE);
+            window.ifs = &ifs;
+            window.mode = MODE_MESH;
+        }
+        else if (strcmp("-l", argv[i]) == 0)
+            window.mode = MODE_TILES;
+        else if (strcmp("-C", argv[i]) == 0 && i + 1 < argc)
+            window.tile_budget = atoi(argv[++i]);
+        else if (strcmp("-z", argv[i]) == 0)
+            window.fly = 1;
+        else if (strcmp("-R", argv[i]) == 0 && i + 1 < argc)
+            window.raster.budget_mb = atoi(argv[++i]);
+        else if (strcmp("-r", argv[i]) == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if (strcmp("-P", argv[i]) == 0 && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (strcmp("-f", argv[i]) == 0)
+            realtime = 0;
+        else if (strcmp("-p", argv[i]) == 0)
+            window.packed = 1;
+        else if (strcmp("-d", argv[i]) == 0 && i + 1 < argc)
+            window.depth = atoi(argv[++i]);
+        else if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+            window.dynres.target_ms = atof(argv[++i]);
+        else if (strcmp("-T", argv[i]) == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp("-g", argv[i]) == 0)
+            window.gpu_timer.enabled = 1;
+        else if (strcmp("-O", argv[i]) == 0)
+            window.overdraw.enabled = 1;
+        else if (strcmp("-M", argv[i]) == 0 && i + 1 < argc)
+            metrics_path = argv[++i];
+        else if (strcmp("-S", argv[i]) == 0)
+            window.software = 1;
+        else if (strcmp("-j", argv[i]) == 0 && i + 1 < argc)
+            window.sw_threads = atoi(argv[++i]);
+        else if (strcmp("-b", argv[i]) == 0)
+            window.frame_sync = 0;
+        else if (strcmp("-B", argv[i]) == 0 && i + 1 < argc)
+            window.buffer_size = atoi(argv[++i]);
+        else if (strcmp("-D", argv[i]) == 0)
+            window.dither = 1;
+        else if (strcmp("-W", argv[i]) == 0)
+            profile_wayland = 1;
+        else if (strcmp("-E", argv[i]) == 0 && i + 1 < argc)
+            export_path = argv[++i];
+        else if (strcmp("-h", argv[i]) == 0)
+            usage(EXIT_SUCCESS);
+        else
+            usage(EXIT_FAILURE);
+    }
 
-    display.display = wl_display_connect(NULL);
+    if (chaos_batch < 1 || chaos_batch > CHAOS_MAX_BATCH ||
+        window.depth < 0 || window.tile_budget < 0)
+        usage(EXIT_FAILURE);
+    window.chaos_batch = chaos_batch;
+    if (window.buffer_size != 16 && window.buffer_size != 24 &&
+        window.buffer_size != 32)
+        usage(EXIT_FAILURE);
+    /* chaos mode generates new points on every draw */
+    if (window.raster.budget_mb > 0 && window.mode == MODE_CHAOS)
+        usage(EXIT_FAILURE);
+    /* the software path only draws lines from memory, into ARGB8888 */
+    if (window.software &&
+        ((window.mode != MODE_RECURSIVE && window.mode != MODE_MESH) ||
+         window.raster.budget_mb > 0 || window.dynres.target_ms > 0 ||
+         window.gpu_timer.enabled || window.overdraw.enabled || export_path ||
+         window.buffer_size != 32 || window.dither))
+        usage(EXIT_FAILURE);
+    /* the offscreen target of dynres has no stencil buffer */
+    if (window.overdraw.enabled && window.dynres.target_ms > 0)
+        usage(EXIT_FAILURE);
+    if (window.depth > depth_limit(&window)) {
+        fprintf(stderr, "depth %d is too deep for this mode, using %d\n",
+                window.depth, depth_limit(&window));
+        window.depth = depth_limit(&window);
+    }
+    window.raster_depth = window.depth;
+
+    if (replay_path) {
+        if (input_log_replay(&display.input, replay_path, realtime) < 0)
+            exit(EXIT_FAILURE);
+    } else if (record_path) {
+        if (input_log_record(&display.input, record_path) < 0)
+            exit(EXIT_FAILURE);
+    } else {
+        input_log_live(&display.input);
+    }
+
+    /* before any thread starts */
+    if (event_loop_init(&display.loop) < 0)
+        exit(EXIT_FAILURE);
+
+    trace_init(trace_path);
+
+    if (metrics_path &&
+        metrics_init(&window.metrics, metrics_path, "sierpinski") < 0)
+        exit(EXIT_FAILURE);
+
+    if (profile_wayland) {
+        static const struct wl_interface *const protocols[] = {
+            &xdg_shell_interface,
+            NULL
+        };
+        int fd = wlprof_init(protocols);
+
+        if (fd < 0)
+            exit(EXIT_FAILURE);
+        display.display = wl_display_connect_to_fd(fd);
+    } else {
+        display.display = wl_display_connect(NULL);
+    }
     assert(display.display);
+    startup_mark("connected");
 
     display.registry = wl_display_get_registry(display.display);
     wl_registry_add_listener(display.registry,
@@ -618,32 +2660,82 @@ int main(int argc, char **argv) {
                              &display);
 
     wl_display_dispatch(display.display);
+    startup_mark("registry");
 
-    init_egl(&display, &window);
-    create_surface(&window);
-    init_gl(&window);
+    if (window.software) {
+        if (!display.shm) {
+            fprintf(stderr, "compositor has no wl_shm\n");
+            exit(EXIT_FAILURE);
+        }
+        create_surface(&window);
+        sw_init(&window);
+    } else {
+        init_egl(&display, &window);
+        startup_mark("EGL context created");
+        create_surface(&window);
+        startup_mark("surface created");
+        init_gl(&window);
+    }
+    startup_mark("initialised");
+
+    if (export_path && frame_export_init(&window.export, export_path) < 0)
+        exit(EXIT_FAILURE);
 
     display.cursor_surface =
         wl_compositor_create_surface(display.compositor);
 
-    sigint.sa_handler = signal_int;
-    sigemptyset(&sigint.sa_mask);
-    sigint.sa_flags = SA_RESETHAND;
-    sigaction(SIGINT, &sigint, NULL);
+    event_loop_add_display(&display.loop, display.display);
 
-    /* The mainloop here is a little subtle.  Redrawing will cause
-     * EGL to read events so we can just call
-     * wl_display_dispatch_pending() to handle any events that got
-     * queued up as a side effect. */
-    while (running) {
-        wl_display_dispatch_pending(display.display);
-        triangles(&window);
+    /* -z animates in fixed steps, which replays take from the log */
+    if (window.fly && display.input.mode != INPUT_REPLAY) {
+        event_loop_set_tick(&display.loop, 1000000000 / animation_hz);
+        display.input.clock_ns = &display.loop.time_ns;
     }
 
-    fprintf(stderr, "squares-wayland exiting\n");
+    /* Sleep until the last frame's callback, handling input as it comes
+     * in, then draw the next one.  Without frame sync (-b) there is no
+     * callback, and only what already arrived is handled between
+     * frames. */
+    while (running && !display.loop.quit) {
+        event_loop_wait(&display.loop, window.callback ? -1 : 0);
+        if (window.callback)
+            continue;
+        if (!input_log_frame(&display.input, input_dispatch, &display))
+            break;
+        if (window.software)
+            triangles_software(&window);
+        else
+            triangles(&window);
+        if (!startup_done) {
+            startup_mark("first frame drawn");
+            startup_done = !window.frame_sync;
+        }
+        trace_poll();
+    }
 
+    fprintf(stderr, "sierpinski exiting\n");
+
+    if (window.software)
+        sw_fini(&window);
+    else if (window.mode == MODE_CHAOS)
+        chaos_fini();
+    else if (window.mode == MODE_MESH)
+        mesh_fini();
+    else if (window.mode == MODE_TILES)
+        tiles_fini();
+
+    metrics_fini(&window.metrics);
+    trace_fini();
+    input_log_close(&display.input);
+    frame_export_fini(&window.export);
+
+    raster_cache_fini(&window.raster);
+    dynres_fini(&window.dynres);
+    gpu_timer_fini(&window.gpu_timer);
+    overdraw_fini(&window.overdraw);
     destroy_surface(&window);
-    fini_egl(&display);
+    if (!window.software)
+        fini_egl(&display);
 
     wl_surface_destroy(display.cursor_surface);
     if (display.cursor_theme)
@@ -655,9 +2747,19 @@ int main(int argc, char **argv) {
     if (display.compositor)
         wl_compositor_destroy(display.compositor);
 
+    if (display.shm)
+        wl_shm_destroy(display.shm);
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (display.outputs[i].output)
+            wl_output_destroy(display.outputs[i].output);
+    }
+
     wl_registry_destroy(display.registry);
     wl_display_flush(display.display);
     wl_display_disconnect(display.display);
+    wlprof_fini();
+    event_loop_fini(&display.loop);
 
     return 0;
 }
\ No newline at end of file
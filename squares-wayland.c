@@ -30,6 +30,7 @@
 #include <math.h>
 #include <assert.h>
 #include <signal.h>
+#include <sys/resource.h>
 
 #include <linux/input.h>
 
@@ -38,6 +39,7 @@
 #include <wayland-cursor.h>
 
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
@@ -47,6 +49,20 @@
 
 #include "shared/platform.h"
 
+#include "dynres.h"
+#include "eventloop.h"
+#include "gputimer.h"
+#include "inputlog.h"
+#include "metrics.h"
+#include "overdraw.h"
+#include "overlay.h"
+#include "renderserver.h"
+#include "scene.h"
+#include "shmbuf.h"
+#include "swraster.h"
+#include "trace.h"
+#include "wlprof.h"
+
 #ifndef EGL_EXT_swap_buffers_with_damage
 #define EGL_EXT_swap_buffers_with_damage 1
 typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)(EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint n_rects);
@@ -60,10 +76,21 @@ typedef EGLBoolean (EGLAPIENTRYP PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC)(EGLDisplay
 struct window;
 struct seat;
 
+#define MAX_OUTPUTS 8
+
+struct output {
+    struct wl_output *output;
+    uint32_t name;
+    int scale;
+    int refresh; /* mHz of the current mode, 0 until known */
+};
+
 struct display {
     struct wl_display *display;
     struct wl_registry *registry;
     struct wl_compositor *compositor;
+    uint32_t compositor_version;
+    struct wl_subcompositor *subcompositor;
     struct xdg_shell *shell;
     struct wl_seat *seat;
     struct wl_pointer *pointer;
@@ -73,12 +100,15 @@ struct display {
     struct wl_cursor_theme *cursor_theme;
     struct wl_cursor *default_cursor;
     struct wl_surface *cursor_surface;
+    struct output outputs[MAX_OUTPUTS];
     struct {
         EGLDisplay dpy;
         EGLContext ctx;
         EGLConfig conf;
     } egl;
     struct window *window;
+    struct event_loop loop;
+    struct input_log input;
 
     PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 };
@@ -89,7 +119,7 @@ struct geometry {
 
 struct window {
     struct display *display;
-    struct geometry geometry, window_size;
+    struct geometry geometry, window_size, allocated;
     struct {
         GLuint rotation_uniform;
         GLuint pos;
@@ -97,14 +127,60 @@ struct window {
     } gl;
 
     uint32_t benchmark_time, frames;
+    uint64_t benchmark_cpu_ns;
     struct wl_egl_window *native;
     struct wl_surface *surface;
     struct xdg_surface *xdg_surface;
     EGLSurface egl_surface;
     struct wl_callback *callback;
     int fullscreen, opaque, buffer_size, frame_sync;
+    /* -B, -D: what the surface costs to fill and hand over */
+    int dither;
+    uint64_t swap_ns;
+    /* configure and scale changes are only recorded by the listeners and
+     * applied once at the start of the next frame */
+    int scale, resize_pending, configure_pending;
+    uint32_t configure_serial, outputs;
+    struct dynres dynres;
+    struct gpu_timer gpu_timer;
+    struct overdraw overdraw;
+    struct metrics metrics;
+    /* -l: the squares are only redrawn when the window changes, what
+     * changes every frame is on the overlay */
+    int layered, static_frames;
+    struct overlay overlay;
+    /* -S: no EGL, the CPU draws into wl_shm buffers */
+    int software, sw_threads;
+    struct shm_buffers shm;
+    struct sw_pool sw_pool;
+    uint64_t sw_render_ns;
+};
+
+static const int benchmark_interval = 5;
+
+static int running = 1;
+
+enum {
+    PASS_SCENE,
+    PASS_DYNRES
 };
 
+static const char *pass_names[] = { "scene", "dynres" };
+
+/* user and system time of every thread in the process, llvmpipe's
+ * included, and the peak resident set size */
+static uint64_t process_cpu_ns(double *peak_mb) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    if (peak_mb)
+        *peak_mb = usage.ru_maxrss * 1024 / 1e6;
+
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+           1000000000 +
+           (uint64_t) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) *
+           1000;
+}
 
 static GLuint position_l,
               projection_l,
@@ -133,8 +209,17 @@ GLfloat model[] = {
     0.0f, 0.0f, 0.0f, 1.0f
 };
 
+/* keep the squares square in non-square windows */
+static void update_projection(int width, int height) {
+    projection[0] = width > height ? (GLfloat) height / width : 1.0f;
+    projection[5] = height > width ? (GLfloat) width / height : 1.0f;
+}
+
 uint32_t maxid = 0;
 
+/* GL draw calls of the frame being drawn, for the metrics */
+static uint64_t draw_calls;
+
 void draw_square(GLfloat x,
                  GLfloat y,
                  GLfloat s,
@@ -152,6 +237,7 @@ void draw_square(GLfloat x,
     glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, square);
     glEnableVertexAttribArray(position_l);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    draw_calls++;
 
     model[12] = 0;
     model[13] = 0;
@@ -161,29 +247,685 @@ void draw_square(GLfloat x,
     return;
 }
 
+static GLuint create_program(const char *src_v, const char *src_f) {
+    GLuint s_v, s_f, p;
+    char msg[512];
+
+    s_v = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(s_v, 1, &src_v, NULL);
+    glCompileShader(s_v);
+    glGetShaderInfoLog(s_v, sizeof msg, NULL, msg);
+    printf("vertex shader info: %s\n", msg);
+
+    s_f = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(s_f, 1, &src_f, NULL);
+    glCompileShader(s_f);
+    glGetShaderInfoLog(s_f, sizeof msg, NULL, msg);
+    printf("fragment shader info: %s\n", msg);
+
+    p = glCreateProgram();
+    glAttachShader(p, s_v);
+    glAttachShader(p, s_f);
+    glLinkProgram(p);
+
+    return p;
+}
+
+/* -s: any number of rectangles from a scene file (scene.h) instead of
+ * the four squares.  The file's columns go into one vertex buffer as
+ * they are and are drawn in one instanced call, each rectangle scaling
+ * and moving unit_square[] in the vertex shader.  Without instancing
+ * (ES 2 with neither extension) every rectangle is expanded into two
+ * triangles on the CPU instead.  fit[] maps the scene's bounds onto the
+ * area of the four squares. */
+static const GLfloat unit_square[] = {
+    0.0f, 0.0f,
+    1.0f, 0.0f,
+    0.0f, 1.0f,
+    1.0f, 1.0f
+};
+
+struct rect_vertex {
+    GLfloat x, y;
+    uint32_t color;
+};
+
+static struct {
+    struct scene file;
+    GLfloat fit[4]; /* scale x, y, then offset x, y */
+    GLuint program, vbo;
+    GLint projection_l, fit_l, corner_l, position_l, size_l, color_l;
+    GLsizei vertices; /* when expanded */
+    size_t size;
+    PFNGLVERTEXATTRIBDIVISOREXTPROC divisor;
+    PFNGLDRAWARRAYSINSTANCEDEXTPROC draw_instanced;
+} rects;
+
+static int rects_load(const char *path) {
+    const float *b;
+    float scale;
+
+    if (scene_open(&rects.file, path) < 0)
+        return -1;
+    if (rects.file.count > INT32_MAX / 6) {
+        fprintf(stderr, "scene %s: too many rectangles\n", path);
+        scene_close(&rects.file);
+        return -1;
+    }
+
+    b = rects.file.header->bounds;
+    scale = fmaxf(b[2] - b[0], b[3] - b[1]);
+    scale = scale > 0 ? 2 / scale : 1;
+    rects.fit[0] = rects.fit[1] = scale;
+    rects.fit[2] = -(b[0] + b[2]) / 2 * scale;
+    rects.fit[3] = -(b[1] + b[3]) / 2 * scale;
+
+    return 0;
+}
+
+static void rects_find_instancing(void) {
+    const char *version = (const char *) glGetString(GL_VERSION);
+    const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+    int major = 0;
+
+    if (version && sscanf(version, "OpenGL ES %d", &major) == 1 &&
+        major >= 3) {
+        rects.divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+            eglGetProcAddress("glVertexAttribDivisor");
+        rects.draw_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+            eglGetProcAddress("glDrawArraysInstanced");
+    } else if (extensions && strstr(extensions, "GL_EXT_instanced_arrays")) {
+        rects.divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+            eglGetProcAddress("glVertexAttribDivisorEXT");
+        rects.draw_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+            eglGetProcAddress("glDrawArraysInstancedEXT");
+    } else if (extensions &&
+               strstr(extensions, "GL_ANGLE_instanced_arrays")) {
+        rects.divisor = (PFNGLVERTEXATTRIBDIVISOREXTPROC)
+            eglGetProcAddress("glVertexAttribDivisorANGLE");
+        rects.draw_instanced = (PFNGLDRAWARRAYSINSTANCEDEXTPROC)
+            eglGetProcAddress("glDrawArraysInstancedANGLE");
+    }
+
+    if (!rects.divisor || !rects.draw_instanced) {
+        rects.divisor = NULL;
+        rects.draw_instanced = NULL;
+    }
+}
+
+/* two counter-clockwise triangles per rectangle */
+static struct rect_vertex *rects_expand(void) {
+    const struct scene *s = &rects.file;
+    struct rect_vertex *v, *out;
+    GLfloat x0, y0, x1, y1;
+    uint64_t i;
+
+    out = malloc(s->count * 6 * sizeof *out);
+    assert(out);
+
+    for (i = 0, v = out; i < s->count; i++, v += 6) {
+        x0 = s->positions[2 * i];
+        y0 = s->positions[2 * i + 1];
+        x1 = x0 + s->sizes[2 * i];
+        y1 = y0 + s->sizes[2 * i + 1];
+
+        v[0] = (struct rect_vertex) { x0, y0, s->colors[i] };
+        v[1] = (struct rect_vertex) { x1, y0, s->colors[i] };
+        v[2] = (struct rect_vertex) { x0, y1, s->colors[i] };
+        v[3] = v[2];
+        v[4] = v[1];
+        v[5] = (struct rect_vertex) { x1, y1, s->colors[i] };
+    }
+
+    return out;
+}
+
+static void rects_init(void) {
+    static const char *src_v = "uniform mat4 projection;\n"
+                               "uniform vec4 fit;\n"
+
+                               "attribute vec2 corner;\n"
+                               "attribute vec2 rect_position;\n"
+                               "attribute vec2 rect_size;\n"
+                               "attribute vec4 rect_color;\n"
+
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "vec2 p = rect_position + corner * rect_size;\n"
+                                   "color = rect_color;\n"
+                                   "gl_Position = vec4(p * fit.xy + fit.zw, 0, 1) * projection;"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "gl_FragColor = color;"
+                               "}";
+    const struct scene_header *h = rects.file.header;
+    struct rect_vertex *expanded = NULL;
+    uint64_t start, expand_ns = 0, upload_ns;
+    const void *data;
+    size_t size;
+
+    rects.program = create_program(src_v, src_f);
+    rects.projection_l = glGetUniformLocation(rects.program, "projection");
+    rects.fit_l = glGetUniformLocation(rects.program, "fit");
+    rects.corner_l = glGetAttribLocation(rects.program, "corner");
+    rects.position_l = glGetAttribLocation(rects.program, "rect_position");
+    rects.size_l = glGetAttribLocation(rects.program, "rect_size");
+    rects.color_l = glGetAttribLocation(rects.program, "rect_color");
+
+    rects_find_instancing();
+
+    if (rects.draw_instanced) {
+        /* all three columns, padding and all, straight from the map */
+        data = (const char *) rects.file.map + h->position_offset;
+        size = h->file_size - h->position_offset;
+    } else {
+        start = trace_now();
+        expanded = rects_expand();
+        expand_ns = trace_now() - start;
+        rects.vertices = rects.file.count * 6;
+        data = expanded;
+        size = rects.vertices * sizeof *expanded;
+    }
+
+    start = trace_now();
+    glGenBuffers(1, &rects.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, rects.vbo);
+    glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glFinish();
+    rects.size = size;
+    upload_ns = trace_now() - start;
+    free(expanded);
+
+    /* later rectangles simply paint over earlier ones */
+    glDisable(GL_DEPTH_TEST);
+
+    printf("scene: %llu rectangles, mapped in %.2f ms, ",
+           (unsigned long long) rects.file.count, rects.file.map_ms);
+    if (rects.draw_instanced)
+        printf("instanced, ");
+    else
+        printf("expanded in %.2f ms, ", expand_ns / 1e6);
+    printf("%.1f MB uploaded in %.2f ms (%.0f MB/s)\n", size / 1e6,
+           upload_ns / 1e6, size / 1e6 / (upload_ns / 1e9));
+}
+
+static void rects_fini(void) {
+    if (rects.vbo)
+        glDeleteBuffers(1, &rects.vbo);
+    if (rects.program)
+        glDeleteProgram(rects.program);
+    scene_close(&rects.file);
+}
+
+static void rects_draw(void) {
+    const struct scene_header *h = rects.file.header;
+
+    glUseProgram(rects.program);
+    glUniformMatrix4fv(rects.projection_l, 1, GL_FALSE, projection);
+    glUniform4fv(rects.fit_l, 1, rects.fit);
+
+    glBindBuffer(GL_ARRAY_BUFFER, rects.vbo);
+
+    if (!rects.draw_instanced) {
+        glVertexAttribPointer(rects.position_l, 2, GL_FLOAT, GL_FALSE,
+                              sizeof(struct rect_vertex), (void *) 0);
+        glVertexAttribPointer(rects.color_l, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                              sizeof(struct rect_vertex),
+                              (void *) offsetof(struct rect_vertex, color));
+        glEnableVertexAttribArray(rects.position_l);
+        glEnableVertexAttribArray(rects.color_l);
+        glVertexAttrib2f(rects.corner_l, 0, 0);
+        glVertexAttrib2f(rects.size_l, 0, 0);
+        glDrawArrays(GL_TRIANGLES, 0, rects.vertices);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        draw_calls++;
+        return;
+    }
+
+    /* offsets of the columns from the start of the buffer */
+    glVertexAttribPointer(rects.position_l, 2, GL_FLOAT, GL_FALSE, 0,
+                          (void *) 0);
+    glVertexAttribPointer(rects.size_l, 2, GL_FLOAT, GL_FALSE, 0,
+                          (void *) (h->size_offset - h->position_offset));
+    glVertexAttribPointer(rects.color_l, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+                          (void *) (h->color_offset - h->position_offset));
+    glEnableVertexAttribArray(rects.position_l);
+    glEnableVertexAttribArray(rects.size_l);
+    glEnableVertexAttribArray(rects.color_l);
+    rects.divisor(rects.position_l, 1);
+    rects.divisor(rects.size_l, 1);
+    rects.divisor(rects.color_l, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glVertexAttribPointer(rects.corner_l, 2, GL_FLOAT, GL_FALSE, 0,
+                          unit_square);
+    glEnableVertexAttribArray(rects.corner_l);
+    rects.divisor(rects.corner_l, 0);
+
+    rects.draw_instanced(GL_TRIANGLE_STRIP, 0, 4, rects.file.count);
+    draw_calls++;
+
+    /* the divisors stay with the attribute indices, which other programs
+     * use too */
+    rects.divisor(rects.position_l, 0);
+    rects.divisor(rects.size_l, 0);
+    rects.divisor(rects.color_l, 0);
+}
+
+/* -L: what other processes send to the render server (renderserver.h)
+ * instead of the four squares.  Every client's frame goes into one of two
+ * vertex buffers of its own in turn, so a new frame never overwrites the
+ * one the GPU may still be drawing from, and is drawn with one call. */
+static struct {
+    struct render_server server;
+    GLuint program, vbo[RENDER_MAX_CLIENTS][2];
+    GLint projection_l, position_l, color_l;
+    GLsizei count[RENDER_MAX_CLIENTS];
+    size_t size[RENDER_MAX_CLIENTS][2];
+    int current[RENDER_MAX_CLIENTS];
+    uint64_t uploaded;
+} serve;
+
+static void serve_init(void) {
+    static const char *src_v = "uniform mat4 projection;\n"
+
+                               "attribute vec2 position;\n"
+                               "attribute vec4 color_a;\n"
+
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "color = color_a;\n"
+                                   "gl_Position = vec4(position, 0, 1) * projection;"
+                               "}";
+    static const char *src_f = "precision mediump float;\n"
+                               "varying vec4 color;\n"
+
+                               "void main() {"
+                                   "gl_FragColor = color;"
+                               "}";
+
+    serve.program = create_program(src_v, src_f);
+    serve.projection_l = glGetUniformLocation(serve.program, "projection");
+    serve.position_l = glGetAttribLocation(serve.program, "position");
+    serve.color_l = glGetAttribLocation(serve.program, "color_a");
+    glGenBuffers(RENDER_MAX_CLIENTS * 2, &serve.vbo[0][0]);
+
+    /* clients draw in order, in either winding */
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+}
+
+static void serve_fini(void) {
+    render_server_fini(&serve.server);
+    if (serve.program) {
+        glDeleteBuffers(RENDER_MAX_CLIENTS * 2, &serve.vbo[0][0]);
+        glDeleteProgram(serve.program);
+    }
+}
+
+/* the frames committed since the last one into the other buffers */
+static void serve_update(void) {
+    TRACE_SCOPE("serve_update");
+    const struct render_frame *f;
+    size_t size;
+    int i;
+
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+        if (!render_server_take(&serve.server, i, &f))
+            continue;
+
+        serve.current[i] ^= 1;
+        serve.count[i] = f->count;
+        size = f->count * sizeof *f->vertices;
+        glBindBuffer(GL_ARRAY_BUFFER, serve.vbo[i][serve.current[i]]);
+        glBufferData(GL_ARRAY_BUFFER, size, f->vertices, GL_STREAM_DRAW);
+        serve.size[i][serve.current[i]] = size;
+        serve.uploaded += size;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void serve_draw(void) {
+    int i;
+
+    glUseProgram(serve.program);
+    glUniformMatrix4fv(serve.projection_l, 1, GL_FALSE, projection);
+    glEnableVertexAttribArray(serve.position_l);
+    glEnableVertexAttribArray(serve.color_l);
+
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++) {
+        if (!serve.count[i])
+            continue;
+        glBindBuffer(GL_ARRAY_BUFFER, serve.vbo[i][serve.current[i]]);
+        glVertexAttribPointer(serve.position_l, 2, GL_FLOAT, GL_FALSE,
+                              sizeof(struct render_vertex), (void *) 0);
+        glVertexAttribPointer(serve.color_l, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                              sizeof(struct render_vertex),
+                              (void *) offsetof(struct render_vertex,
+                                                color));
+        glDrawArrays(GL_TRIANGLES, 0, serve.count[i]);
+        draw_calls++;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisableVertexAttribArray(serve.color_l);
+}
+
+/* Refresh interval of the fastest output we are on, which is the one the
+ * compositor paces frame callbacks by; 0 if unknown or not synced to it. */
+static uint64_t window_refresh_ns(struct window *window) {
+    struct display *display = window->display;
+    int i, refresh = 0;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if ((window->outputs & (1 << i)) &&
+            display->outputs[i].refresh > refresh)
+            refresh = display->outputs[i].refresh;
+    }
+
+    if (!window->frame_sync || refresh <= 0)
+        return 0;
+    return 1000000000000ull / refresh;
+}
+
+/* vertex data in GL buffers: the scene's, or both buffers of every
+ * render server client */
+static uint64_t resident_bytes(void) {
+    uint64_t size = rects.size;
+    int i;
+
+    for (i = 0; i < RENDER_MAX_CLIENTS; i++)
+        size += serve.size[i][0] + serve.size[i][1];
+
+    return size;
+}
+
+static void window_apply_resize(struct window *window) {
+    int width, height;
+
+    if (!window->resize_pending)
+        return;
+    window->resize_pending = 0;
+
+    width = window->geometry.width * window->scale;
+    height = window->geometry.height * window->scale;
+
+    /* the new buffer size takes effect at the next eglSwapBuffers(),
+     * or shm commit, together with the buffer scale and the ack below */
+    if (width != window->allocated.width ||
+        height != window->allocated.height) {
+        if (window->software) {
+            if (shm_buffers_resize(&window->shm, width, height) < 0)
+                exit(EXIT_FAILURE);
+        } else {
+            wl_egl_window_resize(window->native, width, height, 0, 0);
+        }
+        window->allocated.width = width;
+        window->allocated.height = height;
+    }
+    if (window->display->compositor_version >= 3)
+        wl_surface_set_buffer_scale(window->surface, window->scale);
+
+    /* along the bottom left corner, moved with the squares' commit */
+    if (window->layered &&
+        overlay_place(&window->overlay,
+                      0, window->geometry.height - OVERLAY_HEIGHT,
+                      window->scale) < 0)
+        exit(EXIT_FAILURE);
+
+    if (!window->software) {
+        glViewport(0, 0, width, height);
+        dynres_resize(&window->dynres, width, height);
+    }
+    update_projection(window->geometry.width, window->geometry.height);
+
+    if (window->configure_pending) {
+        xdg_surface_ack_configure(window->xdg_surface,
+                                  window->configure_serial);
+        window->configure_pending = 0;
+    }
+}
+
+static void benchmark(struct window *window) {
+    uint32_t time = trace_now() / 1000000;
+    uint64_t cpu_ns;
+    double peak_mb;
+    float seconds;
+
+    if (window->frames == 0) {
+        window->benchmark_time = time;
+        window->benchmark_cpu_ns = process_cpu_ns(NULL);
+    }
+
+    window->frames++;
+    wlprof_frame();
+    if (time - window->benchmark_time < benchmark_interval * 1000)
+        return;
+
+    seconds = (time - window->benchmark_time) / 1000.0f;
+    printf("%d frames in %.1f seconds: %f fps\n",
+           window->frames, seconds, window->frames / seconds);
+
+    cpu_ns = process_cpu_ns(&peak_mb);
+    printf("process: %.2f ms CPU/frame over all threads, %.1f MB peak "
+           "resident\n",
+           (cpu_ns - window->benchmark_cpu_ns) / 1e6 / window->frames,
+           peak_mb);
+
+    if (window->software) {
+        printf("software: drawn in %.2f ms/frame by %d threads\n",
+               window->sw_render_ns / 1e6 / window->frames,
+               window->sw_pool.n_threads);
+        shm_buffers_report(&window->shm);
+        window->sw_render_ns = 0;
+    }
+
+    if (!window->software) {
+        int bytes = window->buffer_size == 16 ? 2 : 4;
+        int swaps = window->layered ? window->static_frames : window->frames;
+        double mb = (double) window->allocated.width *
+                    window->allocated.height * bytes / 1e6;
+
+        printf("framebuffer: %d bit%s, %.2f MB/frame (%.0f MB/s), "
+               "swap %.2f ms/frame\n", window->buffer_size,
+               window->dither ? " dithered" : "", mb,
+               mb * swaps / seconds,
+               swaps ? window->swap_ns / 1e6 / swaps : 0.0);
+        window->swap_ns = 0;
+    }
+
+    if (window->layered) {
+        printf("layers: squares redrawn in %d of %d frames, the overlay "
+               "(%.1f%% of the window) in all\n",
+               window->static_frames, window->frames,
+               100.0 * OVERLAY_WIDTH * OVERLAY_HEIGHT /
+               (window->geometry.width * window->geometry.height));
+        shm_buffers_report(&window->overlay.shm);
+        window->static_frames = 0;
+    }
+
+    if (window->dynres.enabled)
+        printf("dynres: scale %.2f (%dx%d), frame %.2f ms, target %.2f ms\n",
+               window->dynres.scale,
+               window->dynres.scaled_width, window->dynres.scaled_height,
+               window->dynres.frame_ms, window->dynres.target_ms);
+
+    if (serve.server.enabled) {
+        render_server_report(&serve.server, window->frames);
+        printf("render server: %.1f KB/frame uploaded\n",
+               serve.uploaded / 1e3 / window->frames);
+        serve.uploaded = 0;
+    }
+
+    gpu_timer_report(&window->gpu_timer);
+    overdraw_report(&window->overdraw);
+    wlprof_report();
+    event_loop_report(&window->display->loop, window->frames);
+
+    window->benchmark_time = time;
+    window->frames = 0;
+}
+
+static void frame_done(void *data,
+                       struct wl_callback *callback,
+                       uint32_t time) {
+    struct window *window = data;
+
+    wl_callback_destroy(callback);
+    window->callback = NULL;
+
+    /* the compositor wants the next frame, so the last one is up */
+    render_server_presented(&serve.server);
+}
+
+static const struct wl_callback_listener frame_listener = {
+    frame_done
+};
+
+uint32_t p_x, p_y;
+int p_inside;
+
+/* the color of the square under the pointer, -1 if none is */
+static int hovered_color(struct window *window) {
+    /* back through projection[], which fits the squares' [-1, 1] into
+     * the middle of a window that isn't square */
+    double x = (2.0 * p_x / window->geometry.width - 1) / projection[0];
+    double y = (1 - 2.0 * p_y / window->geometry.height) / projection[5];
+
+    /* the rectangles of a scene file aren't looked up */
+    if (!p_inside || rects.file.count || fabs(x) > 1 || fabs(y) > 1)
+        return -1;
+
+    if (y < 0)
+        return x >= 0 ? 0xffffff : 0xff00ff;
+    return x >= 0 ? 0xffff00 : 0x00ffff;
+}
+
+/* the frame callback comes from the overlay, the squares' surface is only
+ * committed when they change */
+static void overlay_update(struct window *window) {
+    TRACE_SCOPE("overlay");
+
+    if (window->frame_sync) {
+        window->callback = wl_surface_frame(window->overlay.surface);
+        wl_callback_add_listener(window->callback, &frame_listener, window);
+    }
+    if (overlay_frame(&window->overlay, window->display->display,
+                      hovered_color(window), trace_now()) < 0)
+        running = 0;
+    wl_display_flush(window->display->display);
+}
+
 void squares(struct window *window) {
+    TRACE_SCOPE("frame");
     EGLint buffer_age = 0;
+    uint64_t start;
+
+    start = trace_now();
+    draw_calls = 0;
+
+    if (window->layered && !window->resize_pending) {
+        overlay_update(window);
+        goto done;
+    }
+
+    window_apply_resize(window);
+    if (serve.server.enabled)
+        serve_update();
+    gpu_timer_frame(&window->gpu_timer);
+    if (window->dynres.enabled)
+        dynres_begin(&window->dynres);
+
+    gpu_timer_begin(&window->gpu_timer, PASS_SCENE);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    overdraw_begin(&window->overdraw);
+
+    {
+        TRACE_SCOPE("draw_squares");
+        if (serve.server.enabled) {
+            serve_draw();
+        } else if (rects.file.count) {
+            rects_draw();
+        } else {
+            draw_square(0, 0, 1, (GLfloat[]){0.0f, 1.0f, 1.0f, 1.0f});
+            draw_square(1, 0, 1, (GLfloat[]){1.0f, 1.0f, 0.0f, 1.0f});
+            draw_square(0, -1, 1, (GLfloat[]){1.0f, 0.0f, 1.0f, 1.0f});
+            draw_square(1, -1, 1, (GLfloat[]){1.0f, 1.0f, 1.0f, 1.0f});
+        }
+    }
+
+    gpu_timer_end(&window->gpu_timer, PASS_SCENE);
 
-    draw_square(0, 0, 1, (GLfloat[]){0.0f, 1.0f, 1.0f, 1.0f});
-    draw_square(1, 0, 1, (GLfloat[]){1.0f, 1.0f, 0.0f, 1.0f});
-    draw_square(0, -1, 1, (GLfloat[]){1.0f, 0.0f, 1.0f, 1.0f});
-    draw_square(1, -1, 1, (GLfloat[]){1.0f, 1.0f, 1.0f, 1.0f});
+    if (window->overdraw.enabled) {
+        TRACE_SCOPE("overdraw_end");
+        overdraw_end(&window->overdraw,
+                     window->allocated.width, window->allocated.height);
+    }
+
+    if (window->dynres.enabled) {
+        {
+            TRACE_SCOPE("dynres_end");
+            gpu_timer_begin(&window->gpu_timer, PASS_DYNRES);
+            dynres_end(&window->dynres);
+            gpu_timer_end(&window->gpu_timer, PASS_DYNRES);
+        }
+        /* wait for the rendering itself, but not for vblank in
+         * eglSwapBuffers(), or the controller would only ever see the
+         * refresh interval */
+        {
+            TRACE_SCOPE("glFinish");
+            glFinish();
+        }
+        dynres_update(&window->dynres, (trace_now() - start) / 1e6);
+    }
 
     eglQuerySurface(window->display->egl.dpy,
                     window->egl_surface,
                     EGL_BUFFER_AGE_EXT,
                     &buffer_age);
-    wl_surface_set_opaque_region(window->surface, NULL);
-    eglSwapBuffers(window->display->egl.dpy, window->egl_surface);
+    gpu_timer_cpu(&window->gpu_timer, (trace_now() - start) / 1e6);
+    if (window->frame_sync && !window->layered) {
+        window->callback = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->callback, &frame_listener, window);
+    }
+    {
+        TRACE_SCOPE("eglSwapBuffers");
+        uint64_t swap_start = trace_now();
+
+        eglSwapBuffers(window->display->egl.dpy, window->egl_surface);
+        window->swap_ns += trace_now() - swap_start;
+    }
+    if (!window->frame_sync)
+        render_server_presented(&serve.server);
+    if (window->layered) {
+        window->static_frames++;
+        overlay_update(window);
+    }
+
+done:
+    metrics_frame(&window->metrics, start, trace_now(),
+                  window_refresh_ns(window), draw_calls, resident_bytes(),
+                  window->display->loop.wakeups_total);
+    benchmark(window);
 }
 
-void init_gl() {
+void init_gl(struct window *window) {
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
+    /* GL starts out dithering; only -D keeps it, so the cost of a 16 bit
+     * framebuffer can be measured with and without */
+    if (window->dither)
+        glEnable(GL_DITHER);
+    else
+        glDisable(GL_DITHER);
 
-    GLuint s_v, s_f, p;
-    char msg[512];
+    GLuint p;
 
     static const char *src_v = "uniform mat4 projection;\n"
                                "uniform mat4 model;\n"
@@ -207,22 +949,7 @@ void init_gl() {
                                    "gl_FragColor = color;"
                                "}";
 
-    s_v = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(s_v, 1, &src_v, NULL);
-    glCompileShader(s_v);
-    glGetShaderInfoLog(s_v, sizeof msg, NULL, msg);
-    printf("vertex shader info: %s\n", msg);
-
-    s_f = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(s_f, 1, &src_f, NULL);
-    glCompileShader(s_f);
-    glGetShaderInfoLog(s_f, sizeof msg, NULL, msg);
-    printf("fragment shader info: %s\n", msg);
-
-    p = glCreateProgram();
-    glAttachShader(p, s_v);
-    glAttachShader(p, s_f);
-    glLinkProgram(p);
+    p = create_program(src_v, src_f);
     glUseProgram(p);
 
     projection_l = glGetUniformLocation(p, "projection");
@@ -230,8 +957,19 @@ void init_gl() {
     color_l = glGetUniformLocation(p, "color_u");
     identifier_l = glGetUniformLocation(p, "identifier_u");
     position_l = glGetAttribLocation(p, "position");
+
+    if (window->dynres.target_ms > 0)
+        dynres_init(&window->dynres, window->dynres.target_ms);
+    if (window->gpu_timer.enabled)
+        gpu_timer_init(&window->gpu_timer, pass_names, 2);
+    if (window->overdraw.enabled)
+        overdraw_init(&window->overdraw);
+
+    if (rects.file.count)
+        rects_init();
+    if (serve.server.enabled)
+        serve_init();
 }
-static int running = 1;
 
 static void init_egl(struct display *display,
                      struct window *window)
@@ -249,15 +987,19 @@ static void init_egl(struct display *display,
         EGL_BLUE_SIZE, 1,
         EGL_ALPHA_SIZE, 1,
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_STENCIL_SIZE, 0,
         EGL_NONE
     };
 
-    EGLint major, minor, n, count, i, size;
+    EGLint major, minor, n, count, i, size, r, g, b, a;
     EGLConfig *configs;
     EGLBoolean ret;
 
-    if (window->opaque || window->buffer_size == 16)
+    if (window->opaque || window->buffer_size < 32)
         config_attribs[9] = 0;
+    /* -O counts fragments in the stencil buffer */
+    if (window->overdraw.enabled)
+        config_attribs[13] = 8;
 
     display->egl.dpy =
         weston_platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
@@ -282,7 +1024,10 @@ static void init_egl(struct display *display,
     for (i = 0; i < n; i++) {
         eglGetConfigAttrib(display->egl.dpy,
                    configs[i], EGL_BUFFER_SIZE, &size);
-        if (window->buffer_size == size) {
+        eglGetConfigAttrib(display->egl.dpy,
+                   configs[i], EGL_ALPHA_SIZE, &a);
+        /* 16 bit means RGB565, not RGBA4444 or RGBA5551 */
+        if (window->buffer_size == size && (size == 32 || a == 0)) {
             display->egl.conf = configs[i];
             break;
         }
@@ -294,6 +1039,17 @@ static void init_egl(struct display *display,
         exit(EXIT_FAILURE);
     }
 
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_RED_SIZE, &r);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_GREEN_SIZE, &g);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_BLUE_SIZE, &b);
+    eglGetConfigAttrib(display->egl.dpy, display->egl.conf,
+                       EGL_ALPHA_SIZE, &a);
+    printf("EGL config: %d bit, R%d G%d B%d A%d\n",
+           window->buffer_size, r, g, b, a);
+
     display->egl.ctx = eglCreateContext(display->egl.dpy,
                         display->egl.conf,
                         EGL_NO_CONTEXT, context_attribs);
@@ -319,6 +1075,26 @@ static void fini_egl(struct display *display)
     eglReleaseThread();
 }
 
+static void window_configure(struct window *window,
+                             int32_t width,
+                             int32_t height,
+                             int fullscreen) {
+    window->fullscreen = fullscreen;
+
+    if (width > 0 && height > 0) {
+        if (!window->fullscreen) {
+            window->window_size.width = width;
+            window->window_size.height = height;
+        }
+        window->geometry.width = width;
+        window->geometry.height = height;
+    } else if (!window->fullscreen) {
+        window->geometry = window->window_size;
+    }
+
+    window->resize_pending = 1;
+}
+
 static void handle_surface_configure(void *data,
                                      struct xdg_surface *surface,
                                      int32_t width,
@@ -326,35 +1102,30 @@ static void handle_surface_configure(void *data,
                                      struct wl_array *states,
                                      uint32_t serial) {
     struct window *window = data;
+    int fullscreen = 0;
     uint32_t *p;
 
-    window->fullscreen = 0;
     wl_array_for_each(p, states) {
         uint32_t state = *p;
         switch (state) {
         case XDG_SURFACE_STATE_FULLSCREEN:
-            window->fullscreen = 1;
+            fullscreen = 1;
             break;
         }
     }
 
-    if (width > 0 && height > 0) {
-        if (!window->fullscreen) {
-            window->window_size.width = width;
-            window->window_size.height = height;
-        }
-        window->geometry.width = width;
-        window->geometry.height = height;
-    } else if (!window->fullscreen) {
-        window->geometry = window->window_size;
-    }
-
-    if (window->native)
-        wl_egl_window_resize(window->native,
-                     window->geometry.width,
-                     window->geometry.height, 0, 0);
-
-    xdg_surface_ack_configure(surface, serial);
+    /* a replay keeps the recorded size, but the configure must still be
+     * acked */
+    if (input_log_event(&window->display->input, INPUT_CONFIGURE, 0,
+                        width, height, fullscreen))
+        window_configure(window, width, height, fullscreen);
+
+    /* Interactive resizes send configures in bursts; only remember the
+     * latest one and let window_apply_resize() reallocate and ack once
+     * per frame. */
+    window->resize_pending = 1;
+    window->configure_pending = 1;
+    window->configure_serial = serial;
 }
 
 static void handle_surface_delete(void *data,
@@ -378,16 +1149,142 @@ static void create_xdg_surface(struct window *window,
     xdg_surface_set_title(window->xdg_surface, "squares-wayland");
 }
 
+static void window_update_scale(struct window *window) {
+    struct display *display = window->display;
+    int i, scale = 1;
+
+    /* render for the densest output we are on, the compositor
+     * downscales for the others */
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if ((window->outputs & (1 << i)) &&
+            display->outputs[i].scale > scale)
+            scale = display->outputs[i].scale;
+    }
+
+    /* buffer scales came with wl_compositor version 3 */
+    if (display->compositor_version < 3)
+        scale = 1;
+
+    if (scale != window->scale) {
+        window->scale = scale;
+        window->resize_pending = 1;
+    }
+}
+
+static struct output *display_find_output(struct display *display,
+                                          struct wl_output *wl_output) {
+    int i;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (display->outputs[i].output == wl_output)
+            return &display->outputs[i];
+    }
+
+    return NULL;
+}
+
+static void surface_handle_enter(void *data,
+                                 struct wl_surface *surface,
+                                 struct wl_output *wl_output) {
+    struct window *window = data;
+    struct output *output = display_find_output(window->display, wl_output);
+
+    if (!output)
+        return;
+
+    window->outputs |= 1 << (output - window->display->outputs);
+    window_update_scale(window);
+}
+
+static void surface_handle_leave(void *data,
+                                 struct wl_surface *surface,
+                                 struct wl_output *wl_output) {
+    struct window *window = data;
+    struct output *output = display_find_output(window->display, wl_output);
+
+    if (!output)
+        return;
+
+    window->outputs &= ~(1 << (output - window->display->outputs));
+    window_update_scale(window);
+}
+
+static const struct wl_surface_listener surface_listener = {
+    surface_handle_enter,
+    surface_handle_leave
+};
+
+static void output_handle_geometry(void *data,
+                                   struct wl_output *wl_output,
+                                   int32_t x,
+                                   int32_t y,
+                                   int32_t physical_width,
+                                   int32_t physical_height,
+                                   int32_t subpixel,
+                                   const char *make,
+                                   const char *model,
+                                   int32_t transform) {}
+
+static void output_handle_mode(void *data,
+                               struct wl_output *wl_output,
+                               uint32_t flags,
+                               int32_t width,
+                               int32_t height,
+                               int32_t refresh) {
+    struct output *output = display_find_output(data, wl_output);
+
+    if (output && (flags & WL_OUTPUT_MODE_CURRENT))
+        output->refresh = refresh;
+}
+
+static void output_handle_done(void *data,
+                               struct wl_output *wl_output) {
+    struct display *d = data;
+
+    if (d->window && d->window->surface)
+        window_update_scale(d->window);
+}
+
+static void output_handle_scale(void *data,
+                                struct wl_output *wl_output,
+                                int32_t scale) {
+    struct output *output = display_find_output(data, wl_output);
+
+    if (output)
+        output->scale = scale;
+}
+
+static const struct wl_output_listener output_listener = {
+    output_handle_geometry,
+    output_handle_mode,
+    output_handle_done,
+    output_handle_scale
+};
+
 static void create_surface(struct window *window) {
     struct display *display = window->display;
     EGLBoolean ret;
 
     window->surface = wl_compositor_create_surface(display->compositor);
+    wl_surface_add_listener(window->surface, &surface_listener, window);
+
+    if (window->software) {
+        shm_buffers_init(&window->shm, display->shm);
+        if (shm_buffers_resize(&window->shm, window->geometry.width,
+                               window->geometry.height) < 0)
+            exit(EXIT_FAILURE);
+        window->allocated = window->geometry;
+        create_xdg_surface(window, display);
+        if (window->fullscreen)
+            xdg_surface_set_fullscreen(window->xdg_surface, NULL);
+        return;
+    }
 
     window->native =
         wl_egl_window_create(window->surface,
                      window->geometry.width,
                      window->geometry.height);
+    window->allocated = window->geometry;
     window->egl_surface =
         weston_platform_create_egl_surface(display->egl.dpy,
                            display->egl.conf,
@@ -399,8 +1296,8 @@ static void create_surface(struct window *window) {
                  window->egl_surface, window->display->egl.ctx);
     assert(ret == EGL_TRUE);
 
-    if (!window->frame_sync)
-        eglSwapInterval(display->egl.dpy, 0);
+    /* the main loop waits for the frame callback itself */
+    eglSwapInterval(display->egl.dpy, 0);
 
     if (!display->shell)
         return;
@@ -410,6 +1307,18 @@ static void create_surface(struct window *window) {
 }
 
 static void destroy_surface(struct window *window) {
+    if (window->layered)
+        overlay_fini(&window->overlay);
+
+    if (window->software) {
+        shm_buffers_fini(&window->shm);
+        xdg_surface_destroy(window->xdg_surface);
+        wl_surface_destroy(window->surface);
+        if (window->callback)
+            wl_callback_destroy(window->callback);
+        return;
+    }
+
     /* Required, otherwise segfault in egl_dri2.c: dri2_make_current()
      * on eglReleaseThread(). */
     eglMakeCurrent(window->display->egl.dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
@@ -430,20 +1339,39 @@ static void pointer_handle_enter(void *data,
                                  uint32_t serial,
                                  struct wl_surface *surface,
                                  wl_fixed_t sx,
-                                 wl_fixed_t sy) {}
+                                 wl_fixed_t sy) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_ENTER, 0, sx, sy, 0))
+        return;
+
+    p_x = wl_fixed_to_int(sx);
+    p_y = wl_fixed_to_int(sy);
+    p_inside = 1;
+}
 
 static void pointer_handle_leave(void *data,
                                  struct wl_pointer *pointer,
                                  uint32_t serial,
-                                 struct wl_surface *surface) {}
+                                 struct wl_surface *surface) {
+    struct display *d = data;
 
-uint32_t p_x, p_y;
+    if (!input_log_event(&d->input, INPUT_POINTER_LEAVE, 0, 0, 0, 0))
+        return;
+
+    p_inside = 0;
+}
 
 static void pointer_handle_motion(void *data,
                                   struct wl_pointer *pointer,
                                   uint32_t time,
                                   wl_fixed_t sx,
                                   wl_fixed_t sy) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_MOTION, time, sx, sy, 0))
+        return;
+
     p_x = wl_fixed_to_int(sx);
     p_y = wl_fixed_to_int(sy);
 }
@@ -454,6 +1382,12 @@ static void pointer_handle_button(void *data,
                                   uint32_t time,
                                   uint32_t button,
                                   uint32_t state) {
+    struct display *d = data;
+
+    if (!input_log_event(&d->input, INPUT_POINTER_BUTTON, time,
+                         button, state, 0))
+        return;
+
     if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
                if (p_x < 128 && p_y < 128) {
             printf("cyan\n");
@@ -481,6 +1415,29 @@ static const struct wl_pointer_listener pointer_listener = {
     pointer_handle_axis,
 };
 
+/* replay: logged input goes through the same handlers as live input */
+static void input_dispatch(void *data, const struct input_record *r) {
+    struct display *d = data;
+
+    switch (r->type) {
+    case INPUT_POINTER_ENTER:
+        pointer_handle_enter(d, NULL, 0, NULL, r->a, r->b);
+        break;
+    case INPUT_POINTER_LEAVE:
+        pointer_handle_leave(d, NULL, 0, NULL);
+        break;
+    case INPUT_POINTER_MOTION:
+        pointer_handle_motion(d, NULL, r->time, r->a, r->b);
+        break;
+    case INPUT_POINTER_BUTTON:
+        pointer_handle_button(d, NULL, 0, r->time, r->a, r->b);
+        break;
+    case INPUT_CONFIGURE:
+        window_configure(d->window, r->a, r->b, r->c);
+        break;
+    }
+}
+
 static void seat_handle_capabilities(void *data,
                                      struct wl_seat *seat,
                                      enum wl_seat_capability caps) {
@@ -523,43 +1480,214 @@ static void registry_handle_global(void *data,
     struct display *d = data;
 
     if (strcmp(interface, "wl_compositor") == 0) {
+        d->compositor_version = version < 3 ? version : 3;
         d->compositor =
             wl_registry_bind(registry, name,
-                     &wl_compositor_interface, 1);
+                     &wl_compositor_interface,
+                     d->compositor_version);
+    } else if (strcmp(interface, "wl_subcompositor") == 0) {
+        d->subcompositor = wl_registry_bind(registry, name,
+                                            &wl_subcompositor_interface, 1);
     } else if (strcmp(interface, "xdg_shell") == 0) {
         d->shell = wl_registry_bind(registry, name,
                         &xdg_shell_interface, 1);
         xdg_shell_add_listener(d->shell, &xdg_shell_listener, d);
         xdg_shell_use_unstable_version(d->shell, XDG_VERSION);
+    } else if (strcmp(interface, "wl_shm") == 0) {
+        d->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
     } else if (strcmp(interface, "wl_seat") == 0) {
         d->seat = wl_registry_bind(registry, name,
                        &wl_seat_interface, 1);
         wl_seat_add_listener(d->seat, &seat_listener, d);
+    } else if (strcmp(interface, "wl_output") == 0) {
+        struct output *output = display_find_output(d, NULL);
+
+        if (!output)
+            return;
+
+        output->output = wl_registry_bind(registry, name,
+                                          &wl_output_interface,
+                                          version < 2 ? version : 2);
+        output->name = name;
+        output->scale = 1;
+        wl_output_add_listener(output->output, &output_listener, d);
     }
 }
 
 static void registry_handle_global_remove(void *data,
                                           struct wl_registry *registry,
-                                          uint32_t name) {}
+                                          uint32_t name) {
+    struct display *d = data;
+    int i;
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (d->outputs[i].output && d->outputs[i].name == name) {
+            wl_output_destroy(d->outputs[i].output);
+            memset(&d->outputs[i], 0, sizeof d->outputs[i]);
+            if (d->window) {
+                d->window->outputs &= ~(1 << i);
+                window_update_scale(d->window);
+            }
+        }
+    }
+}
 
 static const struct wl_registry_listener registry_listener = {
     registry_handle_global,
     registry_handle_global_remove
 };
 
-static void signal_int(int signum) {
-    running = 0;
+/* Software path: the same four squares filled on the CPU into wl_shm
+ * buffers, one band of rows per thread. */
+static const struct {
+    GLfloat x, y;
+    uint32_t color;
+} sw_squares[] = {
+    { 0, 0,  0xff00ffff },
+    { 1, 0,  0xffffff00 },
+    { 0, -1, 0xffff00ff },
+    { 1, -1, 0xffffffff },
+};
+
+/* scene rectangles, RGBA bytes to XRGB8888, each band skipping the
+ * ones outside it */
+static void sw_band_rects(const struct sw_surface *s, int y0, int y1) {
+    const struct scene *f = &rects.file;
+    double hw = s->width / 2.0, hh = s->height / 2.0;
+    double sx = hw * projection[0] * rects.fit[0];
+    double sy = hh * projection[5] * rects.fit[1];
+    double tx = hw * (1 + projection[0] * rects.fit[2]);
+    double ty = hh * (1 - projection[5] * rects.fit[3]);
+    float top, bottom;
+    uint32_t c;
+    uint64_t i;
+
+    for (i = 0; i < f->count; i++) {
+        top = ty - sy * (f->positions[2 * i + 1] + f->sizes[2 * i + 1]);
+        bottom = ty - sy * f->positions[2 * i + 1];
+        if (bottom < y0 || top >= y1)
+            continue;
+
+        c = f->colors[i];
+        sw_fill_rect(s, y0, y1,
+                     tx + sx * f->positions[2 * i], top,
+                     tx + sx * (f->positions[2 * i] + f->sizes[2 * i]),
+                     bottom,
+                     (c & 0xff00ff00) | (c & 0xff) << 16 | (c >> 16 & 0xff));
+    }
+}
+
+static void sw_band(void *data, int y0, int y1) {
+    const struct sw_surface *s = data;
+    double hw = s->width / 2.0, hh = s->height / 2.0;
+    size_t i;
+
+    sw_clear(s, y0, y1, 0xff000000);
+
+    if (rects.file.count) {
+        sw_band_rects(s, y0, y1);
+        return;
+    }
+
+    /* square[] from (x - 1, y) to (x, y + 1), through projection[] into
+     * pixels with y pointing down */
+    for (i = 0; i < sizeof sw_squares / sizeof sw_squares[0]; i++)
+        sw_fill_rect(s, y0, y1,
+                     hw * (1 + projection[0] * (sw_squares[i].x - 1)),
+                     hh * (1 - projection[5] * (sw_squares[i].y + 1)),
+                     hw * (1 + projection[0] * sw_squares[i].x),
+                     hh * (1 - projection[5] * sw_squares[i].y),
+                     sw_squares[i].color);
+}
+
+static void squares_software(struct window *window) {
+    TRACE_SCOPE("frame");
+    struct wl_display *display = window->display->display;
+    struct shm_buffer *buffer;
+    struct sw_surface target;
+    uint64_t start;
+
+    start = trace_now();
+
+    window_apply_resize(window);
+
+    {
+        TRACE_SCOPE("shm_buffers_next");
+        buffer = shm_buffers_next(&window->shm, display);
+    }
+    if (!buffer) {
+        running = 0;
+        return;
+    }
+
+    target.pixels = buffer->pixels;
+    target.width = window->shm.width;
+    target.height = window->shm.height;
+    target.stride = window->shm.stride;
+
+    /* only the drawing, to compare with the GPU; the wait for a buffer is
+     * in the shm report */
+    {
+        TRACE_SCOPE("sw_draw");
+        uint64_t draw_start = trace_now();
+
+        sw_pool_run(&window->sw_pool, sw_band, &target, target.height);
+        window->sw_render_ns += trace_now() - draw_start;
+    }
+
+    if (window->frame_sync) {
+        window->callback = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->callback, &frame_listener, window);
+    }
+
+    shm_buffers_commit(&window->shm, buffer, window->surface);
+    wl_display_flush(display);
+
+    metrics_frame(&window->metrics, start, trace_now(),
+                  window_refresh_ns(window), 0, 0,
+                  window->display->loop.wakeups_total);
+    benchmark(window);
 }
 
 static void usage(int error_code) {
-    fprintf(stderr, "Usage: squares-wayland\n\n");
+    fprintf(stderr, "Usage: squares-wayland [OPTIONS]\n\n"
+            "  -t MS\tScale the render resolution to hold a frame time of MS\n"
+            "  -T FILE\tWrite a Chrome trace-event JSON timeline to FILE\n"
+            "  -g\tMeasure GPU time per render pass\n"
+            "  -O\tShow how many fragments each pixel gets as a heatmap and\n"
+            "    \tcount them (not with -t)\n"
+            "  -S\tDraw on the CPU into wl_shm buffers, without EGL\n"
+            "  -j N\tThreads drawing with -S (default one per CPU)\n"
+            "  -b\tDon't sync to compositor redraw\n"
+            "  -B BITS\tFramebuffer of 16 (RGB565), 24 (XRGB8888) or 32\n"
+            "    \t(ARGB8888, default) bits per pixel; -g times the fill\n"
+            "  -D\tDither when drawing into fewer bits than the colours have\n"
+            "  -s FILE\tDraw the rectangles of a scene file, such as one\n"
+            "    \twritten by scene-gen, instead of the four squares\n"
+            "  -L SOCKET\tDraw what other processes send to the Unix socket\n"
+            "    \tSOCKET (see renderserver.h) instead of the four squares\n"
+            "  -W\tCount Wayland requests and events per frame by message\n"
+            "  -r FILE\tRecord input to FILE\n"
+            "  -P FILE\tReplay input recorded in FILE, then exit\n"
+            "  -f\tReplay as fast as possible instead of at recorded speed\n"
+            "  -M SOCKET\tServe live metrics in the Prometheus text format\n"
+            "    \ton the Unix socket SOCKET\n"
+            "  -l\tRedraw the squares only when the window changes, and\n"
+            "    \tevery frame a small overlay on a subsurface of its own\n"
+            "    \tshowing the hovered color and the frame intervals\n"
+            "    \t(not with -t, -S or -L)\n"
+            "  -h\tThis help text\n\n");
+
+    exit(error_code);
 }
 
 int main(int argc, char **argv) {
-    struct sigaction sigint;
     struct display display = { 0 };
     struct window  window  = { 0 };
-    int i, ret = 0;
+    const char *trace_path = NULL, *scene_path = NULL, *serve_path = NULL;
+    const char *metrics_path = NULL;
+    const char *record_path = NULL, *replay_path = NULL;
+    int i, ret = 0, profile_wayland = 0, realtime = 1;
 
     window.display = &display;
     display.window = &window;
@@ -568,8 +1696,111 @@ int main(int argc, char **argv) {
     window.window_size = window.geometry;
     window.buffer_size = 32;
     window.frame_sync = 1;
+    window.scale = 1;
+    window.resize_pending = 1;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-t", argv[i]) == 0 && i + 1 < argc)
+            window.dynres.target_ms = atof(argv[++i]);
+        else if (strcmp("-T", argv[i]) == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+        else if (strcmp("-g", argv[i]) == 0)
+            window.gpu_timer.enabled = 1;
+        else if (strcmp("-S", argv[i]) == 0)
+            window.software = 1;
+        else if (strcmp("-j", argv[i]) == 0 && i + 1 < argc)
+            window.sw_threads = atoi(argv[++i]);
+        else if (strcmp("-b", argv[i]) == 0)
+            window.frame_sync = 0;
+        else if (strcmp("-B", argv[i]) == 0 && i + 1 < argc)
+            window.buffer_size = atoi(argv[++i]);
+        else if (strcmp("-D", argv[i]) == 0)
+            window.dither = 1;
+        else if (strcmp("-W", argv[i]) == 0)
+            profile_wayland = 1;
+        else if (strcmp("-r", argv[i]) == 0 && i + 1 < argc)
+            record_path = argv[++i];
+        else if (strcmp("-P", argv[i]) == 0 && i + 1 < argc)
+            replay_path = argv[++i];
+        else if (strcmp("-f", argv[i]) == 0)
+            realtime = 0;
+        else if (strcmp("-s", argv[i]) == 0 && i + 1 < argc)
+            scene_path = argv[++i];
+        else if (strcmp("-L", argv[i]) == 0 && i + 1 < argc)
+            serve_path = argv[++i];
+        else if (strcmp("-O", argv[i]) == 0)
+            window.overdraw.enabled = 1;
+        else if (strcmp("-M", argv[i]) == 0 && i + 1 < argc)
+            metrics_path = argv[++i];
+        else if (strcmp("-l", argv[i]) == 0)
+            window.layered = 1;
+        else if (strcmp("-h", argv[i]) == 0)
+            usage(EXIT_SUCCESS);
+        else
+            usage(EXIT_FAILURE);
+    }
 
-    display.display = wl_display_connect(NULL);
+    /* dynres, the GPU timer and the overdraw heatmap are GL render passes,
+     * the render server only draws with GL and shm buffers are ARGB8888 */
+    if (window.software &&
+        (window.dynres.target_ms > 0 || window.gpu_timer.enabled ||
+         window.overdraw.enabled || serve_path ||
+         window.buffer_size != 32 || window.dither))
+        usage(EXIT_FAILURE);
+    if (window.buffer_size != 16 && window.buffer_size != 24 &&
+        window.buffer_size != 32)
+        usage(EXIT_FAILURE);
+    /* the offscreen target of dynres has no stencil buffer */
+    if (window.overdraw.enabled && window.dynres.target_ms > 0)
+        usage(EXIT_FAILURE);
+    if (scene_path && serve_path)
+        usage(EXIT_FAILURE);
+    /* the overlay is drawn on the CPU into shm buffers of its own, dynres
+     * would rescale a frame that isn't drawn and clients of the render
+     * server change the squares every frame */
+    if (window.layered &&
+        (window.software || window.dynres.target_ms > 0 || serve_path))
+        usage(EXIT_FAILURE);
+
+    if (scene_path && rects_load(scene_path) < 0)
+        exit(EXIT_FAILURE);
+
+    if (replay_path) {
+        if (input_log_replay(&display.input, replay_path, realtime) < 0)
+            exit(EXIT_FAILURE);
+    } else if (record_path) {
+        if (input_log_record(&display.input, record_path) < 0)
+            exit(EXIT_FAILURE);
+    } else {
+        input_log_live(&display.input);
+    }
+
+    /* before any thread starts */
+    if (event_loop_init(&display.loop) < 0)
+        exit(EXIT_FAILURE);
+
+    trace_init(trace_path);
+
+    if (metrics_path &&
+        metrics_init(&window.metrics, metrics_path, "squares_wayland") < 0)
+        exit(EXIT_FAILURE);
+
+    if (serve_path && render_server_init(&serve.server, serve_path) < 0)
+        exit(EXIT_FAILURE);
+
+    if (profile_wayland) {
+        static const struct wl_interface *const protocols[] = {
+            &xdg_shell_interface,
+            NULL
+        };
+        int fd = wlprof_init(protocols);
+
+        if (fd < 0)
+            exit(EXIT_FAILURE);
+        display.display = wl_display_connect_to_fd(fd);
+    } else {
+        display.display = wl_display_connect(NULL);
+    }
     assert(display.display);
 
     display.registry = wl_display_get_registry(display.display);
@@ -579,31 +1810,63 @@ int main(int argc, char **argv) {
 
     wl_display_dispatch(display.display);
 
-    init_egl(&display, &window);
-    create_surface(&window);
-    init_gl(&window);
+    if (window.software) {
+        if (!display.shm) {
+            fprintf(stderr, "compositor has no wl_shm\n");
+            exit(EXIT_FAILURE);
+        }
+        create_surface(&window);
+        sw_pool_init(&window.sw_pool, window.sw_threads);
+    } else {
+        init_egl(&display, &window);
+        create_surface(&window);
+        init_gl(&window);
+    }
+
+    if (window.layered &&
+        overlay_init(&window.overlay, display.compositor,
+                     display.subcompositor, display.shm, window.surface) < 0)
+        exit(EXIT_FAILURE);
 
     display.cursor_surface =
         wl_compositor_create_surface(display.compositor);
 
-    sigint.sa_handler = signal_int;
-    sigemptyset(&sigint.sa_mask);
-    sigint.sa_flags = SA_RESETHAND;
-    sigaction(SIGINT, &sigint, NULL);
+    event_loop_add_display(&display.loop, display.display);
 
-    /* The mainloop here is a little subtle.  Redrawing will cause
-     * EGL to read events so we can just call
-     * wl_display_dispatch_pending() to handle any events that got
-     * queued up as a side effect. */
-    while (running) {
-        wl_display_dispatch_pending(display.display);
-        squares(&window);
+    /* sleep until the last frame's callback, or with -b only handle what
+     * already arrived, then draw the next one */
+    while (running && !display.loop.quit) {
+        event_loop_wait(&display.loop, window.callback ? -1 : 0);
+        if (window.callback)
+            continue;
+        if (!input_log_frame(&display.input, input_dispatch, &display))
+            break;
+        if (window.software)
+            squares_software(&window);
+        else
+            squares(&window);
+        trace_poll();
     }
 
     fprintf(stderr, "squares-wayland exiting\n");
 
+    metrics_fini(&window.metrics);
+    trace_fini();
+    input_log_close(&display.input);
+
+    sw_pool_fini(&window.sw_pool);
+    dynres_fini(&window.dynres);
+    gpu_timer_fini(&window.gpu_timer);
+    overdraw_fini(&window.overdraw);
+    if (!window.software) {
+        rects_fini();
+        serve_fini();
+    } else {
+        scene_close(&rects.file);
+    }
     destroy_surface(&window);
-    fini_egl(&display);
+    if (!window.software)
+        fini_egl(&display);
 
     wl_surface_destroy(display.cursor_surface);
     if (display.cursor_theme)
@@ -612,12 +1875,25 @@ int main(int argc, char **argv) {
     if (display.shell)
         xdg_shell_destroy(display.shell);
 
+    if (display.subcompositor)
+        wl_subcompositor_destroy(display.subcompositor);
+
     if (display.compositor)
         wl_compositor_destroy(display.compositor);
 
+    if (display.shm)
+        wl_shm_destroy(display.shm);
+
+    for (i = 0; i < MAX_OUTPUTS; i++) {
+        if (display.outputs[i].output)
+            wl_output_destroy(display.outputs[i].output);
+    }
+
     wl_registry_destroy(display.registry);
     wl_display_flush(display.display);
     wl_display_disconnect(display.display);
+    wlprof_fini();
+    event_loop_fini(&display.loop);
 
     return 0;
 }
\ No newline at end of file
@@ -1,6 +1,14 @@
 #include <GLES2/gl2.h>
+#include <X11/Xlib.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "eglut.h"
+#include "eglutint.h"
+#include "trace.h"
 
 static GLuint position_l,
               projection_l,
@@ -37,12 +45,11 @@ void draw_square(GLfloat x,
     model[0] = s;
     model[5] = s;
 
-    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    /* projection and the vertex array never change, they are set up
+     * once in main() */
     glUniformMatrix4fv(model_l, 1, GL_FALSE, model);
     glUniform4fv(color_l, 1, color);
 
-    glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, square);
-    glEnableVertexAttribArray(position_l);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
     model[12] = 0;
@@ -53,18 +60,137 @@ void draw_square(GLfloat x,
     return;
 }
 
+/* By default the scene is only redrawn when eglut asks for it: on
+ * expose, and from the reshape and keyboard callbacks below, and idle()
+ * sleeps in between.  -c keeps the old behaviour of posting a redisplay
+ * after every frame, which is only useful for benchmarking. */
+static int continuous = 0;
+
+static const double benchmark_interval = 5.0;
+
+static struct {
+    double wall, cpu;
+} start, last;
+
+static unsigned frames, interval_frames;
+
+double wall_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+double cpu_seconds() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+void report_cpu(const char *what, double wall, double cpu, unsigned frames) {
+    printf("%s: %u frames in %.1f seconds, %.1f%% cpu\n",
+           what, frames, wall, wall > 0 ? 100.0 * cpu / wall : 0.0);
+}
+
+void report_exit() {
+    trace_fini();
+    report_cpu("total",
+               wall_seconds() - start.wall,
+               cpu_seconds() - start.cpu,
+               frames);
+}
+
 void squares() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    double wall, cpu;
 
-    draw_square(0, 0, 1, (GLfloat[]){0.0f, 1.0f, 1.0f, 1.0f});
-    draw_square(1, 0, 1, (GLfloat[]){1.0f, 1.0f, 0.0f, 1.0f});
-    draw_square(0, -1, 1, (GLfloat[]){1.0f, 0.0f, 1.0f, 1.0f});
-    draw_square(1, -1, 1, (GLfloat[]){1.0f, 1.0f, 1.0f, 1.0f});
+    {
+        /* eglut swaps after we return, so that is not covered */
+        TRACE_SCOPE("squares");
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        draw_square(0, 0, 1, (GLfloat[]){0.0f, 1.0f, 1.0f, 1.0f});
+        draw_square(1, 0, 1, (GLfloat[]){1.0f, 1.0f, 0.0f, 1.0f});
+        draw_square(0, -1, 1, (GLfloat[]){1.0f, 0.0f, 1.0f, 1.0f});
+        draw_square(1, -1, 1, (GLfloat[]){1.0f, 1.0f, 1.0f, 1.0f});
+    }
+
+    frames++;
+    interval_frames++;
+    wall = wall_seconds();
+    cpu = cpu_seconds();
+
+    if (continuous) {
+        if (wall - last.wall >= benchmark_interval) {
+            report_cpu("continuous", wall - last.wall, cpu - last.cpu,
+                       interval_frames);
+            last.wall = wall;
+            last.cpu = cpu;
+            interval_frames = 0;
+        }
+        eglutPostRedisplay();
+    } else {
+        /* covers the idle time since the previous redraw, which is what
+         * should be close to 0% */
+        report_cpu("redraw", wall - last.wall, cpu - last.cpu,
+                   interval_frames);
+        last.wall = wall;
+        last.cpu = cpu;
+        interval_frames = 0;
+    }
+}
 
+/* eglut's X11 loop only checks XPending() between redraws and calls
+ * this each time round, so without blocking here it spins a core while
+ * nothing happens.  Sleep on the X connection until there is an event,
+ * or SIGUSR1 interrupts the poll for a trace dump. */
+void idle() {
+    struct pollfd pfd;
+
+    trace_poll();
+
+    if (_eglut->redisplay || XPending(_eglut->native_dpy))
+        return;
+
+    pfd.fd = ConnectionNumber(_eglut->native_dpy);
+    pfd.events = POLLIN;
+    poll(&pfd, 1, -1);
+
+    trace_poll();
+}
+
+void reshape(int width, int height) {
+    glViewport(0, 0, width, height);
+    eglutPostRedisplay();
+}
+
+void keyboard(unsigned char key) {
+    if (key == 27 || key == 'q')
+        exit(EXIT_SUCCESS);
+
+    eglutPostRedisplay();
+}
+
+void special(int key) {
     eglutPostRedisplay();
 }
 
 int main(int argc, char **argv) {
+    const char *trace_path = NULL;
+    int i;
+
+    /* eglutInit() ignores arguments it does not know */
+    for (i = 1; i < argc; i++) {
+        if (strcmp("-c", argv[i]) == 0)
+            continuous = 1;
+        else if (strcmp("-T", argv[i]) == 0 && i + 1 < argc)
+            trace_path = argv[++i];
+    }
+
+    trace_init(trace_path);
+
     eglutInitWindowSize(512, 512);
     eglutInitAPIMask(EGLUT_OPENGL_ES2_BIT);
     eglutInit(argc, argv);
@@ -72,6 +198,10 @@ int main(int argc, char **argv) {
     eglutCreateWindow("Squares");
 
     eglutDisplayFunc(squares);
+    eglutIdleFunc(idle);
+    eglutReshapeFunc(reshape);
+    eglutKeyboardFunc(keyboard);
+    eglutSpecialFunc(special);
 
     /* OpenGL */
 
@@ -119,6 +249,14 @@ int main(int argc, char **argv) {
     color_l = glGetUniformLocation(p, "color_u");
     position_l = glGetAttribLocation(p, "position");
 
+    glUniformMatrix4fv(projection_l, 1, GL_FALSE, projection);
+    glVertexAttribPointer(position_l, 2, GL_FLOAT, GL_FALSE, 0, square);
+    glEnableVertexAttribArray(position_l);
+
+    start.wall = last.wall = wall_seconds();
+    start.cpu = last.cpu = cpu_seconds();
+    atexit(report_exit);
+
     eglutMainLoop();
 
     return 0;
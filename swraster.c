@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "swraster.h"
+#include "trace.h"
+
+void sw_fill_span(uint32_t *p, int n, uint32_t color) {
+#ifdef __SSE2__
+    __m128i c = _mm_set1_epi32(color);
+
+    for (; n > 0 && ((uintptr_t) p & 15); n--)
+        *p++ = color;
+
+    for (; n >= 16; n -= 16, p += 16) {
+        _mm_store_si128((__m128i *) p, c);
+        _mm_store_si128((__m128i *) (p + 4), c);
+        _mm_store_si128((__m128i *) (p + 8), c);
+        _mm_store_si128((__m128i *) (p + 12), c);
+    }
+    for (; n >= 4; n -= 4, p += 4)
+        _mm_store_si128((__m128i *) p, c);
+#endif
+
+    while (n-- > 0)
+        *p++ = color;
+}
+
+void sw_clear(const struct sw_surface *s, int y0, int y1, uint32_t color) {
+    int y;
+
+    /* with no padding the band is one span */
+    if (s->stride == s->width) {
+        sw_fill_span(s->pixels + (size_t) y0 * s->stride,
+                     (y1 - y0) * s->width, color);
+        return;
+    }
+
+    for (y = y0; y < y1; y++)
+        sw_fill_span(s->pixels + (size_t) y * s->stride, s->width, color);
+}
+
+/* the pixels from 0 to n - 1 whose centres lie in [lo, hi) */
+static int centres(double lo, double hi, int n, int *i0, int *i1) {
+    lo = ceil(lo - 0.5);
+    hi = ceil(hi - 0.5);
+    if (lo < 0)
+        lo = 0;
+    if (hi > n)
+        hi = n;
+    if (lo >= hi)
+        return 0;
+
+    *i0 = lo;
+    *i1 = hi;
+
+    return 1;
+}
+
+void sw_fill_rect(const struct sw_surface *s,
+                  int y0,
+                  int y1,
+                  float x0,
+                  float ry0,
+                  float x1,
+                  float ry1,
+                  uint32_t color) {
+    int i0, i1, j0, j1, j;
+
+    if (!centres(x0, x1, s->width, &i0, &i1) ||
+        !centres(ry0, ry1, y1, &j0, &j1))
+        return;
+    if (j0 < y0)
+        j0 = y0;
+
+    for (j = j0; j < j1; j++)
+        sw_fill_span(s->pixels + (size_t) j * s->stride + i0, i1 - i0, color);
+}
+
+/* x major: one pixel per column, in the row the line is in at the
+ * column's centre.  The columns are first cut down to about those where
+ * the line is inside the band. */
+static void line_x(const struct sw_surface *s,
+                   int y0,
+                   int y1,
+                   double ax,
+                   double ay,
+                   double bx,
+                   double by,
+                   uint32_t color) {
+    double slope = (by - ay) / (bx - ax), lo = ax, hi = bx, t0, t1, y;
+    int i, i0, i1;
+
+    if (slope != 0) {
+        t0 = ax + (y0 - ay) / slope;
+        t1 = ax + (y1 - ay) / slope;
+        if (t0 > t1) {
+            y = t0;
+            t0 = t1;
+            t1 = y;
+        }
+        if (t0 - 1 > lo)
+            lo = t0 - 1;
+        if (t1 + 1 < hi)
+            hi = t1 + 1;
+    }
+
+    if (!centres(lo, hi, s->width, &i0, &i1))
+        return;
+
+    y = ay + (i0 + 0.5 - ax) * slope;
+    for (i = i0; i < i1; i++, y += slope) {
+        if (y >= y0 && y < y1)
+            s->pixels[(size_t) (int) y * s->stride + i] = color;
+    }
+}
+
+/* y major, the same with rows, which the band cuts down directly */
+static void line_y(const struct sw_surface *s,
+                   int y0,
+                   int y1,
+                   double ax,
+                   double ay,
+                   double bx,
+                   double by,
+                   uint32_t color) {
+    double slope = (bx - ax) / (by - ay), x;
+    int j, j0, j1;
+
+    if (!centres(ay, by, y1, &j0, &j1))
+        return;
+    if (j0 < y0)
+        j0 = y0;
+
+    x = ax + (j0 + 0.5 - ay) * slope;
+    for (j = j0; j < j1; j++, x += slope) {
+        if (x >= 0 && x < s->width)
+            s->pixels[(size_t) j * s->stride + (int) x] = color;
+    }
+}
+
+void sw_lines(const struct sw_surface *s,
+              int y0,
+              int y1,
+              const float *v,
+              size_t n,
+              const double m[6],
+              uint32_t color) {
+    double ax, ay, bx, by;
+    size_t k;
+
+    for (k = 0; k + 1 < n; k += 2, v += 4) {
+        ay = m[3] * v[0] + m[4] * v[1] + m[5];
+        by = m[3] * v[2] + m[4] * v[3] + m[5];
+        if ((ay < y0 && by < y0) || (ay >= y1 && by >= y1))
+            continue;
+
+        ax = m[0] * v[0] + m[1] * v[1] + m[2];
+        bx = m[0] * v[2] + m[1] * v[3] + m[2];
+        if ((ax < 0 && bx < 0) || (ax >= s->width && bx >= s->width))
+            continue;
+
+        if (fabs(bx - ax) >= fabs(by - ay)) {
+            if (ax < bx)
+                line_x(s, y0, y1, ax, ay, bx, by, color);
+            else if (bx < ax)
+                line_x(s, y0, y1, bx, by, ax, ay, color);
+        } else if (ay < by) {
+            line_y(s, y0, y1, ax, ay, bx, by, color);
+        } else {
+            line_y(s, y0, y1, bx, by, ax, ay, color);
+        }
+    }
+}
+
+static void pool_band(struct sw_pool *p, int i) {
+    TRACE_SCOPE("sw_band");
+
+    p->fn(p->data, (int64_t) p->height * i / p->n_threads,
+          (int64_t) p->height * (i + 1) / p->n_threads);
+}
+
+static void *pool_worker(void *arg) {
+    struct sw_pool *p = arg;
+    uint64_t seen = 0;
+    int i;
+
+    trace_thread_init("sw_band");
+
+    pthread_mutex_lock(&p->lock);
+    /* the index is handed out in creation order */
+    i = ++p->pending;
+    pthread_cond_signal(&p->done);
+
+    for (;;) {
+        while (p->generation == seen && !p->quit)
+            pthread_cond_wait(&p->start, &p->lock);
+        if (p->quit)
+            break;
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        pool_band(p, i);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->pending == 0)
+            pthread_cond_signal(&p->done);
+    }
+
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+void sw_pool_init(struct sw_pool *p, int n_threads) {
+    int i;
+
+    memset(p, 0, sizeof *p);
+
+    if (n_threads <= 0)
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_threads < 1)
+        n_threads = 1;
+    if (n_threads > SW_MAX_THREADS)
+        n_threads = SW_MAX_THREADS;
+    p->n_threads = n_threads;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    pthread_mutex_lock(&p->lock);
+    for (i = 1; i < n_threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, pool_worker, p) != 0) {
+            fprintf(stderr, "sw pool: could only start %d threads\n", i);
+            p->n_threads = i;
+            break;
+        }
+    }
+    while (p->pending < p->n_threads - 1)
+        pthread_cond_wait(&p->done, &p->lock);
+    p->pending = 0;
+    pthread_mutex_unlock(&p->lock);
+
+    printf("sw pool: %d band threads\n", p->n_threads);
+}
+
+void sw_pool_fini(struct sw_pool *p) {
+    int i;
+
+    if (!p->n_threads)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = 1;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i = 1; i < p->n_threads; i++)
+        pthread_join(p->threads[i], NULL);
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->start);
+    pthread_cond_destroy(&p->done);
+    p->n_threads = 0;
+}
+
+void sw_pool_run(struct sw_pool *p, sw_band_fn fn, void *data, int height) {
+    p->fn = fn;
+    p->data = data;
+    p->height = height;
+
+    if (p->n_threads == 1) {
+        pool_band(p, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->pending = p->n_threads - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    pool_band(p, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->pending)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,72 @@
+#ifndef SWRASTER_H
+#define SWRASTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SW_MAX_THREADS 64
+
+/* CPU rasterizer for the wl_shm backend, for machines where EGL would
+ * only mean llvmpipe: a whole GL stack to draw rectangles and lines.
+ *
+ * Everything draws into one horizontal band [y0, y1) of the surface at a
+ * time, so a frame is split into as many bands as there are threads and
+ * each thread writes rows nobody else touches.  Spans are filled with
+ * SSE2 stores where available.  Pixels are 32 bit XRGB8888 and row 0 is
+ * the top of the surface. */
+struct sw_surface {
+    uint32_t *pixels;
+    int width, height;
+    int stride; /* in pixels */
+};
+
+/* n pixels from p */
+void sw_fill_span(uint32_t *p, int n, uint32_t color);
+
+void sw_clear(const struct sw_surface *s, int y0, int y1, uint32_t color);
+
+/* the pixels whose centres lie in [x0, x1) x [ry0, ry1), in band rows */
+void sw_fill_rect(const struct sw_surface *s,
+                  int y0,
+                  int y1,
+                  float x0,
+                  float ry0,
+                  float x1,
+                  float ry1,
+                  uint32_t color);
+
+/* n / 2 one pixel wide GL_LINES, the vertices transformed to pixels by
+ * (x, y) -> (m[0] x + m[1] y + m[2], m[3] x + m[4] y + m[5]), in band
+ * rows.  Much like GL, a line gets one pixel in each column (or row, if
+ * steep) whose centre lies between its end points. */
+void sw_lines(const struct sw_surface *s,
+              int y0,
+              int y1,
+              const float *v,
+              size_t n,
+              const double m[6],
+              uint32_t color);
+
+/* Band workers.  sw_pool_run() calls fn once per band, on the calling
+ * thread and n_threads - 1 others, and returns when all are done. */
+typedef void (*sw_band_fn)(void *data, int y0, int y1);
+
+struct sw_pool {
+    int n_threads;
+    pthread_t threads[SW_MAX_THREADS];
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+
+    sw_band_fn fn;
+    void *data;
+    int height, pending, quit;
+    uint64_t generation;
+};
+
+/* n_threads <= 0 is one per online CPU */
+void sw_pool_init(struct sw_pool *p, int n_threads);
+void sw_pool_fini(struct sw_pool *p);
+void sw_pool_run(struct sw_pool *p, sw_band_fn fn, void *data, int height);
+
+#endif
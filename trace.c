@@ -0,0 +1,182 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE (1 << 16) /* events per thread, power of two */
+#define TRACE_MAX_THREADS 32
+
+struct trace_event {
+    const char *name;
+    uint64_t start, end;
+};
+
+struct trace_buffer {
+    const char *name;
+    pid_t tid;
+    uint64_t head;
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+int trace_enabled = 0;
+
+static const char *trace_path;
+static uint64_t trace_epoch;
+static struct trace_buffer *buffers[TRACE_MAX_THREADS];
+static int n_buffers;
+static volatile sig_atomic_t dump_requested;
+
+static __thread struct trace_buffer *local;
+
+static void signal_usr1(int signum) {
+    (void) signum;
+    dump_requested = 1;
+}
+
+void trace_thread_init(const char *name) {
+    struct trace_buffer *b;
+    int slot;
+
+    if (!__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) || local)
+        return;
+
+    slot = __atomic_fetch_add(&n_buffers, 1, __ATOMIC_ACQ_REL);
+    if (slot >= TRACE_MAX_THREADS) {
+        fprintf(stderr, "trace: too many threads, not tracing %s\n", name);
+        return;
+    }
+
+    b = calloc(1, sizeof *b);
+    if (!b) {
+        fprintf(stderr, "trace: out of memory, not tracing %s\n", name);
+        return;
+    }
+    b->name = name;
+    b->tid = syscall(SYS_gettid);
+
+    local = b;
+    __atomic_store_n(&buffers[slot], b, __ATOMIC_RELEASE);
+}
+
+void trace_init(const char *path) {
+    struct sigaction sigusr1;
+
+    if (!path)
+        return;
+
+    trace_path = path;
+    trace_epoch = trace_now();
+    trace_enabled = 1;
+    trace_thread_init("main");
+
+    sigusr1.sa_handler = signal_usr1;
+    sigemptyset(&sigusr1.sa_mask);
+    sigusr1.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sigusr1, NULL);
+}
+
+void trace_record(const char *name, uint64_t start, uint64_t end) {
+    struct trace_buffer *b = local;
+    struct trace_event *e;
+
+    if (!b)
+        return;
+
+    e = &b->events[b->head & (TRACE_RING_SIZE - 1)];
+    /* trace_dump() on another thread may be reading the event this
+     * overwrites; the fence orders the last head before it, which is how
+     * the dump tells */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&e->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->start, start, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->end, end, __ATOMIC_RELAXED);
+
+    /* publish only once the event is complete */
+    __atomic_store_n(&b->head, b->head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_dump(void) {
+    struct trace_buffer *b;
+    struct trace_event *e, event;
+    uint64_t head, i;
+    int n, t, first = 1;
+    pid_t pid = getpid();
+    FILE *f;
+
+    if (!trace_enabled)
+        return;
+
+    f = fopen(trace_path, "w");
+    if (!f) {
+        perror("trace: fopen");
+        return;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    n = __atomic_load_n(&n_buffers, __ATOMIC_ACQUIRE);
+    if (n > TRACE_MAX_THREADS)
+        n = TRACE_MAX_THREADS;
+
+    for (t = 0; t < n; t++) {
+        b = __atomic_load_n(&buffers[t], __ATOMIC_ACQUIRE);
+        if (!b)
+            continue;
+
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",", pid, b->tid, b->name);
+        first = 0;
+
+        head = __atomic_load_n(&b->head, __ATOMIC_ACQUIRE);
+        i = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (; i < head; i++) {
+            e = &b->events[i & (TRACE_RING_SIZE - 1)];
+            event.name = __atomic_load_n(&e->name, __ATOMIC_RELAXED);
+            event.start = __atomic_load_n(&e->start, __ATOMIC_RELAXED);
+            event.end = __atomic_load_n(&e->end, __ATOMIC_RELAXED);
+            /* skip it if its thread has lapped the ring since, as it
+             * may have been overwritten halfway through the loads */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&b->head, __ATOMIC_RELAXED) >=
+                i + TRACE_RING_SIZE)
+                continue;
+
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+                    "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name, pid, b->tid,
+                    (event.start - trace_epoch) / 1e3,
+                    (event.end - event.start) / 1e3);
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    fprintf(stderr, "trace written to %s\n", trace_path);
+}
+
+void trace_poll(void) {
+    if (!dump_requested)
+        return;
+
+    dump_requested = 0;
+    trace_dump();
+}
+
+/* The rings are not freed: a traced thread that is still running, such
+ * as a worker that is never joined, may be inside a scope and record into
+ * its ring after this.  They go with the process. */
+void trace_fini(void) {
+    if (!trace_enabled)
+        return;
+
+    trace_dump();
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELAXED);
+}
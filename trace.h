@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Frame phase tracing.  TRACE_SCOPE("name") records the time from the
+ * point of declaration to the end of the enclosing block into a ring
+ * buffer owned by the calling thread; nothing is allocated or written
+ * out on that path.  The rings are written as Chrome trace-event JSON
+ * (chrome://tracing, ui.perfetto.dev) by trace_fini(), or whenever the
+ * process receives SIGUSR1 and the main loop calls trace_poll().
+ *
+ * Names must be string literals, only the pointer is stored. */
+
+struct trace_scope {
+    const char *name;
+    uint64_t start;
+};
+
+extern int trace_enabled;
+
+/* path == NULL leaves tracing disabled; also sets up the calling thread */
+void trace_init(const char *path);
+/* dumps and stops new scopes; the rings stay, so other threads may still
+ * be recording */
+void trace_fini(void);
+
+/* every other thread that traces calls this once before its first scope */
+void trace_thread_init(const char *name);
+
+void trace_poll(void);
+/* safe while other threads record: events they overwrite during the
+ * dump are left out */
+void trace_dump(void);
+
+/* CLOCK_MONOTONIC in ns, the one clock of everything that is timed, so
+ * it is inline for the programs that don't link trace.c */
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace_record(const char *name, uint64_t start, uint64_t end);
+
+static inline struct trace_scope trace_scope_begin(const char *name) {
+    struct trace_scope scope = {
+        name, __atomic_load_n(&trace_enabled, __ATOMIC_RELAXED) ?
+              trace_now() : 0
+    };
+
+    return scope;
+}
+
+static inline void trace_scope_end(struct trace_scope *scope) {
+    if (scope->start)
+        trace_record(scope->name, scope->start, trace_now());
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#define TRACE_SCOPE(name)                                           \
+    struct trace_scope TRACE_CONCAT(trace_scope_, __LINE__)        \
+        __attribute__((cleanup(trace_scope_end))) =                 \
+        trace_scope_begin(name)
+
+#endif
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wlprof.h"
+#include "trace.h"
+
+#define WLPROF_MAX_INTERFACES 128
+#define WLPROF_MAX_FDS 28      /* per sendmsg() in libwayland */
+#define WLPROF_BUFFER_SIZE 16384
+#define WLPROF_SERVER_ID_START 0xff000000
+
+enum direction {
+    REQUEST,
+    EVENT
+};
+
+static const char *const arrows[] = { "->", "<-" };
+
+struct object {
+    const struct wl_interface *interface;
+    const char *name; /* bound with, for interfaces with no table */
+};
+
+struct object_map {
+    struct object *objects;
+    uint32_t size;
+};
+
+struct counter {
+    const char *interface, *message;
+    uint32_t opcode;
+    enum direction direction;
+    uint64_t count, bytes;
+};
+
+/* bytes of one direction not parsed yet, for messages split over reads */
+struct stream {
+    char data[2 * WLPROF_BUFFER_SIZE];
+    size_t length;
+};
+
+int wlprof_enabled = 0;
+
+static const struct wl_interface *interfaces[WLPROF_MAX_INTERFACES];
+static int n_interfaces;
+
+/* client allocated ids, and server allocated ones from 0xff000000 */
+static struct object_map client_objects, server_objects;
+
+static char **names;
+static int n_names;
+
+static pthread_t thread;
+static int client_fd = -1, server_fd = -1;
+static struct stream streams[2];
+
+/* everything below is shared with the relay thread */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct counter *counters;
+static int n_counters, max_counters;
+static uint64_t frames, messages[2], bytes[2], flushes, roundtrips;
+static uint64_t frame_messages, max_frame_messages, desyncs;
+
+static int arg_count(const char *signature) {
+    int n = 0;
+
+    for (; *signature; signature++)
+        if (*signature != '?' && (*signature < '0' || *signature > '9'))
+            n++;
+
+    return n;
+}
+
+static void add_interface(const struct wl_interface *interface);
+
+static void add_message_types(const struct wl_message *messages, int n) {
+    int i, j;
+
+    for (i = 0; i < n; i++)
+        for (j = 0; j < arg_count(messages[i].signature); j++)
+            add_interface(messages[i].types[j]);
+}
+
+/* the interface and every one its messages create, recursively */
+static void add_interface(const struct wl_interface *interface) {
+    int i;
+
+    if (!interface)
+        return;
+    for (i = 0; i < n_interfaces; i++)
+        if (interfaces[i] == interface)
+            return;
+    if (n_interfaces == WLPROF_MAX_INTERFACES)
+        return;
+
+    interfaces[n_interfaces++] = interface;
+    add_message_types(interface->methods, interface->method_count);
+    add_message_types(interface->events, interface->event_count);
+}
+
+static const struct wl_interface *find_interface(const char *name) {
+    int i;
+
+    for (i = 0; i < n_interfaces; i++)
+        if (strcmp(interfaces[i]->name, name) == 0)
+            return interfaces[i];
+
+    return NULL;
+}
+
+/* names of bound interfaces with no table, kept for the counters */
+static const char *intern(const char *name) {
+    char **grown;
+    int i;
+
+    for (i = 0; i < n_names; i++)
+        if (strcmp(names[i], name) == 0)
+            return names[i];
+
+    grown = realloc(names, (n_names + 1) * sizeof *names);
+    if (!grown)
+        return "unknown";
+    names = grown;
+    names[n_names] = strdup(name);
+
+    return names[n_names] ? names[n_names++] : "unknown";
+}
+
+static struct object *lookup(uint32_t id, int create) {
+    struct object_map *map = &client_objects;
+    struct object *grown;
+    uint32_t size;
+
+    if (id >= WLPROF_SERVER_ID_START) {
+        map = &server_objects;
+        id -= WLPROF_SERVER_ID_START;
+    }
+
+    if (id >= map->size) {
+        if (!create)
+            return NULL;
+        size = map->size ? map->size : 64;
+        while (size <= id)
+            size *= 2;
+        grown = realloc(map->objects, size * sizeof *grown);
+        if (!grown)
+            return NULL;
+        memset(grown + map->size, 0, (size - map->size) * sizeof *grown);
+        map->objects = grown;
+        map->size = size;
+    }
+
+    return &map->objects[id];
+}
+
+static void count(const char *interface, const char *message,
+                  uint32_t opcode, enum direction direction, uint32_t size) {
+    struct counter *c, *grown;
+    int i;
+
+    for (i = 0; i < n_counters; i++) {
+        c = &counters[i];
+        if (c->interface == interface && c->opcode == opcode &&
+            c->direction == direction)
+            break;
+    }
+
+    if (i == n_counters) {
+        if (n_counters == max_counters) {
+            max_counters = max_counters ? max_counters * 2 : 64;
+            grown = realloc(counters, max_counters * sizeof *grown);
+            if (!grown) {
+                max_counters = n_counters;
+                return;
+            }
+            counters = grown;
+        }
+        c = &counters[n_counters++];
+        c->interface = interface;
+        c->message = message;
+        c->opcode = opcode;
+        c->direction = direction;
+        c->count = c->bytes = 0;
+    }
+
+    c->count++;
+    c->bytes += size;
+}
+
+/* Walk the arguments for new_id ones and record the objects they
+ * create.  An untyped new_id (wl_registry.bind) takes its interface
+ * from the string before it. */
+static void track_new_ids(const struct wl_message *message,
+                          const char *p, const char *end) {
+    const char *signature, *string = NULL;
+    const struct wl_interface *interface;
+    struct object *object;
+    uint32_t length, id;
+    int i = 0;
+
+    for (signature = message->signature; *signature; signature++) {
+        if (*signature == '?' || (*signature >= '0' && *signature <= '9'))
+            continue;
+        if (*signature != 'h' && p + 4 > end)
+            return;
+
+        switch (*signature) {
+        case 's':
+        case 'a':
+            memcpy(&length, p, 4);
+            p += 4;
+            if (length > (size_t) (end - p))
+                return;
+            string = *signature == 's' && length &&
+                p[length - 1] == '\0' ? p : NULL;
+            p += (length + 3) & ~3u;
+            break;
+        case 'n':
+            memcpy(&id, p, 4);
+            p += 4;
+            interface = message->types[i];
+            if (!interface && string)
+                interface = find_interface(string);
+            object = id ? lookup(id, 1) : NULL;
+            if (object) {
+                object->interface = interface;
+                object->name = interface || !string ? NULL : intern(string);
+            }
+            break;
+        case 'h':
+            break;
+        default:
+            p += 4;
+            break;
+        }
+        i++;
+    }
+}
+
+static void handle_message(enum direction direction, const char *data,
+                           uint32_t size) {
+    const struct wl_interface *interface = NULL;
+    const struct wl_message *message = NULL;
+    const char *name = "unknown";
+    struct object *object;
+    uint32_t id, opcode;
+
+    memcpy(&id, data, 4);
+    memcpy(&opcode, data + 4, 4);
+    opcode &= 0xffff;
+
+    object = lookup(id, 0);
+    if (object) {
+        interface = object->interface;
+        if (interface)
+            name = interface->name;
+        else if (object->name)
+            name = object->name;
+    }
+
+    if (interface && direction == REQUEST &&
+        opcode < (uint32_t) interface->method_count)
+        message = &interface->methods[opcode];
+    else if (interface && direction == EVENT &&
+             opcode < (uint32_t) interface->event_count)
+        message = &interface->events[opcode];
+
+    count(name, message ? message->name : NULL, opcode, direction, size);
+    messages[direction]++;
+    frame_messages++;
+
+    if (interface == &wl_display_interface && direction == REQUEST &&
+        opcode == WL_DISPLAY_SYNC)
+        roundtrips++;
+
+    if (message)
+        track_new_ids(message, data + 8, data + size);
+}
+
+/* called with the lock held */
+static void parse(enum direction direction, const char *data, size_t n) {
+    struct stream *s = &streams[direction];
+    uint32_t word, size;
+    size_t offset = 0;
+
+    if (n > sizeof s->data - s->length) {
+        /* can't be a stream of valid messages; start over */
+        desyncs++;
+        s->length = 0;
+        return;
+    }
+    memcpy(s->data + s->length, data, n);
+    s->length += n;
+
+    while (s->length - offset >= 8) {
+        memcpy(&word, s->data + offset + 4, 4);
+        size = word >> 16;
+        if (size < 8 || size % 4) {
+            desyncs++;
+            s->length = 0;
+            return;
+        }
+        if (size > s->length - offset)
+            break;
+
+        handle_message(direction, s->data + offset, size);
+        offset += size;
+    }
+
+    memmove(s->data, s->data + offset, s->length - offset);
+    s->length -= offset;
+}
+
+/* Move one read's worth of bytes and fds from one side to the other,
+ * fds along with the bytes they came with.  0 once either side closed. */
+static int relay(int from, int to, enum direction direction) {
+    char data[WLPROF_BUFFER_SIZE];
+    char control[CMSG_SPACE(WLPROF_MAX_FDS * sizeof(int))];
+    struct iovec iov = { data, sizeof data };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    int fds[WLPROF_MAX_FDS], n_fds = 0, i;
+    ssize_t n, sent, done = 0;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+
+    do
+        n = recvmsg(from, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return 0;
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+        }
+
+    msg.msg_controllen = n_fds ? CMSG_SPACE(n_fds * sizeof(int)) : 0;
+    if (!n_fds)
+        msg.msg_control = NULL;
+    else {
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+    }
+
+    while (done < n) {
+        iov.iov_base = data + done;
+        iov.iov_len = n - done;
+        sent = sendmsg(to, &msg, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent < 0)
+            break;
+        done += sent;
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+    }
+
+    for (i = 0; i < n_fds; i++)
+        close(fds[i]);
+
+    pthread_mutex_lock(&lock);
+    bytes[direction] += n;
+    if (direction == REQUEST)
+        flushes++;
+    parse(direction, data, n);
+    pthread_mutex_unlock(&lock);
+
+    return done == n;
+}
+
+static void *relay_thread(void *data) {
+    struct pollfd fds[2] = {
+        { .fd = client_fd, .events = POLLIN },
+        { .fd = server_fd, .events = POLLIN },
+    };
+    int i;
+
+    trace_thread_init("wlprof");
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < 2; i++)
+            if (fds[i].revents && !relay(fds[i].fd, fds[!i].fd, i))
+                goto done;
+    }
+
+done:
+    /* the client sees the connection close too */
+    shutdown(client_fd, SHUT_RDWR);
+    shutdown(server_fd, SHUT_RDWR);
+
+    return NULL;
+}
+
+/* the same socket wl_display_connect(NULL) would use */
+static int connect_compositor(void) {
+    const char *name = getenv("WAYLAND_DISPLAY");
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    const char *socket_env = getenv("WAYLAND_SOCKET");
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd, n;
+
+    if (socket_env) {
+        unsetenv("WAYLAND_SOCKET");
+        return atoi(socket_env);
+    }
+
+    if (!name)
+        name = "wayland-0";
+    if (name[0] == '/')
+        n = snprintf(addr.sun_path, sizeof addr.sun_path, "%s", name);
+    else if (dir)
+        n = snprintf(addr.sun_path, sizeof addr.sun_path, "%s/%s",
+                     dir, name);
+    else {
+        fprintf(stderr, "wlprof: XDG_RUNTIME_DIR not set\n");
+        return -1;
+    }
+    if (n >= (int) sizeof addr.sun_path) {
+        fprintf(stderr, "wlprof: socket path too long\n");
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+        fprintf(stderr, "wlprof: %s: %s\n", addr.sun_path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int wlprof_init(const struct wl_interface *const *extra) {
+    static const struct wl_interface *const core[] = {
+        &wl_display_interface,
+        &wl_compositor_interface,
+        &wl_subcompositor_interface,
+        &wl_shm_interface,
+        &wl_seat_interface,
+        &wl_output_interface,
+        &wl_data_device_manager_interface,
+        &wl_shell_interface,
+        NULL
+    };
+    int pair[2], i;
+
+    server_fd = connect_compositor();
+    if (server_fd < 0)
+        return -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+        fprintf(stderr, "wlprof: socketpair: %s\n", strerror(errno));
+        close(server_fd);
+        return -1;
+    }
+    client_fd = pair[1];
+
+    for (i = 0; core[i]; i++)
+        add_interface(core[i]);
+    for (i = 0; extra && extra[i]; i++)
+        add_interface(extra[i]);
+    lookup(1, 1)->interface = &wl_display_interface;
+
+    if (pthread_create(&thread, NULL, relay_thread, NULL) != 0) {
+        fprintf(stderr, "wlprof: can't start the relay thread\n");
+        close(pair[0]);
+        close(pair[1]);
+        close(server_fd);
+        return -1;
+    }
+
+    wlprof_enabled = 1;
+    printf("wlprof: profiling %d interfaces\n", n_interfaces);
+
+    return pair[0];
+}
+
+void wlprof_fini(void) {
+    int i;
+
+    if (!wlprof_enabled)
+        return;
+
+    /* the relay ends when wl_display_disconnect() closes the client end */
+    pthread_join(thread, NULL);
+    close(client_fd);
+    close(server_fd);
+
+    for (i = 0; i < n_names; i++)
+        free(names[i]);
+    free(names);
+    free(client_objects.objects);
+    free(server_objects.objects);
+    free(counters);
+    wlprof_enabled = 0;
+}
+
+void wlprof_frame(void) {
+    if (!wlprof_enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+    frames++;
+    if (frame_messages > max_frame_messages)
+        max_frame_messages = frame_messages;
+    frame_messages = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+static int by_count(const void *a, const void *b) {
+    const struct counter *ca = a, *cb = b;
+
+    if (ca->direction != cb->direction)
+        return ca->direction - cb->direction;
+
+    return ca->count < cb->count ? 1 : ca->count > cb->count ? -1 : 0;
+}
+
+void wlprof_report(void) {
+    struct counter *c;
+    double n;
+    int i;
+
+    if (!wlprof_enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    n = frames ? frames : 1;
+    printf("wayland: %.1f requests (%.0f bytes), %.1f events (%.0f bytes), "
+           "%.2f flushes, %.2f roundtrips per frame, "
+           "at most %llu messages in a frame\n",
+           messages[REQUEST] / n, bytes[REQUEST] / n,
+           messages[EVENT] / n, bytes[EVENT] / n,
+           flushes / n, roundtrips / n,
+           (unsigned long long) max_frame_messages);
+    if (flushes)
+        printf("wayland: %.0f bytes per flush\n",
+               (double) bytes[REQUEST] / flushes);
+    if (desyncs)
+        printf("wayland: lost track of the stream %llu times\n",
+               (unsigned long long) desyncs);
+
+    qsort(counters, n_counters, sizeof *counters, by_count);
+    for (i = 0; i < n_counters; i++) {
+        c = &counters[i];
+        if (!c->count)
+            continue;
+        if (c->message)
+            printf("  %s %s.%s: %.2f per frame, %.0f bytes\n",
+                   arrows[c->direction], c->interface, c->message,
+                   c->count / n, c->bytes / n);
+        else
+            printf("  %s %s#%u: %.2f per frame, %.0f bytes\n",
+                   arrows[c->direction], c->interface, c->opcode,
+                   c->count / n, c->bytes / n);
+        c->count = c->bytes = 0;
+    }
+
+    frames = flushes = roundtrips = 0;
+    messages[REQUEST] = messages[EVENT] = 0;
+    bytes[REQUEST] = bytes[EVENT] = 0;
+    max_frame_messages = desyncs = 0;
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,37 @@
+#ifndef WLPROF_H
+#define WLPROF_H
+
+#include <wayland-client.h>
+
+/* Wayland protocol traffic profiler.
+ *
+ * wlprof_init() connects to the compositor itself and hands the client
+ * one end of a socket pair for wl_display_connect_to_fd().  A thread
+ * relays the bytes and file descriptors between the two unchanged and
+ * decodes the wire format on the way, counting every request and event
+ * by interface and message, the bytes of each, the writes the client
+ * makes (one per flush, unless two arrive before the relay reads) and
+ * wl_display.sync requests, each of which is a round trip.
+ *
+ * Object ids are followed through the new_id arguments of the messages,
+ * using the signatures in the wl_interface tables of libwayland-client
+ * plus any passed to wlprof_init().  Objects of interfaces it has no
+ * table for, such as those EGL binds internally, are counted under the
+ * name they were bound with, and objects they create as unknown. */
+
+extern int wlprof_enabled;
+
+/* returns the fd for wl_display_connect_to_fd(), or -1 after printing
+ * why; interfaces is NULL terminated */
+int wlprof_init(const struct wl_interface *const *interfaces);
+
+/* after wl_display_disconnect() */
+void wlprof_fini(void);
+
+/* mark the end of a frame */
+void wlprof_frame(void);
+
+/* print per frame averages since the last report and reset them */
+void wlprof_report(void);
+
+#endif